@@ -0,0 +1,601 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include "pberr.h"
+
+// The benchmarks compare the secured functions to their standard
+// counterpart, they need the secured malloc and I/O
+#if !defined(PBERRALL)
+  #error "bench.c must be compiled with -DPBERRALL"
+#endif
+
+// Build mode reported in the results
+#if defined(BUILDMODE)
+  #define BENCH_MODE BUILDMODE
+#else
+  #define BENCH_MODE 0
+#endif
+
+// Number of repetitions of each benchmark, the best one is kept
+#define BENCH_NBREP 5
+// Number of threads of the multi-threaded benchmarks
+#define BENCH_NBTHREAD 4
+// Maximum number of entries in the baseline
+#define BENCH_NBMAXBASE 256
+// Length max of the name of a benchmark
+#define BENCH_NAMELENGTHMAX 64
+// Minimum regression in nanoseconds to be reported, under it the
+// difference is considered as noise
+#define BENCH_MINREGRESSION 2.0
+
+// Entry of the baseline
+typedef struct BenchBase {
+  int _mode;
+  char _name[BENCH_NAMELENGTHMAX];
+  double _ns;
+} BenchBase;
+
+// Baseline loaded from the file given in argument
+BenchBase benchBase[BENCH_NBMAXBASE];
+int benchNbBase = 0;
+// Tolerance in percent before a result is considered as a regression
+double benchTolerance = 20.0;
+// Number of regressions
+int benchNbRegression = 0;
+
+// Stream on /dev/null used as output of the benchmarks
+FILE* benchNull = NULL;
+// Sink for the results of the benchmarks, to avoid them being
+// optimized out
+volatile long benchSink = 0;
+
+// Return the monotonic time in nanoseconds
+uint64_t BenchNow(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+// Load the baseline from the file at 'path'. Lines are
+// '<mode> <name> <ns per op> ...', lines starting with '#' are ignored
+void BenchLoadBase(const char* const path) {
+  FILE* fd = fopen(path, "r");
+  if (fd == NULL)
+    return;
+  char line[256];
+  while (benchNbBase < BENCH_NBMAXBASE &&
+    fgets(line, 256, fd) != NULL) {
+    BenchBase* base = benchBase + benchNbBase;
+    if (line[0] != '#' &&
+      sscanf(line, "%d %63s %lf", &(base->_mode), base->_name,
+      &(base->_ns)) == 3)
+      ++benchNbBase;
+  }
+  fclose(fd);
+}
+
+// Print the result 'ns' in nanoseconds per operation of the
+// benchmark 'name', and compare it to the baseline
+void BenchReport(const char* const name, const double ns) {
+  printf("%d %-28s %10.1f", BENCH_MODE, name, ns);
+  for (int iBase = 0; iBase < benchNbBase; ++iBase) {
+    BenchBase* base = benchBase + iBase;
+    if (base->_mode != BENCH_MODE || strcmp(base->_name, name) != 0)
+      continue;
+    printf(" %10.1f %+7.1f%%", base->_ns,
+      (ns - base->_ns) / base->_ns * 100.0);
+    if (ns > base->_ns * (1.0 + benchTolerance / 100.0) &&
+      ns - base->_ns > BENCH_MINREGRESSION) {
+      printf(" REGRESSION");
+      ++benchNbRegression;
+    }
+    break;
+  }
+  printf("\n");
+  fflush(stdout);
+}
+
+// Run BENCH_NBREP times 'nbIter' iterations of 'fun' and report the
+// best time per iteration under the name 'name'
+void BenchRun(const char* const name, void (*fun)(long),
+  const long nbIter) {
+  double best = -1.0;
+  for (int iRep = 0; iRep < BENCH_NBREP; ++iRep) {
+    uint64_t start = BenchNow();
+    fun(nbIter);
+    double ns = (double)(BenchNow() - start) / (double)nbIter;
+    if (best < 0.0 || ns < best)
+      best = ns;
+  }
+  BenchReport(name, best);
+}
+
+// ---------------- Malloc ----------------
+
+// The pointers are volatile, else the compiler removes the malloc/free
+// pairs
+
+void BenchMalloc64(long nb) {
+  for (long i = 0; i < nb; ++i) {
+    char* volatile ptr = malloc(64);
+    ptr[0] = (char)i;
+    benchSink += ptr[0];
+    free(ptr);
+  }
+}
+
+void BenchPBErrMalloc64(long nb) {
+  for (long i = 0; i < nb; ++i) {
+    char* volatile ptr = PBErrMalloc(&thePBErr, 64);
+    ptr[0] = (char)i;
+    benchSink += ptr[0];
+    PBErrFree(&thePBErr, ptr);
+  }
+}
+
+void BenchMalloc4k(long nb) {
+  for (long i = 0; i < nb; ++i) {
+    char* volatile ptr = malloc(4096);
+    ptr[0] = (char)i;
+    benchSink += ptr[0];
+    free(ptr);
+  }
+}
+
+void BenchPBErrMalloc4k(long nb) {
+  for (long i = 0; i < nb; ++i) {
+    char* volatile ptr = PBErrMalloc(&thePBErr, 4096);
+    ptr[0] = (char)i;
+    benchSink += ptr[0];
+    PBErrFree(&thePBErr, ptr);
+  }
+}
+
+// ---------------- Printf ----------------
+
+void BenchFprintfShort(long nb) {
+  for (long i = 0; i < nb; ++i)
+    fprintf(benchNull, "%hd ", (short)i);
+}
+
+void BenchPBErrPrintfShort(long nb) {
+  for (long i = 0; i < nb; ++i)
+    PBErrPrintf(&thePBErr, benchNull, "%hd ", (short)i);
+}
+
+void BenchFprintfInt(long nb) {
+  for (long i = 0; i < nb; ++i)
+    fprintf(benchNull, "%d ", (int)i);
+}
+
+void BenchPBErrPrintfInt(long nb) {
+  for (long i = 0; i < nb; ++i)
+    PBErrPrintf(&thePBErr, benchNull, "%d ", (int)i);
+}
+
+void BenchFprintfLong(long nb) {
+  for (long i = 0; i < nb; ++i)
+    fprintf(benchNull, "%ld ", i);
+}
+
+void BenchPBErrPrintfLong(long nb) {
+  for (long i = 0; i < nb; ++i)
+    PBErrPrintf(&thePBErr, benchNull, "%ld ", i);
+}
+
+void BenchFprintfFloat(long nb) {
+  for (long i = 0; i < nb; ++i)
+    fprintf(benchNull, "%f ", (float)i * 0.5f);
+}
+
+void BenchPBErrPrintfFloat(long nb) {
+  for (long i = 0; i < nb; ++i)
+    PBErrPrintf(&thePBErr, benchNull, "%f ", (float)i * 0.5f);
+}
+
+void BenchFprintfStr(long nb) {
+  for (long i = 0; i < nb; ++i)
+    fprintf(benchNull, "%s ", "benchmark");
+}
+
+void BenchPBErrPrintfStr(long nb) {
+  char* str = "benchmark";
+  for (long i = 0; i < nb; ++i)
+    PBErrPrintf(&thePBErr, benchNull, "%s ", str);
+}
+
+// ---------------- Scanf ----------------
+
+// Stream containing the values read by the scanf benchmarks
+FILE* benchIn = NULL;
+
+// Fill benchIn with 'nb' values formatted with 'format', then rewind
+// it. The value i is the integer i, or i / 2 for floats
+void BenchPrepareIn(const char* const format, const bool isFloat,
+  const long nb) {
+  if (benchIn != NULL)
+    fclose(benchIn);
+  benchIn = tmpfile();
+  if (benchIn == NULL) {
+    fprintf(stderr, "tmpfile failed\n");
+    exit(1);
+  }
+  for (long i = 0; i < nb; ++i) {
+    if (isFloat)
+      fprintf(benchIn, format, (double)(i % 1000) * 0.5);
+    else
+      fprintf(benchIn, format, (int)(i % 1000));
+  }
+  rewind(benchIn);
+}
+
+void BenchFscanfShort(long nb) {
+  rewind(benchIn);
+  short v = 0;
+  for (long i = 0; i < nb; ++i) {
+    if (fscanf(benchIn, "%hd", &v) != 1)
+      exit(1);
+    benchSink += v;
+  }
+}
+
+void BenchPBErrScanfShort(long nb) {
+  rewind(benchIn);
+  short v = 0;
+  for (long i = 0; i < nb; ++i) {
+    PBErrScanf(&thePBErr, benchIn, "%hd", &v);
+    benchSink += v;
+  }
+}
+
+void BenchFscanfInt(long nb) {
+  rewind(benchIn);
+  int v = 0;
+  for (long i = 0; i < nb; ++i) {
+    if (fscanf(benchIn, "%d", &v) != 1)
+      exit(1);
+    benchSink += v;
+  }
+}
+
+void BenchPBErrScanfInt(long nb) {
+  rewind(benchIn);
+  int v = 0;
+  for (long i = 0; i < nb; ++i) {
+    PBErrScanf(&thePBErr, benchIn, "%d", &v);
+    benchSink += v;
+  }
+}
+
+void BenchFscanfFloat(long nb) {
+  rewind(benchIn);
+  float v = 0.0f;
+  for (long i = 0; i < nb; ++i) {
+    if (fscanf(benchIn, "%f", &v) != 1)
+      exit(1);
+    benchSink += (long)v;
+  }
+}
+
+void BenchPBErrScanfFloat(long nb) {
+  rewind(benchIn);
+  float v = 0.0f;
+  for (long i = 0; i < nb; ++i) {
+    PBErrScanf(&thePBErr, benchIn, "%f", &v);
+    benchSink += (long)v;
+  }
+}
+
+void BenchFscanfStr(long nb) {
+  rewind(benchIn);
+  char v[32];
+  for (long i = 0; i < nb; ++i) {
+    if (fscanf(benchIn, "%31s", v) != 1)
+      exit(1);
+    benchSink += v[0];
+  }
+}
+
+void BenchPBErrScanfStr(long nb) {
+  rewind(benchIn);
+  char v[32];
+  for (long i = 0; i < nb; ++i) {
+    PBErrScanf(&thePBErr, benchIn, "%31s", v);
+    benchSink += v[0];
+  }
+}
+
+// ---------------- Catch ----------------
+
+// PBErr used by the catch benchmarks
+PBErr benchErr;
+
+void BenchBacktrace(long nb) {
+  void* stack[PBERR_MAXSTACKHEIGHT];
+  for (long i = 0; i < nb; ++i)
+    benchSink += backtrace(stack, PBERR_MAXSTACKHEIGHT);
+}
+
+void BenchStackCapture(long nb) {
+  void* stack[PBERR_MAXSTACKHEIGHT];
+  for (long i = 0; i < nb; ++i)
+    benchSink += PBErrStackCapture(stack, PBERR_MAXSTACKHEIGHT);
+}
+
+void BenchCatch(long nb) {
+  for (long i = 0; i < nb; ++i)
+    PBErrRaise(&benchErr, PBErrTypeInvalidData, false,
+      "bench %ld", i);
+}
+
+// Latency of a fatal catch, measured in a child process from the
+// catch until its atexit handlers are called
+uint64_t benchFatalStart = 0;
+int benchFatalPipe[2];
+
+void BenchFatalAtExit(void) {
+  uint64_t elapsed = BenchNow() - benchFatalStart;
+  if (write(benchFatalPipe[1], &elapsed, sizeof(elapsed)) < 0)
+    _exit(1);
+}
+
+void BenchRunCatchFatal(const long nbIter) {
+  double best = -1.0;
+  fflush(stdout);
+  fflush(stderr);
+  for (int iRep = 0; iRep < BENCH_NBREP; ++iRep) {
+    uint64_t sum = 0;
+    for (long iIter = 0; iIter < nbIter; ++iIter) {
+      if (pipe(benchFatalPipe) != 0)
+        exit(1);
+      pid_t pid = fork();
+      if (pid == 0) {
+        close(benchFatalPipe[0]);
+        atexit(BenchFatalAtExit);
+        benchFatalStart = BenchNow();
+        PBErrRaise(&benchErr, PBErrTypeInvalidData, true, "bench");
+        _exit(1);
+      }
+      close(benchFatalPipe[1]);
+      uint64_t elapsed = 0;
+      if (read(benchFatalPipe[0], &elapsed, sizeof(elapsed)) !=
+        sizeof(elapsed))
+        exit(1);
+      close(benchFatalPipe[0]);
+      waitpid(pid, NULL, 0);
+      sum += elapsed;
+    }
+    double ns = (double)sum / (double)nbIter;
+    if (best < 0.0 || ns < best)
+      best = ns;
+  }
+  BenchReport("catch_fatal", best);
+}
+
+void BenchTryOnce(const long i) {
+  PBErrTry {
+    benchSink += i;
+  } PBErrTryCatch(err) {
+    benchSink = 0;
+  } PBErrTryEnd;
+}
+
+void BenchTry(long nb) {
+  for (long i = 0; i < nb; ++i)
+    BenchTryOnce(i);
+}
+
+// Write 'nb' small files durably, one at a time with fsync
+void BenchDurableFsync(long nb) {
+  char path[64];
+  char pathTmp[64];
+  for (long i = 0; i < nb; ++i) {
+    sprintf(path, "./benchdurable%ld.txt", i);
+    sprintf(pathTmp, "./benchdurable%ld.tmp", i);
+    FILE* fd = fopen(pathTmp, "w");
+    fprintf(fd, "%ld\n", i);
+    fflush(fd);
+    fsync(fileno(fd));
+    fclose(fd);
+    rename(pathTmp, path);
+    int dir = open(".", O_RDONLY | O_DIRECTORY);
+    fsync(dir);
+    close(dir);
+  }
+  for (long i = 0; i < nb; ++i) {
+    sprintf(path, "./benchdurable%ld.txt", i);
+    remove(path);
+  }
+}
+
+// Write 'nb' small files durably, committed together
+void BenchDurable(long nb) {
+  char path[64];
+  for (long i = 0; i < nb; ++i) {
+    sprintf(path, "./benchdurable%ld.txt", i);
+    FILE* fd = PBErrOpenStreamOutDurable(&thePBErr, path);
+    PBErrPrintf(&thePBErr, fd, "%ld\n", i);
+    PBErrCloseStream(&thePBErr, fd);
+  }
+  PBErrDurableSync(&thePBErr);
+  for (long i = 0; i < nb; ++i) {
+    sprintf(path, "./benchdurable%ld.txt", i);
+    remove(path);
+  }
+}
+
+void BenchTraceScope(long nb) {
+  for (long i = 0; i < nb; ++i) {
+    PBErrTraceScope(PBErrDomainPBErr, "bench");
+    benchSink += i;
+  }
+}
+
+// ---------------- Contention ----------------
+
+// Benchmark run by each thread of the multi-threaded benchmarks
+void (*benchThreadFun)(long) = NULL;
+long benchThreadNbIter = 0;
+
+void* BenchThread(void* arg) {
+  (void)arg;
+  PBErrThreadInit(NULL);
+  benchThreadFun(benchThreadNbIter);
+  return NULL;
+}
+
+// Run 'fun' with 'nbIter' iterations in BENCH_NBTHREAD threads and
+// report the wall time per iteration of all the threads
+void BenchRunThreads(const char* const name, void (*fun)(long),
+  const long nbIter) {
+  double best = -1.0;
+  benchThreadFun = fun;
+  benchThreadNbIter = nbIter;
+  for (int iRep = 0; iRep < BENCH_NBREP; ++iRep) {
+    pthread_t threads[BENCH_NBTHREAD];
+    uint64_t start = BenchNow();
+    for (int iThread = 0; iThread < BENCH_NBTHREAD; ++iThread)
+      pthread_create(threads + iThread, NULL, BenchThread, NULL);
+    for (int iThread = 0; iThread < BENCH_NBTHREAD; ++iThread)
+      pthread_join(threads[iThread], NULL);
+    double ns = (double)(BenchNow() - start) /
+      (double)(nbIter * BENCH_NBTHREAD);
+    if (best < 0.0 || ns < best)
+      best = ns;
+  }
+  BenchReport(name, best);
+}
+
+void BenchThreadMalloc(long nb) {
+  for (long i = 0; i < nb; ++i) {
+    char* volatile ptr = PBErrMalloc(PBMathErr, 64);
+    ptr[0] = (char)i;
+    PBErrFree(PBMathErr, ptr);
+  }
+}
+
+void BenchThreadCatch(long nb) {
+  for (long i = 0; i < nb; ++i)
+    PBErrRaise(PBMathErr, PBErrTypeInvalidData, false,
+      "bench %ld", i);
+}
+
+// ---------------- Main ----------------
+
+// Usage: bench [<baseline file> [<tolerance in percent>]]
+// Print the results as '<mode> <name> <ns per op>' and if a baseline
+// is given, its value and the relative difference. Return 1 if a
+// result regressed by more than the tolerance
+int main(int argc, char** argv) {
+  if (argc > 1)
+    BenchLoadBase(argv[1]);
+  if (argc > 2)
+    benchTolerance = atof(argv[2]);
+  benchNull = fopen("/dev/null", "w");
+  if (benchNull == NULL)
+    return 1;
+  thePBErr._stream = benchNull;
+  benchErr = PBErrCreateStatic();
+  benchErr._stream = benchNull;
+  printf("# mode benchmark %24s %10s %8s\n", "ns/op", "baseline",
+    "delta");
+
+  BenchRun("malloc_64", BenchMalloc64, 200000);
+  BenchRun("pberrmalloc_64", BenchPBErrMalloc64, 200000);
+  BenchRun("malloc_4k", BenchMalloc4k, 200000);
+  BenchRun("pberrmalloc_4k", BenchPBErrMalloc4k, 200000);
+  // Same with the heap profiler sampling every 512KB, and a large 
+  // block most likely sampled so that the frees look up the table
+  PBErrHeapProfStart(512 * 1024);
+  char* benchLive = PBErrMalloc(&thePBErr, 1024 * 1024);
+  BenchRun("pberrmalloc_64_heapprof", BenchPBErrMalloc64, 200000);
+  BenchRun("pberrmalloc_4k_heapprof", BenchPBErrMalloc4k, 200000);
+  PBErrFree(&thePBErr, benchLive);
+  PBErrHeapProfStop();
+
+  BenchRun("fprintf_short", BenchFprintfShort, 200000);
+  BenchRun("pberrprintf_short", BenchPBErrPrintfShort, 200000);
+  BenchRun("fprintf_int", BenchFprintfInt, 200000);
+  BenchRun("pberrprintf_int", BenchPBErrPrintfInt, 200000);
+  BenchRun("fprintf_long", BenchFprintfLong, 200000);
+  BenchRun("pberrprintf_long", BenchPBErrPrintfLong, 200000);
+  BenchRun("fprintf_float", BenchFprintfFloat, 200000);
+  BenchRun("pberrprintf_float", BenchPBErrPrintfFloat, 200000);
+  BenchRun("fprintf_str", BenchFprintfStr, 200000);
+  BenchRun("pberrprintf_str", BenchPBErrPrintfStr, 200000);
+
+  long nbIn = 200000;
+  BenchPrepareIn("%d ", false, nbIn);
+  BenchRun("fscanf_short", BenchFscanfShort, nbIn);
+  BenchRun("pberrscanf_short", BenchPBErrScanfShort, nbIn);
+  BenchRun("fscanf_int", BenchFscanfInt, nbIn);
+  BenchRun("pberrscanf_int", BenchPBErrScanfInt, nbIn);
+  BenchPrepareIn("%f ", true, nbIn);
+  BenchRun("fscanf_float", BenchFscanfFloat, nbIn);
+  BenchRun("pberrscanf_float", BenchPBErrScanfFloat, nbIn);
+  BenchPrepareIn("str%d ", false, nbIn);
+  BenchRun("fscanf_str", BenchFscanfStr, nbIn);
+  BenchRun("pberrscanf_str", BenchPBErrScanfStr, nbIn);
+  fclose(benchIn);
+
+  // Cost of the capture of the stack alone
+  BenchRun("backtrace", BenchBacktrace, 20000);
+  PBErrUnwindInit(PBErrUnwinderFramePointer);
+  BenchRun("unwind_fp", BenchStackCapture, 200000);
+  PBErrUnwindInit(PBErrUnwinderBacktrace);
+  // Non fatal catch in the different output modes
+  BenchRun("catch_text_immediate", BenchCatch, 2000);
+  PBErrSetSymbolMode(PBErrSymbolModeCached);
+  BenchRun("catch_text_cached", BenchCatch, 20000);
+  PBErrSetSymbolMode(PBErrSymbolModeRaw);
+  BenchRun("catch_text_raw", BenchCatch, 20000);
+  PBErrUnwindInit(PBErrUnwinderFramePointer);
+  BenchRun("catch_text_raw_fp", BenchCatch, 20000);
+  PBErrUnwindInit(PBErrUnwinderBacktrace);
+  PBErrSetStackHeight(0);
+  BenchRun("catch_text_raw_nostack", BenchCatch, 20000);
+  PBErrSetStackHeight(PBERR_STACKHEIGHTDEFAULT);
+  PBErrSetSymbolMode(PBErrSymbolModeImmediate);
+  benchErr._format = PBErrFormatJSON;
+  BenchRun("catch_json", BenchCatch, 20000);
+  benchErr._format = PBErrFormatText;
+  // Non fatal catch without output
+  PBErrSetDedup(1, ULONG_MAX);
+  BenchRun("catch_suppressed", BenchCatch, 20000);
+  PBErrSetDedup(0, 0);
+  PBErrDedupReset();
+  BenchRunCatchFatal(100);
+  // Scope of PBErrTry without error
+  BenchRun("try_noerror", BenchTry, 1000000);
+  // Traced scope, the events are recorded
+  PBErrTraceEnable(true);
+  BenchRun("trace_scope", BenchTraceScope, 1000000);
+  PBErrTraceEnable(false);
+  PBErrTraceReset();
+  // Small durable files, per file
+  BenchRun("durable_small_fsync", BenchDurableFsync, 200);
+  BenchRun("durable_small", BenchDurable, 200);
+
+  BenchRunThreads("mt_pberrmalloc_64", BenchThreadMalloc, 200000);
+  PBErrSetDedup(1, ULONG_MAX);
+  BenchRunThreads("mt_catch_suppressed", BenchThreadCatch, 10000);
+  PBErrSetDedup(0, 0);
+  PBErrDedupReset();
+  PBErrSinkStart(1024);
+  BenchRunThreads("mt_catch_sink", BenchThreadCatch, 10000);
+  PBErrSinkStop();
+
+  fclose(benchNull);
+  if (benchNbRegression > 0) {
+    printf("# %d regression(s)\n", benchNbRegression);
+    return 1;
+  }
+  return 0;
+}
@@ -3,6 +3,12 @@
 #include <time.h>
 #include <string.h>
 #include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include "pberr.h"
 
 void UnitTestCreateStatic() {
@@ -39,6 +45,262 @@ void UnitTestMalloc() {
   free(arr);
 }
 
+void* UnitTestAllocStatWorker(void* arg) {
+  return PBErrMalloc((PBErr*)arg, 100);
+}
+
+void UnitTestAllocStat() {
+  printf("UnitTestAllocStat\n");
+  PBErr err = PBErrCreateStatic();
+  err._domain = PBErrDomainGSet;
+  PBErrAllocStat before;
+  PBErrAllocStatGet(PBErrDomainGSet, &before);
+  char* arr = PBErrMalloc(&err, 100);
+  PBErrAllocStat during;
+  PBErrAllocStatGet(PBErrDomainGSet, &during);
+  PBErrFree(&err, arr);
+  PBErrAllocStat after;
+  PBErrAllocStatGet(PBErrDomainGSet, &after);
+  // The default PBErr of a repository accounts in its domain
+  PBErrAllocStat beforeMath;
+  PBErrAllocStatGet(PBErrDomainPBMath, &beforeMath);
+  PBErrFree(PBMathErr, PBErrMalloc(PBMathErr, 100));
+  PBErrAllocStat afterMath;
+  PBErrAllocStatGet(PBErrDomainPBMath, &afterMath);
+  // The allocations of a thread are folded at its exit
+  pthread_t thread;
+  void* ptr = NULL;
+  pthread_create(&thread, NULL, UnitTestAllocStatWorker, &err);
+  pthread_join(thread, &ptr);
+  PBErrAllocStat afterThread;
+  PBErrAllocStatGet(PBErrDomainGSet, &afterThread);
+  PBErrFree(&err, ptr);
+  printf("AllocStat ");
+#if defined(PBERR_ALLOCSTAT)
+  if (afterMath._nbAlloc == beforeMath._nbAlloc + 1 &&
+    afterThread._nbAlloc == after._nbAlloc + 1 &&
+    afterThread._live >= after._live + 100 &&
+    during._live >= before._live + 100 && 
+    during._nbAlloc == before._nbAlloc + 1 &&
+    during._hist[3] == before._hist[3] + 1 &&
+    during._peak >= during._live &&
+    after._live == before._live && after._nbFree == before._nbFree + 1)
+#else
+  if (during._nbAlloc == 0 && after._nbFree == 0)
+#endif
+    printf("OK");
+  else
+    printf("NOK");
+  printf("\n");
+}
+
+void UnitTestMallocVariant() {
+  printf("UnitTestMallocVariant\n");
+  PBErr err = PBErrCreateStatic();
+  err._domain = PBErrDomainGSet;
+  PBErrAllocStat before;
+  PBErrAllocStatGet(PBErrDomainGSet, &before);
+  bool ok = true;
+  char* aligned = PBErrMallocAligned(&err, 64, 100);
+  if (aligned == NULL || ((uintptr_t)aligned & 63) != 0)
+    ok = false;
+  int* zero = PBErrCalloc(&err, 10, sizeof(int));
+  for (int i = 0; zero != NULL && i < 10; ++i)
+    if (zero[i] != 0)
+      ok = false;
+  if (zero == NULL)
+    ok = false;
+  char* arr = PBErrRealloc(&err, NULL, 10);
+  memcpy(arr, "PBErr", 6);
+  arr = PBErrRealloc(&err, arr, 10000);
+  if (arr == NULL || strcmp(arr, "PBErr") != 0)
+    ok = false;
+  size_t sizeHuge = 4ul << 20;
+  char* huge = PBErrMallocHuge(&err, sizeHuge);
+  if (huge == NULL) {
+    ok = false;
+  } else {
+    huge[0] = 1;
+    huge[sizeHuge - 1] = 2;
+    if (huge[0] + huge[sizeHuge - 1] != 3)
+      ok = false;
+  }
+  PBErrFree(&err, aligned);
+  PBErrFree(&err, zero);
+  if (PBErrRealloc(&err, arr, 0) != NULL)
+    ok = false;
+  PBErrFreeHuge(&err, huge, sizeHuge);
+  PBErrAllocStat after;
+  PBErrAllocStatGet(PBErrDomainGSet, &after);
+#if defined(PBERR_ALLOCSTAT)
+  if (after._live != before._live || 
+    after._nbAlloc - before._nbAlloc != 
+    after._nbFree - before._nbFree)
+    ok = false;
+#else
+  (void)before;
+  (void)after;
+#endif
+  printf("MallocVariant ");
+  if (ok)
+    printf("OK");
+  else
+    printf("NOK");
+  printf("\n");
+}
+
+// Cache of blocks released by the reclaim callbacks
+typedef struct UnitTestReclaimCache {
+  char* _blocks[256];
+  int _nb;
+  int _nbCall;
+  // Order of the call of the callback among all the callbacks
+  int _iCall;
+} UnitTestReclaimCache;
+
+int unitTestReclaimNbCall = 0;
+
+size_t UnitTestReclaimFun(const size_t size, void* const data) {
+  UnitTestReclaimCache* cache = data;
+  ++(cache->_nbCall);
+  cache->_iCall = unitTestReclaimNbCall++;
+  size_t released = 0;
+  while (cache->_nb > 0 && released < size) {
+    --(cache->_nb);
+    PBErrFree(&thePBErr, cache->_blocks[cache->_nb]);
+    released += 4096;
+  }
+  return released;
+}
+
+void UnitTestReclaim() {
+  printf("UnitTestReclaim\n");
+  bool ok = true;
+  UnitTestReclaimCache low = {._nb = 0};
+  UnitTestReclaimCache high = {._nb = 0};
+  UnitTestReclaimCache other = {._nb = 0};
+  for (int i = 0; i < 2; ++i) {
+    low._blocks[low._nb++] = PBErrMalloc(&thePBErr, 4096);
+    high._blocks[high._nb++] = PBErrMalloc(&thePBErr, 4096);
+    other._blocks[other._nb++] = PBErrMalloc(&thePBErr, 4096);
+  }
+  if (!PBErrReclaimAdd(PBErrDomainGSet, 1, UnitTestReclaimFun, &low) ||
+    !PBErrReclaimAdd(PBErrDomainGSet, 2, UnitTestReclaimFun, &high) ||
+    !PBErrReclaimAdd(PBErrDomainJSON, 3, UnitTestReclaimFun, &other))
+    ok = false;
+  // The callbacks of the domain first, by decreasing priority
+  if (PBErrReclaim(PBErrDomainGSet, 4096 * 5) != 4096 * 5 ||
+    high._iCall != 0 || low._iCall != 1 || other._iCall != 2 ||
+    other._nb != 1)
+    ok = false;
+  // Failed allocation
+  PBErr err = PBErrCreateStatic();
+  err._domain = PBErrDomainGSet;
+  unitTestReclaimNbCall = 0;
+  volatile bool failed = false;
+  PBErrTry {
+    char* arr = PBErrMalloc(&err, (size_t)1 << 62);
+    free(arr);
+  } PBErrTryCatch(e) {
+    failed = (e->_type == PBErrTypeMallocFailed);
+  } PBErrTryEnd;
+#if defined(PBERRALL) || defined(PBERRSAFEMALLOC)
+  // Only the callback still releasing memory has been retried
+  if (!failed || unitTestReclaimNbCall != 3 || other._nb != 0)
+    ok = false;
+#else
+  (void)failed;
+#endif
+  // An invalid alignment doesn't call the callbacks
+  unitTestReclaimNbCall = 0;
+  volatile bool invalid = false;
+  PBErrTry {
+    char* arr = PBErrMallocAligned(&err, 24, 64);
+    free(arr);
+  } PBErrTryCatch(e) {
+    invalid = (e->_type == PBErrTypeInvalidArg);
+  } PBErrTryEnd;
+#if defined(PBERRALL) || defined(PBERRSAFEMALLOC)
+  if (!invalid || unitTestReclaimNbCall != 0)
+    ok = false;
+#else
+  (void)invalid;
+#endif
+  // Budget
+#if defined(PBERR_ALLOCSTAT)
+  unsigned long live = 0;
+  for (int iDomain = 0; iDomain < PBErrDomainNb; ++iDomain) {
+    PBErrAllocStat stat;
+    PBErrAllocStatGet((PBErrDomain)iDomain, &stat);
+    live += stat._live;
+  }
+  if (!PBErrReclaimSetBudget(live + 256 * 1024))
+    ok = false;
+  low._nbCall = 0;
+  for (int i = 0; i < 256; ++i) {
+    // The callback may be called by PBErrMalloc and change low._nb
+    char* block = PBErrMalloc(&thePBErr, 4096);
+    low._blocks[low._nb++] = block;
+  }
+  PBErrReclaimSetBudget(0);
+  if (low._nbCall == 0 || low._nb == 256)
+    ok = false;
+#else
+  if (PBErrReclaimSetBudget(1024))
+    ok = false;
+#endif
+  if (!PBErrReclaimRemove(UnitTestReclaimFun, &low) ||
+    !PBErrReclaimRemove(UnitTestReclaimFun, &high) ||
+    !PBErrReclaimRemove(UnitTestReclaimFun, &other) ||
+    PBErrReclaimRemove(UnitTestReclaimFun, &other) ||
+    PBErrReclaim(PBErrDomainGSet, 4096) != 0)
+    ok = false;
+  while (low._nb > 0)
+    PBErrFree(&thePBErr, low._blocks[--(low._nb)]);
+  printf("Reclaim ");
+  if (ok)
+    printf("OK");
+  else
+    printf("NOK");
+  printf("\n");
+}
+
+void UnitTestArena() {
+  printf("UnitTestArena\n");
+  PBErrArena arena = PBErrArenaCreateStatic(&thePBErr, 64);
+  char* a = PBErrArenaAlloc(&arena, 3);
+  double* b = PBErrArenaAlloc(&arena, sizeof(double));
+  char* c = PBErrArenaAlloc(&arena, 1000);
+  a[2] = 1;
+  *b = 1.0;
+  c[999] = 1;
+  PBErrArenaReset(&arena);
+  char* d = PBErrArenaAlloc(&arena, 3);
+  PBErrArena* arenaThread = PBErrArenaThread();
+  int* e = PBErrArenaAlloc(arenaThread, sizeof(int));
+  *e = 1;
+  // Sizes wrapping around once aligned fail like a malloc
+  PBErr err = PBErrCreateStatic();
+  arena._err = &err;
+  volatile bool failed = false;
+  PBErrTry {
+    PBErrArenaAlloc(&arena, SIZE_MAX - 1);
+  } PBErrTryCatch(exc) {
+    failed = (exc->_type == PBErrTypeMallocFailed);
+  } PBErrTryEnd;
+  arena._err = &thePBErr;
+  printf("Arena ");
+  if (a != NULL && ((size_t)b) % _Alignof(max_align_t) == 0 && 
+    c != NULL && d == a && arena._first->_next != NULL && 
+    arenaThread == PBErrArenaThread() && failed)
+    printf("OK");
+  else
+    printf("NOK");
+  printf("\n");
+  PBErrArenaRelease(&arena);
+  PBErrArenaReset(arenaThread);
+}
+
 void UnitTestIO() {
   FILE* fd = PBErrOpenStreamOut(&thePBErr, "./testio.txt");
   short a = 1;
@@ -92,6 +354,1161 @@ void UnitTestIO() {
   printf("UnitTestIO OK\n");
 }
 
+void* UnitTestThreadWorker(void* arg) {
+  // Each thread has its own PBErr per domain
+  if (!PBErrThreadInit((PBErrCollector*)arg) || 
+    PBMathErr == &thePBErr || PBMathErr == GSetErr ||
+    PBMathErr != PBErrThread(PBErrDomainPBMath))
+    return NULL;
+  PBMathErr->_stream = fopen("/dev/null", "w");
+  PBMathErr->_type = PBErrTypeInvalidData;
+  sprintf(PBMathErr->_msg, "UnitTestThread: worker error");
+  PBMathErr->_fatal = false;
+  PBErrCatch(PBMathErr);
+  fclose(PBMathErr->_stream);
+  return NULL;
+}
+
+void UnitTestMap() {
+  printf("UnitTestMap\n");
+  FILE* fd = PBErrOpenStreamOut(&thePBErr, "./testmap.txt");
+  fprintf(fd, "1\n -2\t3.5e2 -0.125 string\n70000 x");
+  PBErrCloseStream(&thePBErr, fd);
+  PBErr err = PBErrCreateStatic();
+  err._stream = fopen("/dev/null", "w");
+  bool ret = true;
+#if defined(PBERRALL) || defined(PBERRSAFEIO)
+  PBErrMap* map = PBErrOpenMapIn(&err, "./testmap.txt");
+  short a = 0;
+  int b = 0;
+  float c = 0.0;
+  float d = 0.0;
+  char e[10];
+  short f = 0;
+  ret = PBErrScanfMap(&err, map, &a) && a == 1;
+  ret &= PBErrScanfMap(&err, map, &b) && b == -2;
+  ret &= PBErrScanfMap(&err, map, &c) && c == 350.0;
+  ret &= PBErrScanfMap(&err, map, &d) && d == -0.125;
+  ret &= PBErrScanfMap(&err, map, e) && strcmp(e, "string") == 0;
+  ret &= !PBErrScanfMap(&err, map, &f) && f == 0;
+  ret &= PBErrScanfMap(&err, map, &b) && b == 70000;
+  ret &= !PBErrScanfMap(&err, map, &b) && b == 70000;
+  ret &= PBErrScanfMap(&err, map, e) && strcmp(e, "x") == 0;
+  ret &= !PBErrScanfMap(&err, map, e);
+  PBErrCloseMap(&err, map);
+  ret &= (PBErrOpenMapIn(&err, "./missingfile") == NULL);
+#endif
+  fclose(err._stream);
+  remove("./testmap.txt");
+  printf("Map ");
+  if (ret)
+    printf("OK");
+  else
+    printf("NOK");
+  printf("\n");
+}
+
+void UnitTestArray() {
+  printf("UnitTestArray\n");
+  bool ret = true;
+#if defined(PBERRALL) || defined(PBERRSAFEIO)
+  short a[3] = {-32768, 0, 32767};
+  int b[3] = {-2147483647, 7, 2147483647};
+  long c[2] = {-9223372036854775807L, 9223372036854775807L};
+  float d[3] = {-1.5, 0.0, 3.25};
+  FILE* fd = PBErrOpenStreamOut(&thePBErr, "./testarray.txt");
+  ret &= PBErrPrintfArray(&thePBErr, fd, "%hi\n", a, 3);
+  ret &= PBErrPrintfArray(&thePBErr, fd, " %d", b, 3);
+  ret &= PBErrPrintfArray(&thePBErr, fd, "\n%ld", c, 2);
+  ret &= PBErrPrintfArray(&thePBErr, fd, " %f", d, 3);
+  ret &= PBErrPrintfArray(&thePBErr, fd, " [%+05i]", b + 1, 1);
+  PBErrCloseStream(&thePBErr, fd);
+  short checka[3];
+  int checkb[3];
+  long checkc[2];
+  float checkd[3];
+  int checke = 0;
+  fd = PBErrOpenStreamIn(&thePBErr, "./testarray.txt");
+  ret &= PBErrScanfArray(&thePBErr, fd, "%hi", checka, 3);
+  ret &= PBErrScanfArray(&thePBErr, fd, "%d", checkb, 3);
+  ret &= PBErrScanfArray(&thePBErr, fd, "%ld", checkc, 2);
+  ret &= PBErrScanfArray(&thePBErr, fd, "%f", checkd, 3);
+  ret &= PBErrScanfArray(&thePBErr, fd, " [%d]", &checke, 1);
+  PBErr err = PBErrCreateStatic();
+  err._stream = fopen("/dev/null", "w");
+  ret &= !PBErrScanfArray(&err, fd, "%d", checkb, 1);
+  fclose(err._stream);
+  PBErrCloseStream(&thePBErr, fd);
+  ret &= memcmp(a, checka, sizeof(a)) == 0 &&
+    memcmp(b, checkb, sizeof(b)) == 0 &&
+    memcmp(c, checkc, sizeof(c)) == 0 &&
+    memcmp(d, checkd, sizeof(d)) == 0 && checke == 7;
+  // Values longer than the buffer of the fast path are read like 
+  // fscanf does
+  fd = PBErrOpenStreamOut(&thePBErr, "./testarray.txt");
+  fprintf(fd, "%079d %0100.3f %d\n", 42, 1.5, 9);
+  PBErrCloseStream(&thePBErr, fd);
+  fd = PBErrOpenStreamIn(&thePBErr, "./testarray.txt");
+  ret &= PBErrScanfArray(&thePBErr, fd, "%d", checkb, 1) &&
+    PBErrScanfArray(&thePBErr, fd, "%f", checkd, 1) &&
+    PBErrScanfArray(&thePBErr, fd, "%i", checkb + 1, 1) &&
+    checkb[0] == 42 && checkd[0] == 1.5 && checkb[1] == 9;
+  PBErrCloseStream(&thePBErr, fd);
+  remove("./testarray.txt");
+#endif
+  printf("Array ");
+  if (ret)
+    printf("OK");
+  else
+    printf("NOK");
+  printf("\n");
+}
+
+#if defined(PBERRALL) || defined(PBERRSAFEIO)
+// Write the 'len' first bytes of 'bytes', with the byte at 'pos'
+// xored with 'flip', into a file, read back its header, then the
+// array of 3 floats at 'posArr' if it's positive. Return true if the
+// read failed with an error of type 'type' and message 'msg'
+bool UnitTestBinCorrupt(const unsigned char* const bytes,
+  const size_t len, const size_t pos, const unsigned char flip,
+  const long posArr, const PBErrType type, const char* const msg) {
+  FILE* fd = fopen("./testbincorrupt.bin", "wb");
+  fwrite(bytes, 1, pos, fd);
+  if (pos < len) {
+    fputc(bytes[pos] ^ flip, fd);
+    fwrite(bytes + pos + 1, 1, len - pos - 1, fd);
+  }
+  fclose(fd);
+  PBErrCollector* collector = PBErrCollectorCreate(1);
+  PBErr err = PBErrCreateStatic();
+  err._stream = fopen("/dev/null", "w");
+  err._collector = collector;
+  fd = PBErrOpenStreamIn(&err, "./testbincorrupt.bin");
+  bool ok = PBErrBinReadHeader(&err, fd);
+  if (ok && posArr > 0) {
+    float arr[3];
+    fseek(fd, posArr, SEEK_SET);
+    ok = PBErrBinReadArray(&err, fd, arr, 3);
+  }
+  PBErrCloseStream(&err, fd);
+  fclose(err._stream);
+  char buf[PBERR_MSGLENGTHMAX];
+  const PBErr* first = PBErrCollectorFirst(collector);
+  bool ret = !ok && first != NULL && first->_type == type &&
+    strcmp(PBErrFormatMsg(first, buf, PBERR_MSGLENGTHMAX), msg) == 0;
+  PBErrCollectorFree(&collector);
+  remove("./testbincorrupt.bin");
+  return ret;
+}
+#endif
+
+void UnitTestBin() {
+  printf("UnitTestBin\n");
+  bool ret = true;
+#if defined(PBERRALL) || defined(PBERRSAFEIO)
+  short a = -2;
+  int b = 3;
+  long c = -4000000000L;
+  float d = 0.1;
+  char* e = "string";
+  float f[3] = {1.0, -2.0, 1e-30};
+  int g[2] = {5, 6};
+  FILE* fd = PBErrOpenStreamOut(&thePBErr, "./testbin.bin");
+  ret &= PBErrBinWriteHeader(&thePBErr, fd);
+  ret &= PBErrBinWrite(&thePBErr, fd, a);
+  ret &= PBErrBinWrite(&thePBErr, fd, b);
+  ret &= PBErrBinWrite(&thePBErr, fd, c);
+  ret &= PBErrBinWrite(&thePBErr, fd, d);
+  ret &= PBErrBinWrite(&thePBErr, fd, e);
+  ret &= PBErrBinWriteArrayCRC(&thePBErr, fd, f, 3);
+  ret &= PBErrBinWriteArray(&thePBErr, fd, g, 2);
+  PBErrCloseStream(&thePBErr, fd);
+  short checka = 0;
+  int checkb = 0;
+  long checkc = 0;
+  float checkd = 0.0;
+  char checke[10];
+  float checkf[3];
+  int checkg[2];
+  fd = PBErrOpenStreamIn(&thePBErr, "./testbin.bin");
+  ret &= PBErrBinReadHeader(&thePBErr, fd);
+  ret &= PBErrBinRead(&thePBErr, fd, &checka);
+  ret &= PBErrBinRead(&thePBErr, fd, &checkb);
+  ret &= PBErrBinRead(&thePBErr, fd, &checkc);
+  ret &= PBErrBinRead(&thePBErr, fd, &checkd);
+  ret &= PBErrBinReadArray(&thePBErr, fd, checke, 10);
+  long posF = ftell(fd);
+  ret &= PBErrBinReadArray(&thePBErr, fd, checkf, 3);
+  PBErr err = PBErrCreateStatic();
+  err._stream = fopen("/dev/null", "w");
+  ret &= !PBErrBinReadArray(&err, fd, checkg, 3) && 
+    err._msg[0] == '\0';
+  fclose(err._stream);
+  PBErrCloseStream(&thePBErr, fd);
+  ret &= a == checka && b == checkb && c == checkc && d == checkd &&
+    strcmp(e, checke) == 0 && memcmp(f, checkf, sizeof(f)) == 0;
+  // Corrupt a copy of the file: the header is 12 bytes, the version
+  // at byte 4 and the endianness at byte 5, the data of the CRC
+  // protected array follow its tag and 8 bytes count
+  unsigned char bytes[256];
+  fd = fopen("./testbin.bin", "rb");
+  size_t len = fread(bytes, 1, sizeof(bytes), fd);
+  fclose(fd);
+  ret &= UnitTestBinCorrupt(bytes, len, len, 0, posF, PBErrTypeUnknown,
+    "") == false;
+  ret &= UnitTestBinCorrupt(bytes, len, posF + 10, 0x01, posF,
+    PBErrTypeInvalidData, "CRC mismatch\n");
+  ret &= UnitTestBinCorrupt(bytes, len, 0, 0x01, 0,
+    PBErrTypeInvalidData, "invalid magic number\n");
+  ret &= UnitTestBinCorrupt(bytes, len, 4, 0xFF, 0,
+    PBErrTypeInvalidData, "unsupported version\n");
+  ret &= UnitTestBinCorrupt(bytes, len, 5, 'L' ^ 'B', 0,
+    PBErrTypeInvalidData, "unsupported endianness\n");
+  ret &= UnitTestBinCorrupt(bytes, posF + 13, posF + 13, 0, posF,
+    PBErrTypeIOError, "fread failed for a block\n");
+  remove("./testbin.bin");
+#endif
+  printf("Bin ");
+  if (ret)
+    printf("OK");
+  else
+    printf("NOK");
+  printf("\n");
+}
+
+void UnitTestAsyncOut() {
+  printf("UnitTestAsyncOut\n");
+  bool ret = true;
+  int nb = 300000;
+  FILE* fd = PBErrOpenStreamOutAsync(&thePBErr, "./testasync.txt");
+  for (int i = 0; i < nb; ++i)
+    PBErrPrintf(&thePBErr, fd, "%d\n", i);
+  PBErrCloseStream(&thePBErr, fd);
+  fd = PBErrOpenStreamIn(&thePBErr, "./testasync.txt");
+  for (int i = 0; i < nb && ret; ++i) {
+    int check = -1;
+    PBErrScanf(&thePBErr, fd, "%d", &check);
+    ret &= (check == i);
+  }
+  PBErrCloseStream(&thePBErr, fd);
+  remove("./testasync.txt");
+#if defined(PBERRALL) || defined(PBERRSAFEIO)
+  // The failure of the writer is reported at the latest when closing
+  PBErr err = PBErrCreateStatic();
+  err._stream = fopen("/dev/null", "w");
+  PBErrCollector* collector = PBErrCollectorCreate(10);
+  err._collector = collector;
+  fd = PBErrOpenStreamOutAsync(&err, "/dev/full");
+  for (int i = 0; i < nb; ++i)
+    PBErrPrintf(&err, fd, "%d\n", i);
+  PBErrCloseStream(&err, fd);
+  const PBErr* first = PBErrCollectorFirst(collector);
+  ret &= first != NULL && first->_type == PBErrTypeIOError;
+  PBErrCollectorFree(&collector);
+  fclose(err._stream);
+#endif
+#if defined(PBERR_ALLOCSTAT)
+  // The stream is accounted in the domain of the PBErr which opened 
+  // it, and released when it's closed
+  PBErrAllocStat before;
+  PBErrAllocStatGet(PBErrDomainGSet, &before);
+  PBErr errGSet = PBErrCreateStatic();
+  errGSet._domain = PBErrDomainGSet;
+  fd = PBErrOpenStreamOutAsync(&errGSet, "./testasync.txt");
+  PBErrPrintf(&errGSet, fd, "%d\n", 1);
+  PBErrCloseStream(&errGSet, fd);
+  remove("./testasync.txt");
+  PBErrAllocStat after;
+  PBErrAllocStatGet(PBErrDomainGSet, &after);
+  ret &= (after._live == before._live && 
+    after._nbAlloc == before._nbAlloc + 1 &&
+    after._nbFree == before._nbFree + 1);
+#endif
+  printf("AsyncOut ");
+  if (ret)
+    printf("OK");
+  else
+    printf("NOK");
+  printf("\n");
+}
+
+void UnitTestDurable() {
+  printf("UnitTestDurable\n");
+  bool ret = true;
+  int nb = 20;
+  char path[64];
+  for (int i = 0; i < nb; ++i) {
+    sprintf(path, "./testdurable%d.txt", i);
+    FILE* fd = PBErrOpenStreamOutDurable(&thePBErr, path);
+    PBErrPrintf(&thePBErr, fd, "%d\n", i);
+    PBErrCloseStream(&thePBErr, fd);
+  }
+  ret &= PBErrDurableSync(&thePBErr);
+  for (int i = 0; i < nb; ++i) {
+    sprintf(path, "./testdurable%d.txt", i);
+    FILE* fd = PBErrOpenStreamIn(&thePBErr, path);
+    int check = -1;
+    PBErrScanf(&thePBErr, fd, "%d", &check);
+    ret &= (check == i);
+    PBErrCloseStream(&thePBErr, fd);
+    remove(path);
+  }
+#if defined(PBERRALL) || defined(PBERRSAFEIO)
+  // The file doesn't exist until it's committed, and the stream 
+  // leaves nothing in the allocation statistics
+  PBErrAllocStat before;
+  PBErrAllocStatGet(PBErrDomainPBErr, &before);
+  FILE* fd = PBErrOpenStreamOutDurable(&thePBErr, "./testdurable.txt");
+  PBErrPrintf(&thePBErr, fd, "%d\n", 1);
+  fflush(fd);
+  ret &= (access("./testdurable.txt", F_OK) != 0);
+  PBErrCloseStream(&thePBErr, fd);
+  PBErrDurableSync(&thePBErr);
+  ret &= (access("./testdurable.txt", F_OK) == 0);
+  remove("./testdurable.txt");
+  PBErrAllocStat after;
+  PBErrAllocStatGet(PBErrDomainPBErr, &after);
+  ret &= (after._live == before._live);
+  // The rename fails if the destination is a non empty directory,
+  // which is reported by PBErrDurableSync
+  PBErr err = PBErrCreateStatic();
+  err._stream = fopen("/dev/null", "w");
+  PBErrCollector* collector = PBErrCollectorCreate(10);
+  err._collector = collector;
+  mkdir("./testdurabledir", 0777);
+  fd = fopen("./testdurabledir/file", "w");
+  fclose(fd);
+  fd = PBErrOpenStreamOutDurable(&err, "./testdurabledir");
+  PBErrPrintf(&err, fd, "%d\n", 1);
+  PBErrCloseStream(&err, fd);
+  ret &= !PBErrDurableSync(&err) && PBErrDurableSync(&err);
+  const PBErr* first = PBErrCollectorFirst(collector);
+  ret &= first != NULL && first->_type == PBErrTypeIOError;
+  PBErrCollectorFree(&collector);
+  fclose(err._stream);
+  remove("./testdurabledir/file");
+  remove("./testdurabledir");
+#endif
+  printf("Durable ");
+  if (ret)
+    printf("OK");
+  else
+    printf("NOK");
+  printf("\n");
+}
+
+void UnitTestDomainErr() {
+  printf("UnitTestDomainErr\n");
+  // The default PBErr of a repository is printed on the stream of
+  // thePBErr, unless it has its own
+  FILE* streamSave = thePBErr._stream;
+  thePBErr._stream = fopen("./testdomainerr.txt", "w");
+  PBErrRaise(GSetErr, PBErrTypeInvalidData, false, "on thePBErr");
+  FILE* own = fopen("/dev/null", "w");
+  GSetErr->_stream = own;
+  PBErrRaise(GSetErr, PBErrTypeInvalidData, false, "on its own");
+  GSetErr->_stream = NULL;
+  fclose(own);
+  fclose(thePBErr._stream);
+  thePBErr._stream = streamSave;
+  FILE* fd = fopen("./testdomainerr.txt", "r");
+  bool found = false;
+  bool foundOwn = false;
+  char line[PBERR_MSGLENGTHMAX];
+  while (fgets(line, PBERR_MSGLENGTHMAX, fd) != NULL) {
+    found |= (strstr(line, "on thePBErr") != NULL);
+    foundOwn |= (strstr(line, "on its own") != NULL);
+  }
+  fclose(fd);
+  remove("./testdomainerr.txt");
+  printf("DomainErr ");
+  if (found && !foundOwn && GSetErr->_domain == PBErrDomainGSet)
+    printf("OK");
+  else
+    printf("NOK");
+  printf("\n");
+}
+
+void UnitTestThread() {
+  printf("UnitTestThread\n");
+  int nbThread = 4;
+  PBErrCollector* collector = PBErrCollectorCreate(nbThread - 1);
+  pthread_t threads[4];
+  for (int iThread = nbThread; iThread--;)
+    pthread_create(threads + iThread, NULL, UnitTestThreadWorker,
+      collector);
+  for (int iThread = nbThread; iThread--;)
+    pthread_join(threads[iThread], NULL);
+  const PBErr* first = PBErrCollectorFirst(collector);
+  printf("Collector ");
+  // The dropped errors don't reserve slots
+  if (PBErrCollectorGetNbPushed(collector) == (unsigned long)nbThread &&
+    atomic_load(&(collector->_nb)) == nbThread - 1 &&
+    first != NULL && first->_domain == PBErrDomainPBMath &&
+    first->_type == PBErrTypeInvalidData &&
+    PBErrCollectorGet(collector, nbThread - 1) == NULL &&
+    PBMathErr != &thePBErr && PBMathErr->_domain == PBErrDomainPBMath &&
+    PBErrThread(PBErrDomainPBMath) == PBMathErr &&
+    thePBErr._msg[0] == '\0')
+    printf("OK");
+  else
+    printf("NOK");
+  printf("\n");
+  PBErrCollectorFree(&collector);
+  // A message with a string argument is formatted before the copy 
+  // into the collector, as the string may not be valid anymore when 
+  // the copy is read
+  collector = PBErrCollectorCreate(1);
+  PBErr err = PBErrCreateStatic();
+  err._stream = fopen("/dev/null", "w");
+  err._collector = collector;
+  char str[16];
+  strcpy(str, "before");
+  PBErrRaise(&err, PBErrTypeInvalidData, false, "str %s", str);
+  strcpy(str, "after");
+  fclose(err._stream);
+  char msg[PBERR_MSGLENGTHMAX];
+  first = PBErrCollectorFirst(collector);
+  printf("CollectorStr ");
+  if (first != NULL && strcmp(
+    PBErrFormatMsg(first, msg, PBERR_MSGLENGTHMAX), "str before") == 0)
+    printf("OK");
+  else
+    printf("NOK");
+  printf("\n");
+  PBErrCollectorFree(&collector);
+}
+
+void UnitTestSink() {
+  printf("UnitTestSink\n");
+  PBErr err = PBErrCreateStatic();
+  err._stream = fopen("./testsink.txt", "w");
+  bool ret = PBErrSinkStart(2);
+  int nbErr = 5;
+  for (int iErr = 0; iErr < nbErr; ++iErr) {
+    err._type = PBErrTypeIOError;
+    sprintf(err._msg, "UnitTestSink: error %d", iErr);
+    err._fatal = false;
+    PBErrCatch(&err);
+  }
+  PBErrSinkFlush();
+  PBErrSinkStop();
+  int nbDropped = (int)PBErrSinkGetNbDropped();
+  // The ring buffer is reused, it can't grow
+  ret &= !PBErrSinkStart(1024) && PBErrSinkStart(1);
+  PBErrSinkStop();
+  fclose(err._stream);
+  FILE* fd = fopen("./testsink.txt", "r");
+  int nbPrinted = 0;
+  char line[PBERR_MSGLENGTHMAX];
+  while (fgets(line, PBERR_MSGLENGTHMAX, fd) != NULL)
+    if (strcmp(line, "---- PBErrCatch ----\n") == 0)
+      ++nbPrinted;
+  fclose(fd);
+  remove("./testsink.txt");
+  printf("Sink ");
+  if (ret && nbPrinted + nbDropped == nbErr &&
+    err._msg[0] == '\0')
+    printf("OK");
+  else
+    printf("NOK");
+  printf("\n");
+}
+
+void UnitTestDedup() {
+  printf("UnitTestDedup\n");
+  PBErr err = PBErrCreateStatic();
+  err._stream = fopen("./testdedup.txt", "w");
+  PBErrSetDedup(2, 5);
+  for (int iErr = 0; iErr < 12; ++iErr) {
+    err._type = PBErrTypeInvalidData;
+    sprintf(err._msg, "UnitTestDedup");
+    err._fatal = false;
+    PBErrCatch(&err);
+  }
+  PBErrSetDedup(0, 0);
+  fclose(err._stream);
+  FILE* fd = fopen("./testdedup.txt", "r");
+  int nbFull = 0;
+  int nbSummary = 0;
+  char line[PBERR_MSGLENGTHMAX];
+  while (fgets(line, PBERR_MSGLENGTHMAX, fd) != NULL) {
+    if (strcmp(line, "Stack:\n") == 0)
+      ++nbFull;
+    if (strcmp(line, "Repeated 5 times\n") == 0)
+      ++nbSummary;
+  }
+  fclose(fd);
+  remove("./testdedup.txt");
+  unsigned long nbSuppressed = PBErrDedupGetNbSuppressed();
+  PBErrDedupReset();
+  // Errors raised at different lines are counted separately, even
+  // without the stack
+  PBErrSetStackHeight(0);
+  PBErrSetDedup(1, 100);
+  err._stream = fopen("/dev/null", "w");
+  for (int iErr = 0; iErr < 3; ++iErr) {
+    PBErrRaise(&err, PBErrTypeInvalidData, false, "UnitTestDedup");
+    PBErrRaise(&err, PBErrTypeInvalidData, false, "UnitTestDedup");
+  }
+  fclose(err._stream);
+  PBErrSetDedup(0, 0);
+  PBErrSetStackHeight(PBERR_STACKHEIGHTDEFAULT);
+  printf("Dedup ");
+  if (nbFull == 2 && nbSummary == 2 && nbSuppressed == 8 &&
+    PBErrDedupGetNbSuppressed() == 4)
+    printf("OK");
+  else
+    printf("NOK");
+  printf("\n");
+  PBErrDedupReset();
+}
+
+void UnitTestRaise() {
+  printf("UnitTestRaise\n");
+  PBErr err = PBErrCreateStatic();
+  err._stream = fopen("/dev/null", "w");
+  PBErrCollector* collector = PBErrCollectorCreate(1);
+  err._collector = collector;
+  int line = __LINE__ + 1;
+  PBErrRaise(&err, PBErrTypeInvalidData, false, 
+    "value %d of %s is %.2f (%lu%%)", 3, "x", 1.5, (unsigned long)7);
+  fclose(err._stream);
+  const PBErr* first = PBErrCollectorFirst(collector);
+  char msg[PBERR_MSGLENGTHMAX];
+  printf("Raise ");
+  if (first != NULL && first->_site != NULL &&
+    first->_site->_line == line &&
+    strcmp(first->_site->_func, "UnitTestRaise") == 0 &&
+    strcmp(PBErrFormatMsg(first, msg, PBERR_MSGLENGTHMAX), 
+    "value 3 of x is 1.50 (7%)") == 0 && err._site == NULL)
+    printf("OK");
+  else
+    printf("NOK");
+  printf("\n");
+  PBErrCollectorFree(&collector);
+}
+
+void UnitTestFormat() {
+  printf("UnitTestFormat\n");
+  PBErr err = PBErrCreateStatic();
+  err._stream = fopen("./testformat.txt", "w");
+  err._format = PBErrFormatJSON;
+  PBErrRaise(&err, PBErrTypeInvalidData, false, "say \"%s\"", "hi");
+  fclose(err._stream);
+  FILE* fd = fopen("./testformat.txt", "r");
+  char line[1024];
+  bool okJSON = (fgets(line, 1024, fd) != NULL &&
+    strncmp(line, "{\"time\":", 8) == 0 &&
+    strstr(line, "\"type\":\"invalid data\"") != NULL &&
+    strstr(line, "\"msg\":\"say \\\"hi\\\"\"") != NULL &&
+    strstr(line, "\"fatal\":false") != NULL &&
+    line[strlen(line) - 2] == '}');
+  fclose(fd);
+  err._stream = fopen("./testformat.txt", "w");
+  err._format = PBErrFormatBin;
+  PBErrRaise(&err, PBErrTypeIOError, false, "bin");
+  fclose(err._stream);
+  fd = fopen("./testformat.txt", "r");
+  unsigned char rec[1024];
+  size_t len = fread(rec, 1, 1024, fd);
+  fclose(fd);
+  remove("./testformat.txt");
+  size_t lenRec = 
+    (size_t)rec[0] | ((size_t)rec[1] << 8) | ((size_t)rec[2] << 16);
+  bool okBin = (len >= 40 && lenRec == len - 4 && 
+    rec[4] == PBERR_RECVERSION && rec[5] == 0 && 
+    rec[8] == PBErrTypeIOError && rec[36] == 3 &&
+    memcmp(rec + 38, "bin", 3) == 0);
+  printf("Format ");
+  if (okJSON && okBin)
+    printf("OK");
+  else
+    printf("NOK");
+  printf("\n");
+}
+
+void UnitTestCount() {
+  printf("UnitTestCount\n");
+  PBErrCountReset();
+  PBErr err = PBErrCreateStatic();
+  err._stream = fopen("/dev/null", "w");
+  err._domain = PBErrDomainGSet;
+  PBErrSetDedup(1, 100);
+  for (int iErr = 0; iErr < 3; ++iErr)
+    PBErrRaise(&err, PBErrTypeInvalidData, false, "UnitTestCount");
+  PBErrSetDedup(0, 0);
+  PBErrDedupReset();
+  fclose(err._stream);
+  PBErrCountStat stat;
+  PBErrCountGet(&stat);
+  bool ret = PBErrCountExport("./testcount.txt");
+  FILE* fd = fopen("./testcount.txt", "r");
+  bool found = false;
+  char line[PBERR_MSGLENGTHMAX];
+  while (fd != NULL && fgets(line, PBERR_MSGLENGTHMAX, fd) != NULL)
+    if (strcmp(line, "pberr_errors_total{domain=\"GSet\","
+      "type=\"invalid data\"} 3\n") == 0)
+      found = true;
+  if (fd != NULL)
+    fclose(fd);
+  remove("./testcount.txt");
+  printf("Count ");
+  if (ret && found && 
+    stat._nb[PBErrDomainGSet][PBErrTypeInvalidData] == 3 &&
+    stat._nbFatal[PBErrDomainGSet] == 0)
+    printf("OK");
+  else
+    printf("NOK");
+  printf("\n");
+}
+
+void UnitTestTryRaise(PBErr* const err, const char* const str) {
+  char buf[10];
+  strcpy(buf, str);
+  PBErrRaise(err, PBErrTypeInvalidData, true, "bad %s", buf);
+}
+
+void UnitTestTry() {
+  printf("UnitTestTry\n");
+  PBErr err = PBErrCreateStatic();
+  volatile int nbInner = 0;
+  volatile int nbOuter = 0;
+  volatile bool okInner = false;
+  volatile bool okOuter = false;
+  PBErrTry {
+    PBErrTry {
+      UnitTestTryRaise(&err, "input");
+      ++nbInner;
+    } PBErrTryCatch(e) {
+      okInner = (e->_type == PBErrTypeInvalidData &&
+        strcmp(e->_msg, "bad input") == 0 && err._site == NULL);
+      // Forward to the enclosing scope
+      PBErr fwd = *e;
+      PBErrCatch(&fwd);
+      ++nbInner;
+    } PBErrTryEnd;
+    ++nbOuter;
+  } PBErrTryCatch(e) {
+    okOuter = (strcmp(e->_msg, "bad input") == 0);
+  } PBErrTryEnd;
+  // Without error
+  PBErrTry {
+    ++nbOuter;
+  } PBErrTryCatch(e) {
+    nbOuter = -1;
+  } PBErrTryEnd;
+  printf("Try ");
+  if (okInner && okOuter && nbInner == 0 && nbOuter == 1 && 
+    PBErrScopeTop == NULL)
+    printf("OK");
+  else
+    printf("NOK");
+  printf("\n");
+}
+
+void UnitTestContextRow(PBErr* const err, const int iRow) {
+  PBErrContextScope("parsing row %d", iRow);
+  PBErrRaise(err, PBErrTypeInvalidData, false, "bad value");
+}
+
+void UnitTestContext() {
+  printf("UnitTestContext\n");
+  bool ok = true;
+  PBErr err = PBErrCreateStatic();
+  err._stream = fopen("./testcontext.txt", "w");
+  {
+    PBErrContextScope("loading %s", "dataset X");
+    UnitTestContextRow(&err, 123);
+    ok &= (PBErrContextCur._nb == 1);
+    err._format = PBErrFormatJSON;
+    UnitTestContextRow(&err, 124);
+  }
+  fclose(err._stream);
+  ok &= (PBErrContextCur._nb == 0);
+  FILE* fd = fopen("./testcontext.txt", "r");
+  char buf[4096];
+  size_t len = fread(buf, 1, sizeof(buf) - 1, fd);
+  buf[len] = '\0';
+  fclose(fd);
+  remove("./testcontext.txt");
+  ok &= (strstr(buf, 
+    "Context:\n  loading dataset X\n  parsing row 123\n") != NULL);
+  ok &= (strstr(buf, 
+    "\"context\":[\"loading dataset X\",\"parsing row 124\"]") != 
+    NULL);
+  // A fatal error unwinding to a PBErrTry pops the frames pushed 
+  // inside it
+  PBErrContextPush("outer");
+  PBErrTry {
+    PBErrContextPush("inner");
+    PBErrContextPush("innermost");
+    PBErrRaise(&err, PBErrTypeInvalidData, true, "fatal");
+  } PBErrTryCatch(e) {
+    ok &= (PBErrContextCur._nb == 1);
+  } PBErrTryEnd;
+  PBErrContextPop();
+  // Frames beyond the capacity are counted but not memorized
+  for (int i = 0; i < PBERR_NBMAXCONTEXT + 4; ++i)
+    PBErrContextPush("frame %d", i);
+  ok &= (PBErrContextCur._nb == PBERR_NBMAXCONTEXT + 4);
+  for (int i = 0; i < PBERR_NBMAXCONTEXT + 4; ++i)
+    PBErrContextPop();
+  PBErrContextPop();
+  ok &= (PBErrContextCur._nb == 0);
+  printf("Context ");
+  if (ok)
+    printf("OK");
+  else
+    printf("NOK");
+  printf("\n");
+}
+
+void UnitTestCrash() {
+  printf("UnitTestCrash\n");
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    // No core dump for the test
+    struct rlimit lim = {.rlim_cur = 0, .rlim_max = 0};
+    setrlimit(RLIMIT_CORE, &lim);
+    int fd = open("./testcrash.txt", O_WRONLY | O_CREAT | O_TRUNC, 
+      0644);
+    PBErrCrashHandlerInstall(fd);
+    PBErrThreadInit(NULL);
+    PBErr* err = PBErrThread(PBErrDomainGSet);
+    err->_stream = fopen("/dev/null", "w");
+    PBErrRaise(err, PBErrTypeInvalidData, false, "before crash %d", 7);
+    volatile int* volatile ptr = NULL;
+    *ptr = 1;
+    _exit(0);
+  }
+  int status = 0;
+  waitpid(pid, &status, 0);
+  FILE* fd = fopen("./testcrash.txt", "r");
+  bool okSig = false;
+  bool okLast = false;
+  bool okEnd = false;
+  char line[PBERR_MSGLENGTHMAX];
+  while (fd != NULL && fgets(line, PBERR_MSGLENGTHMAX, fd) != NULL) {
+    if (strcmp(line, "Signal: 11 (SIGSEGV)\n") == 0)
+      okSig = true;
+    if (strcmp(line, "PBErrLast: GSet\n") == 0)
+      okLast = true;
+    if (strcmp(line, "--------------------\n") == 0)
+      okEnd = true;
+  }
+  if (fd != NULL)
+    fclose(fd);
+  remove("./testcrash.txt");
+  printf("Crash ");
+  if (WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV && 
+    okSig && okLast && okEnd)
+    printf("OK");
+  else
+    printf("NOK");
+  printf("\n");
+}
+
+// Return (void*)1 if the thread got an alternate stack, else NULL
+void* UnitTestCrashWorker(void* arg) {
+  (void)arg;
+  stack_t cur;
+  bool ok = PBErrCrashHandlerThreadInit() && 
+    sigaltstack(NULL, &cur) == 0 && (cur.ss_flags & SS_DISABLE) == 0 &&
+    PBErrCrashHandlerThreadInit();
+  return (ok ? (void*)1 : NULL);
+}
+
+void UnitTestCrashStack() {
+  printf("UnitTestCrashStack\n");
+  // The alternate stack of the user is restored at uninstallation
+  void* mem = malloc(65536);
+  stack_t user = {.ss_sp = mem, .ss_flags = 0, .ss_size = 65536};
+  sigaltstack(&user, NULL);
+  int fd = open("/dev/null", O_WRONLY);
+  bool okInstall = PBErrCrashHandlerInstall(fd);
+  stack_t cur;
+  sigaltstack(NULL, &cur);
+  bool okOwn = (cur.ss_sp != mem);
+  PBErrCrashHandlerUninstall();
+  close(fd);
+  sigaltstack(NULL, &cur);
+  bool okRestore = (cur.ss_sp == mem && (cur.ss_flags & SS_DISABLE) == 0);
+  stack_t disable = {.ss_sp = NULL, .ss_flags = SS_DISABLE, .ss_size = 0};
+  sigaltstack(&disable, NULL);
+  free(mem);
+  // Other threads get their own alternate stack
+  pthread_t thread;
+  void* okThread = NULL;
+  pthread_create(&thread, NULL, UnitTestCrashWorker, NULL);
+  pthread_join(thread, &okThread);
+  printf("CrashStack ");
+  if (okInstall && okOwn && okRestore && okThread != NULL)
+    printf("OK");
+  else
+    printf("NOK");
+  printf("\n");
+}
+
+volatile int unitTestUnwindNb = 0;
+
+__attribute__((noinline)) int UnitTestUnwindLeaf(void** const stack,
+  const int height) {
+  int nb = PBErrStackCapture(stack, height);
+  // Not a tail call, so the capture returns into this function
+  ++unitTestUnwindNb;
+  return nb;
+}
+
+void UnitTestUnwind() {
+  printf("UnitTestUnwind\n");
+  bool ok = (PBErrGetUnwinder() == PBErrUnwinderBacktrace);
+  PBErrUnwinder unwinders[2] = 
+    {PBErrUnwinderBacktrace, PBErrUnwinderFramePointer};
+  void* stacks[2][PBERR_MAXSTACKHEIGHT];
+  int heights[2] = {0, 0};
+  for (int iUnw = 0; iUnw < 2; ++iUnw) {
+    ok &= PBErrUnwindInit(unwinders[iUnw]);
+    ok &= (PBErrGetUnwinder() == unwinders[iUnw]);
+    heights[iUnw] = 
+      UnitTestUnwindLeaf(stacks[iUnw], PBERR_MAXSTACKHEIGHT);
+  }
+  // Both backends start with the return address in the leaf, further
+  // frames depend on the frame pointers in the compiled code
+  ok &= (heights[0] >= 2 && heights[0] <= PBERR_MAXSTACKHEIGHT);
+  ok &= (heights[1] >= 1 && heights[1] <= PBERR_MAXSTACKHEIGHT);
+  ok &= (stacks[0][0] == stacks[1][0]);
+  char** syms = backtrace_symbols(stacks[1], 1);
+  ok &= (syms != NULL && strstr(syms[0], "UnitTestUnwindLeaf") != NULL);
+  free(syms);
+  // Reports with the frame pointer walk
+  PBErr err = PBErrCreateStatic();
+  err._fatal = false;
+  err._format = PBErrFormatJSON;
+  err._stream = fopen("./testunwind.txt", "w");
+  PBErrRaise(&err, PBErrTypeInvalidData, false, "fp");
+  // Reports without stack
+  PBErrSetStackHeight(0);
+  PBErrRaise(&err, PBErrTypeInvalidData, false, "nostack");
+  fclose(err._stream);
+  ok &= (PBErrGetStackHeight() == 0);
+  PBErrSetStackHeight(PBERR_STACKHEIGHTDEFAULT + 1);
+  ok &= (PBErrGetStackHeight() == PBERR_STACKHEIGHTDEFAULT + 1);
+  PBErrSetStackHeight(PBERR_MAXSTACKHEIGHT + 1);
+  ok &= (PBErrGetStackHeight() == PBERR_MAXSTACKHEIGHT);
+  PBErrSetStackHeight(-1);
+  ok &= (PBErrGetStackHeight() == 0);
+  PBErrSetStackHeight(PBERR_STACKHEIGHTDEFAULT);
+  FILE* fd = fopen("./testunwind.txt", "r");
+  char buf[4096];
+  size_t len = fread(buf, 1, sizeof(buf) - 1, fd);
+  buf[len] = '\0';
+  fclose(fd);
+  remove("./testunwind.txt");
+  char* fp = strstr(buf, "\"msg\":\"fp\"");
+  char* nostack = strstr(buf, "\"msg\":\"nostack\"");
+  ok &= (fp != NULL && nostack != NULL);
+  if (nostack != NULL)
+    ok &= (strstr(nostack, "\"stack\":[]") != NULL);
+  if (fp != NULL && nostack != NULL) {
+    nostack[0] = '\0';
+    ok &= (strstr(fp, "\"stack\":[\"0x") != NULL);
+  }
+  ok &= !PBErrUnwindInit(PBErrUnwinderNb);
+  ok &= PBErrUnwindInit(PBErrUnwinderBacktrace);
+  printf("Unwind ");
+  if (ok)
+    printf("OK");
+  else
+    printf("NOK");
+  printf("\n");
+}
+
+__attribute__((noinline)) double UnitTestProfBusy(void) {
+  volatile double sum = 0.0;
+  struct timespec start;
+  struct timespec now;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+  do {
+    for (int i = 0; i < 100000; ++i)
+      sum += sqrt((double)i);
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+  } while ((now.tv_sec - start.tv_sec) * 1000000000l + 
+    (now.tv_nsec - start.tv_nsec) < 300000000l);
+  return sum;
+}
+
+void UnitTestProf() {
+  printf("UnitTestProf\n");
+  bool okStart = PBErrProfStart(1000);
+  UnitTestProfBusy();
+  FILE* fd = fopen("./testprof.txt", "w");
+  bool okStop = PBErrProfStop(fd);
+  fclose(fd);
+  fd = fopen("./testprof.txt", "r");
+  bool found = false;
+  unsigned long nbSample = 0;
+  char line[4096];
+  while (fgets(line, 4096, fd) != NULL) {
+    if (strstr(line, "UnitTestProf;UnitTestProfBusy") != NULL)
+      found = true;
+    char* nb = strrchr(line, ' ');
+    if (nb != NULL)
+      nbSample += strtoul(nb + 1, NULL, 10);
+  }
+  fclose(fd);
+  remove("./testprof.txt");
+  printf("Prof ");
+  if (okStart && okStop && found && nbSample > 0 &&
+    nbSample + PBErrProfGetNbDropped() == PBErrProfGetNbSample() &&
+    !PBErrProfStop(NULL))
+    printf("OK");
+  else
+    printf("NOK");
+  printf("\n");
+}
+
+// Spin with a junk frame pointer, as code built without frame
+// pointers may have when it's interrupted
+__attribute__((noinline)) void UnitTestProfJunk(unsigned long nb) {
+#if defined(__x86_64__)
+  // Step over the red zone before pushing
+  __asm__ volatile(
+    "sub $128, %%rsp\n\t"
+    "push %%rbp\n\t"
+    "mov $0x1000, %%rbp\n\t"
+    "1: dec %0\n\t"
+    "jnz 1b\n\t"
+    "pop %%rbp\n\t"
+    "add $128, %%rsp"
+    : "+r"(nb) : : "cc", "memory");
+#else
+  (void)nb;
+#endif
+}
+
+void* UnitTestProfJunkWorker(void* arg) {
+  (void)arg;
+  UnitTestProfJunk(300000000ul);
+  return NULL;
+}
+
+void UnitTestProfFp() {
+  printf("UnitTestProfFp\n");
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    // The frame pointer walk ends on the junk frame pointer instead 
+    // of crashing, with the bounds of the stack known in the main
+    // thread and unknown in the worker
+    PBErrUnwindInit(PBErrUnwinderFramePointer);
+    PBErrProfStart(1000);
+    pthread_t thread;
+    pthread_create(&thread, NULL, UnitTestProfJunkWorker, NULL);
+    UnitTestProfJunk(300000000ul);
+    pthread_join(thread, NULL);
+    FILE* fd = fopen("/dev/null", "w");
+    PBErrProfStop(fd);
+    fclose(fd);
+    _exit(PBErrProfGetNbSample() > 0 ? 0 : 1);
+  }
+  int status = 0;
+  waitpid(pid, &status, 0);
+  printf("ProfFp ");
+  if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+    printf("OK");
+  else
+    printf("NOK");
+  printf("\n");
+}
+
+// Not cloned, else the clone's name doesn't match in the profile
+__attribute__((noinline, noclone, used))
+void UnitTestHeapProfAlloc(PBErr* const err,
+  char** const arr, const int nb) {
+  for (int i = 0; i < nb; ++i)
+    arr[i] = PBErrMalloc(err, 4096);
+}
+
+// Return the number of bytes of the lines of the heap profile in the
+// file at 'path' containing 'str'
+unsigned long UnitTestHeapProfBytes(const char* const path, 
+  const char* const str) {
+  FILE* fd = fopen(path, "r");
+  if (fd == NULL)
+    return 0;
+  unsigned long bytes = 0;
+  char line[4096];
+  while (fgets(line, 4096, fd) != NULL) {
+    char* nb = strrchr(line, ' ');
+    if (strstr(line, str) != NULL && nb != NULL)
+      bytes += strtoul(nb + 1, NULL, 10);
+  }
+  fclose(fd);
+  return bytes;
+}
+
+void UnitTestHeapProf() {
+  printf("UnitTestHeapProf\n");
+  bool okStart = PBErrHeapProfStart(4096);
+  char* arr[256];
+  UnitTestHeapProfAlloc(&thePBErr, arr, 256);
+  const char* path = "./testheapprof.txt";
+  bool okSig = PBErrHeapProfDumpOnSignal(SIGUSR1, path);
+  raise(SIGUSR1);
+  PBErrHeapProfPoll();
+  unsigned long bytesAlloc = 
+    UnitTestHeapProfBytes(path, "UnitTestHeapProf;UnitTestHeapProfAlloc");
+  for (int i = 0; i < 256; ++i)
+    PBErrFree(&thePBErr, arr[i]);
+  FILE* fd = fopen(path, "w");
+  bool okDump = PBErrHeapProfDump(fd);
+  fclose(fd);
+  unsigned long bytesFree = 
+    UnitTestHeapProfBytes(path, "UnitTestHeapProfAlloc");
+  remove(path);
+  unsigned long nbLive = PBErrHeapProfGetNbLive();
+  PBErrHeapProfStop();
+  printf("HeapProf ");
+#if defined(PBERR_ALLOCSTAT)
+  // 1MB is allocated, less than 64KB before the thread notices the 
+  // start
+  if (okStart && okSig && okDump && bytesAlloc > 512 * 1024 && 
+    bytesAlloc < 2048 * 1024 && bytesFree == 0 && nbLive == 0 &&
+    !PBErrHeapProfDump(stdout))
+#else
+  (void)okSig;
+  (void)okDump;
+  (void)bytesAlloc;
+  (void)bytesFree;
+  (void)nbLive;
+  if (!okStart)
+#endif
+    printf("OK");
+  else
+    printf("NOK");
+  printf("\n");
+}
+
+void UnitTestTraceWork(const int nb) {
+  PBErrTraceScope(PBErrDomainGSet, "UnitTestTraceWork");
+  for (int i = 0; i < nb; ++i) {
+    PBErrTraceBegin(PBErrDomainGSet, "step");
+    PBErrTraceCounter(PBErrDomainGSet, "i", i);
+    PBErrTraceEnd(PBErrDomainGSet, "step");
+  }
+}
+
+void* UnitTestTraceWorker(void* arg) {
+  (void)arg;
+  PBErrTraceRecord(PBErrDomainGSet, "worker", 'i', 0);
+  return NULL;
+}
+
+void UnitTestTrace() {
+  printf("UnitTestTrace\n");
+  PBErrTraceEnable(true);
+  UnitTestTraceWork(3);
+  PBErr err = PBErrCreateStatic();
+  err._stream = fopen("/dev/null", "w");
+  PBErrRaise(&err, PBErrTypeIOError, false, "UnitTestTrace");
+  fclose(err._stream);
+  PBErrTraceEnable(false);
+  FILE* fd = fopen("./testtrace.txt", "w");
+  bool ret = PBErrTraceExport(fd);
+  fclose(fd);
+  PBErrTraceReset();
+  fd = fopen("./testtrace.txt", "r");
+  int nbBegin = 0;
+  int nbEnd = 0;
+  int nbCounter = 0;
+  int nbInstant = 0;
+  char line[PBERR_MSGLENGTHMAX];
+  while (fgets(line, PBERR_MSGLENGTHMAX, fd) != NULL) {
+    if (strstr(line, "\"ph\":\"B\"") != NULL)
+      ++nbBegin;
+    if (strstr(line, "\"ph\":\"E\"") != NULL)
+      ++nbEnd;
+    if (strstr(line, "\"ph\":\"C\"") != NULL)
+      ++nbCounter;
+    if (strstr(line, "\"name\":\"I/O error\",\"cat\":\"PBErr\","
+      "\"ph\":\"i\"") != NULL)
+      ++nbInstant;
+  }
+  fclose(fd);
+  // The threads started one after the other reuse the same ring, the
+  // events of the exited ones being dropped
+  PBErrTraceEnable(true);
+  for (int iThread = 0; iThread < 8; ++iThread) {
+    pthread_t thread;
+    pthread_create(&thread, NULL, UnitTestTraceWorker, NULL);
+    pthread_join(thread, NULL);
+  }
+  PBErrTraceEnable(false);
+  fd = fopen("./testtrace.txt", "w");
+  ret &= PBErrTraceExport(fd);
+  fclose(fd);
+  fd = fopen("./testtrace.txt", "r");
+  int nbRing = 0;
+  int nbWorker = 0;
+  while (fgets(line, PBERR_MSGLENGTHMAX, fd) != NULL) {
+    if (strstr(line, "\"thread_name\"") != NULL)
+      ++nbRing;
+    if (strstr(line, "\"name\":\"worker\"") != NULL)
+      ++nbWorker;
+  }
+  fclose(fd);
+  ret &= (nbRing <= 2 && nbWorker == 1 && 
+    PBErrTraceGetNbDropped() == 7);
+  PBErrTraceReset();
+  ret &= (PBErrTraceGetNbDropped() == 0);
+  remove("./testtrace.txt");
+  printf("Trace ");
+#if BUILDMODE != 2
+  if (ret && nbBegin == 4 && nbEnd == 4 && nbCounter == 3 && 
+    nbInstant == 1)
+#else
+  if (ret && nbBegin == 0 && nbEnd == 0 && nbCounter == 0 && 
+    nbInstant == 0)
+#endif
+    printf("OK");
+  else
+    printf("NOK");
+  printf("\n");
+}
+
+void UnitTestSymbol() {
+  printf("UnitTestSymbol\n");
+  char sym[100];
+  PBErrSymbolize((void*)UnitTestSymbol, sym, 100);
+  char symCache[100];
+  PBErrSymbolize((void*)UnitTestSymbol, symCache, 100);
+  PBErr err = PBErrCreateStatic();
+  err._stream = fopen("./testsymbol.txt", "w");
+  err._fatal = false;
+  PBErrSetSymbolMode(PBErrSymbolModeRaw);
+  PBErrAddrLogOpen("./testaddrlog.txt");
+  PBErrCatch(&err);
+  PBErrAddrLogClose();
+  PBErrSetSymbolMode(PBErrSymbolModeImmediate);
+  fclose(err._stream);
+  FILE* fd = fopen("./testaddrlog.txt", "r");
+  char line[PBERR_MSGLENGTHMAX];
+  bool isLog = (fgets(line, PBERR_MSGLENGTHMAX, fd) != NULL &&
+    strstr(line, " 0x") != NULL);
+  fclose(fd);
+  remove("./testsymbol.txt");
+  remove("./testaddrlog.txt");
+  printf("Symbol ");
+  if (strstr(sym, "UnitTestSymbol") != NULL && 
+    strcmp(sym, symCache) == 0 && isLog)
+    printf("OK");
+  else
+    printf("NOK");
+  printf("\n");
+}
+
 void UnitTestCatch() {
   printf("UnitTestCatch\n");
   thePBErr._stream = stdout;
@@ -110,7 +1527,33 @@ void UnitTestAll() {
   UnitTestCreateStatic();
   UnitTestReset();
   UnitTestMalloc();
+  UnitTestAllocStat();
+  UnitTestMallocVariant();
+  UnitTestReclaim();
+  UnitTestArena();
   UnitTestIO();
+  UnitTestMap();
+  UnitTestArray();
+  UnitTestBin();
+  UnitTestAsyncOut();
+  UnitTestDurable();
+  UnitTestThread();
+  UnitTestDomainErr();
+  UnitTestSink();
+  UnitTestSymbol();
+  UnitTestDedup();
+  UnitTestRaise();
+  UnitTestFormat();
+  UnitTestCount();
+  UnitTestTry();
+  UnitTestContext();
+  UnitTestCrash();
+  UnitTestCrashStack();
+  UnitTestUnwind();
+  UnitTestProf();
+  UnitTestProfFp();
+  UnitTestHeapProf();
+  UnitTestTrace();
   UnitTestCatch();
 }
 
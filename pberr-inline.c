@@ -0,0 +1,307 @@
+// ============ PBERR-INLINE.C ================
+
+// Fast paths of the secured malloc and I/O. Included in pberr.h as
+// static inline functions if BUILDMODE != 0, else in pberr.c as
+// normal functions. The errors are reported through PBErrFailed which
+// is kept out of the fast paths
+
+// ================ Functions implementation ====================
+
+// Secured malloc
+#if defined(PBERRALL) || defined(PBERRSAFEMALLOC)
+#if BUILDMODE != 0
+static inline
+#endif
+void* PBErrMalloc(PBErr* const that, const size_t size) {
+  void* ret = malloc(size);
+  if (PBERR_UNLIKELY(ret == NULL)) {
+    ret = _PBErrReclaimRetry(that, PBErrFailMalloc, NULL, 0, size);
+    if (ret == NULL) {
+      PBErrFailed(that, PBErrFailMalloc, NULL, size);
+      return NULL;
+    }
+  }
+#if defined(PBERR_ALLOCSTAT)
+  _PBErrAllocStatAdd(that, ret);
+#endif
+  return ret;
+}
+
+// Secured aligned malloc, 'alignment' must be a power of 2 multiple
+// of sizeof(void*)
+#if BUILDMODE != 0
+static inline
+#endif
+void* PBErrMallocAligned(PBErr* const that, const size_t alignment,
+  const size_t size) {
+#if BUILDMODE == 0
+  if (PBERR_UNLIKELY(alignment < sizeof(void*) ||
+    (alignment & (alignment - 1)) != 0))
+    PBErrFailed(that, PBErrFailAlignment, NULL, alignment);
+#endif
+  void* ret = NULL;
+  int rc = posix_memalign(&ret, alignment, size);
+  if (PBERR_UNLIKELY(rc != 0)) {
+    // Releasing memory can't fix an invalid alignment
+    if (rc != ENOMEM) {
+      PBErrFailed(that, PBErrFailAlignment, NULL, alignment);
+      return NULL;
+    }
+    ret = _PBErrReclaimRetry(that, PBErrFailMallocAligned, NULL, 
+      alignment, size);
+    if (ret == NULL) {
+      PBErrFailed(that, PBErrFailMallocAligned, NULL, size);
+      return NULL;
+    }
+  }
+#if defined(PBERR_ALLOCSTAT)
+  _PBErrAllocStatAdd(that, ret);
+#endif
+  return ret;
+}
+
+// Secured calloc
+#if BUILDMODE != 0
+static inline
+#endif
+void* PBErrCalloc(PBErr* const that, const size_t nb, 
+  const size_t size) {
+  void* ret = calloc(nb, size);
+  if (PBERR_UNLIKELY(ret == NULL)) {
+    ret = _PBErrReclaimRetry(that, PBErrFailCalloc, NULL, nb, size);
+    if (ret == NULL) {
+      // Report the total size, or SIZE_MAX if it overflows
+      PBErrFailed(that, PBErrFailCalloc, NULL, 
+        (size != 0 && nb > SIZE_MAX / size ? SIZE_MAX : nb * size));
+      return NULL;
+    }
+  }
+#if defined(PBERR_ALLOCSTAT)
+  _PBErrAllocStatAdd(that, ret);
+#endif
+  return ret;
+}
+
+// Secured realloc of the memory 'ptr' allocated with the PBErrMalloc
+// functions. If it fails, 'ptr' is still valid
+// If 'size' is 0, 'ptr' is freed and null is returned
+#if BUILDMODE != 0
+static inline
+#endif
+void* PBErrRealloc(PBErr* const that, void* const ptr, 
+  const size_t size) {
+  if (size == 0) {
+    PBErrFree(that, ptr);
+    return NULL;
+  }
+#if defined(PBERR_ALLOCSTAT)
+  // Only look up the old memory here, it stays allocated if the
+  // realloc fails
+  long iSample = -1;
+  uintptr_t sample = 0;
+  size_t sizeOld = 
+    (ptr != NULL ? _PBErrAllocStatPeek(ptr, &iSample, &sample) : 0);
+#endif
+  void* ret = realloc(ptr, size);
+  if (PBERR_UNLIKELY(ret == NULL)) {
+    ret = _PBErrReclaimRetry(that, PBErrFailRealloc, ptr, 0, size);
+    if (ret == NULL) {
+      PBErrFailed(that, PBErrFailRealloc, NULL, size);
+      return NULL;
+    }
+  }
+#if defined(PBERR_ALLOCSTAT)
+  if (ptr != NULL)
+    _PBErrAllocStatResize(that, iSample, sample, sizeOld, ret);
+  else
+    _PBErrAllocStatAdd(that, ret);
+#endif
+  return ret;
+}
+
+// Free the memory 'ptr' allocated with PBErrMalloc
+#if BUILDMODE != 0
+static inline
+#endif
+void PBErrFree(PBErr* const that, void* const ptr) {
+  if (ptr == NULL)
+    return;
+#if defined(PBERR_ALLOCSTAT)
+  _PBErrAllocStatSub(that, ptr);
+#else
+  (void)that;
+#endif
+  free(ptr);
+}
+#endif
+
+// Secured I/O
+#if defined(PBERRALL) || defined(PBERRSAFEIO)
+
+#if BUILDMODE == 0
+// Check the arguments common to the secured I/O functions
+static void PBErrCheckIO(PBErr* const that, const FILE* const stream,
+  const char* const format) {
+  if (PBERR_UNLIKELY(that == NULL))
+    PBErrFailed(that, PBErrFailNull, "that", 0);
+  if (PBERR_UNLIKELY(stream == NULL))
+    PBErrFailed(that, PBErrFailNull, "stream", 0);
+  if (PBERR_UNLIKELY(format == NULL))
+    PBErrFailed(that, PBErrFailNull, "format", 0);
+}
+#endif
+
+#if BUILDMODE != 0
+static inline
+#endif
+bool _PBErrScanfShort(PBErr* const that,
+  FILE* const stream, const char* const format, short* const data) {
+#if BUILDMODE == 0
+  PBErrCheckIO(that, stream, format);
+  if (PBERR_UNLIKELY(data == NULL))
+    PBErrFailed(that, PBErrFailNull, "data", 0);
+#endif
+  // Read from the stream
+  if (PBERR_UNLIKELY(fscanf(stream, format, data) == EOF)) {
+    PBErrFailed(that, PBErrFailScanf, NULL, 0);
+    return false;
+  }
+  return true;
+}
+
+#if BUILDMODE != 0
+static inline
+#endif
+bool _PBErrScanfInt(PBErr* const that,
+  FILE* const stream, const char* const format, int* const data) {
+#if BUILDMODE == 0
+  PBErrCheckIO(that, stream, format);
+  if (PBERR_UNLIKELY(data == NULL))
+    PBErrFailed(that, PBErrFailNull, "data", 0);
+#endif
+  // Read from the stream
+  if (PBERR_UNLIKELY(fscanf(stream, format, data) == EOF)) {
+    PBErrFailed(that, PBErrFailScanf, NULL, 0);
+    return false;
+  }
+  return true;
+}
+
+#if BUILDMODE != 0
+static inline
+#endif
+bool _PBErrScanfFloat(PBErr* const that,
+  FILE* const stream, const char* const format, float* const data) {
+#if BUILDMODE == 0
+  PBErrCheckIO(that, stream, format);
+  if (PBERR_UNLIKELY(data == NULL))
+    PBErrFailed(that, PBErrFailNull, "data", 0);
+#endif
+  // Read from the stream
+  if (PBERR_UNLIKELY(fscanf(stream, format, data) == EOF)) {
+    PBErrFailed(that, PBErrFailScanf, NULL, 0);
+    return false;
+  }
+  return true;
+}
+
+#if BUILDMODE != 0
+static inline
+#endif
+bool _PBErrScanfStr(PBErr* const that,
+  FILE* const stream, const char* const format, char* const data) {
+#if BUILDMODE == 0
+  PBErrCheckIO(that, stream, format);
+  if (PBERR_UNLIKELY(data == NULL))
+    PBErrFailed(that, PBErrFailNull, "data", 0);
+#endif
+  // Read from the stream
+  if (PBERR_UNLIKELY(fscanf(stream, format, data) == EOF)) {
+    PBErrFailed(that, PBErrFailScanf, NULL, 0);
+    return false;
+  }
+  return true;
+}
+
+#if BUILDMODE != 0
+static inline
+#endif
+bool _PBErrPrintfShort(PBErr* const that,
+  FILE* const stream, const char* const format, const short data) {
+#if BUILDMODE == 0
+  PBErrCheckIO(that, stream, format);
+#endif
+  // Print to the stream
+  if (PBERR_UNLIKELY(fprintf(stream, format, data) < 0)) {
+    PBErrFailed(that, PBErrFailPrintf, NULL, 0);
+    return false;
+  }
+  return true;
+}
+
+#if BUILDMODE != 0
+static inline
+#endif
+bool _PBErrPrintfLong(PBErr* const that,
+  FILE* const stream, const char* const format, const long data) {
+#if BUILDMODE == 0
+  PBErrCheckIO(that, stream, format);
+#endif
+  // Print to the stream
+  if (PBERR_UNLIKELY(fprintf(stream, format, data) < 0)) {
+    PBErrFailed(that, PBErrFailPrintf, NULL, 0);
+    return false;
+  }
+  return true;
+}
+
+#if BUILDMODE != 0
+static inline
+#endif
+bool _PBErrPrintfInt(PBErr* const that,
+  FILE* const stream, const char* const format, const int data) {
+#if BUILDMODE == 0
+  PBErrCheckIO(that, stream, format);
+#endif
+  // Print to the stream
+  if (PBERR_UNLIKELY(fprintf(stream, format, data) < 0)) {
+    PBErrFailed(that, PBErrFailPrintf, NULL, 0);
+    return false;
+  }
+  return true;
+}
+
+#if BUILDMODE != 0
+static inline
+#endif
+bool _PBErrPrintfFloat(PBErr* const that,
+  FILE* const stream, const char* const format, const float data) {
+#if BUILDMODE == 0
+  PBErrCheckIO(that, stream, format);
+#endif
+  // Print to the stream
+  if (PBERR_UNLIKELY(fprintf(stream, format, data) < 0)) {
+    PBErrFailed(that, PBErrFailPrintf, NULL, 0);
+    return false;
+  }
+  return true;
+}
+
+#if BUILDMODE != 0
+static inline
+#endif
+bool _PBErrPrintfStr(PBErr* const that,
+  FILE* const stream, const char* const format,
+  const char* const data) {
+#if BUILDMODE == 0
+  PBErrCheckIO(that, stream, format);
+#endif
+  // Print to the stream
+  if (PBERR_UNLIKELY(fprintf(stream, format, data) < 0)) {
+    PBErrFailed(that, PBErrFailPrintf, NULL, 0);
+    return false;
+  }
+  return true;
+}
+
+#endif
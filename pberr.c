@@ -2,45 +2,123 @@
 
 // ================= Include =================
 
+// GNU extensions (dladdr, dl_iterate_phdr, ...)
+#ifndef _GNU_SOURCE
+  #define _GNU_SOURCE
+#endif
 #include "pberr.h"
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <dlfcn.h>
+#include <link.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <stdarg.h>
+#include <ucontext.h>
+#include <sys/time.h>
+#include <math.h>
 
 // ================= Define ==================
 
 // Default PBErr
 PBErr thePBErr = {._msg[0] = '\0', ._type = PBErrTypeUnknown, 
   ._stream = NULL, ._fatal = true};
+// Default PBErr of each repository, tagged with its domain so that
+// the allocations and errors are accounted per repository. The
+// default domain uses thePBErr. Without their own stream they are
+// printed as thePBErr (cf PBErrCatch)
+#define PBERR_DOMAINERR(Name) [PBErrDomain ## Name] = { \
+  ._msg[0] = '\0', ._type = PBErrTypeUnknown, ._stream = NULL, \
+  ._fatal = true, ._domain = PBErrDomain ## Name}
+static PBErr PBErrDomainErr[PBErrDomainNb] = {
+  PBERR_DOMAINERR(PBMath),
+  PBERR_DOMAINERR(GSet),
+  PBERR_DOMAINERR(ELORank),
+  PBERR_DOMAINERR(Shapoid),
+  PBERR_DOMAINERR(BCurve),
+  PBERR_DOMAINERR(GenBrush),
+  PBERR_DOMAINERR(FracNoise),
+  PBERR_DOMAINERR(GenAlg),
+  PBERR_DOMAINERR(Grad),
+  PBERR_DOMAINERR(KnapSack),
+  PBERR_DOMAINERR(NeuraNet),
+  PBERR_DOMAINERR(PBPhys),
+  PBERR_DOMAINERR(GenTree),
+  PBERR_DOMAINERR(JSON),
+  PBERR_DOMAINERR(MiniFrame),
+  PBERR_DOMAINERR(PixelToPosEstimator),
+  PBERR_DOMAINERR(PBDataAnalysis),
+  PBERR_DOMAINERR(PBImgAnalysis),
+  PBERR_DOMAINERR(PBFileSys),
+  PBERR_DOMAINERR(SDSIA),
+  PBERR_DOMAINERR(GDataSet),
+  PBERR_DOMAINERR(ResPublish),
+  PBERR_DOMAINERR(TheSquid),
+  PBERR_DOMAINERR(CBo),
+  PBERR_DOMAINERR(Cryptic),
+  PBERR_DOMAINERR(GradAutomaton),
+  PBERR_DOMAINERR(Smally),
+  PBERR_DOMAINERR(Buzzy),
+  PBERR_DOMAINERR(NeuraMorph)
+};
 // Declare a pointer for each repository, by default they are
-// all pointing toward the default PBErr, but it allows the 
-// user to manage separately the errors if necessary
-PBErr* PBMathErr = &thePBErr;
-PBErr* GSetErr = &thePBErr;
-PBErr* ELORankErr = &thePBErr;
-PBErr* ShapoidErr = &thePBErr;
-PBErr* BCurveErr = &thePBErr;
-PBErr* GenBrushErr = &thePBErr;
-PBErr* FracNoiseErr = &thePBErr;
-PBErr* GenAlgErr = &thePBErr;
-PBErr* GradErr = &thePBErr;
-PBErr* KnapSackErr = &thePBErr;
-PBErr* NeuraNetErr = &thePBErr;
-PBErr* PBPhysErr = &thePBErr;
-PBErr* GenTreeErr = &thePBErr;
-PBErr* JSONErr = &thePBErr;
-PBErr* MiniFrameErr = &thePBErr;
-PBErr* PixelToPosEstimatorErr = &thePBErr;
-PBErr* PBDataAnalysisErr = &thePBErr;
-PBErr* PBImgAnalysisErr = &thePBErr;
-PBErr* PBFileSysErr = &thePBErr;
-PBErr* SDSIAErr = &thePBErr;
-PBErr* GDataSetErr = &thePBErr;
-PBErr* ResPublishErr = &thePBErr;
-PBErr* TheSquidErr = &thePBErr;
-PBErr* CBoErr = &thePBErr;
-PBErr* CrypticErr = &thePBErr;
-PBErr* GradAutomatonErr = &thePBErr;
-PBErr* SmallyErr = &thePBErr;
-PBErr* BuzzyErr = &thePBErr;
-PBErr* NeuraMorphErr = &thePBErr;
+// pointing toward the default PBErr of their repository, but it 
+// allows the user to manage separately the errors if necessary
+// The pointers are thread local to allow each thread to manage its
+// own errors (cf PBErrThreadInit)
+_Thread_local PBErr* PBMathErr = PBErrDomainErr + PBErrDomainPBMath;
+_Thread_local PBErr* GSetErr = PBErrDomainErr + PBErrDomainGSet;
+_Thread_local PBErr* ELORankErr = PBErrDomainErr + PBErrDomainELORank;
+_Thread_local PBErr* ShapoidErr = PBErrDomainErr + PBErrDomainShapoid;
+_Thread_local PBErr* BCurveErr = PBErrDomainErr + PBErrDomainBCurve;
+_Thread_local PBErr* GenBrushErr = PBErrDomainErr + PBErrDomainGenBrush;
+_Thread_local PBErr* FracNoiseErr = PBErrDomainErr + PBErrDomainFracNoise;
+_Thread_local PBErr* GenAlgErr = PBErrDomainErr + PBErrDomainGenAlg;
+_Thread_local PBErr* GradErr = PBErrDomainErr + PBErrDomainGrad;
+_Thread_local PBErr* KnapSackErr = PBErrDomainErr + PBErrDomainKnapSack;
+_Thread_local PBErr* NeuraNetErr = PBErrDomainErr + PBErrDomainNeuraNet;
+_Thread_local PBErr* PBPhysErr = PBErrDomainErr + PBErrDomainPBPhys;
+_Thread_local PBErr* GenTreeErr = PBErrDomainErr + PBErrDomainGenTree;
+_Thread_local PBErr* JSONErr = PBErrDomainErr + PBErrDomainJSON;
+_Thread_local PBErr* MiniFrameErr = PBErrDomainErr + PBErrDomainMiniFrame;
+_Thread_local PBErr* PixelToPosEstimatorErr = 
+  PBErrDomainErr + PBErrDomainPixelToPosEstimator;
+_Thread_local PBErr* PBDataAnalysisErr = 
+  PBErrDomainErr + PBErrDomainPBDataAnalysis;
+_Thread_local PBErr* PBImgAnalysisErr = 
+  PBErrDomainErr + PBErrDomainPBImgAnalysis;
+_Thread_local PBErr* PBFileSysErr = PBErrDomainErr + PBErrDomainPBFileSys;
+_Thread_local PBErr* SDSIAErr = PBErrDomainErr + PBErrDomainSDSIA;
+_Thread_local PBErr* GDataSetErr = PBErrDomainErr + PBErrDomainGDataSet;
+_Thread_local PBErr* ResPublishErr = 
+  PBErrDomainErr + PBErrDomainResPublish;
+_Thread_local PBErr* TheSquidErr = PBErrDomainErr + PBErrDomainTheSquid;
+_Thread_local PBErr* CBoErr = PBErrDomainErr + PBErrDomainCBo;
+_Thread_local PBErr* CrypticErr = PBErrDomainErr + PBErrDomainCryptic;
+_Thread_local PBErr* GradAutomatonErr = 
+  PBErrDomainErr + PBErrDomainGradAutomaton;
+_Thread_local PBErr* SmallyErr = PBErrDomainErr + PBErrDomainSmally;
+_Thread_local PBErr* BuzzyErr = PBErrDomainErr + PBErrDomainBuzzy;
+_Thread_local PBErr* NeuraMorphErr = 
+  PBErrDomainErr + PBErrDomainNeuraMorph;
+_Thread_local PBErrScope* PBErrScopeTop = NULL;
+_Thread_local PBErrScope* PBErrScopeCaught = NULL;
+_Thread_local PBErrContextStack PBErrContextCur = {._nb = 0};
+
+// Return the default PBErr of the domain 'domain', shared by the 
+// threads and never freed
+static PBErr* PBErrDomainDefault(const PBErrDomain domain) {
+  if ((int)domain <= 0 || domain >= PBErrDomainNb)
+    return &thePBErr;
+  return PBErrDomainErr + domain;
+}
 
 const char* PBErrTypeLbl[PBErrTypeNb] = {
   "unknown",
@@ -55,8 +133,510 @@ const char* PBErrTypeLbl[PBErrTypeNb] = {
   "runtime error"
 };
 
+const char* PBErrDomainLbl[PBErrDomainNb] = {
+  "PBErr",
+  "PBMath",
+  "GSet",
+  "ELORank",
+  "Shapoid",
+  "BCurve",
+  "GenBrush",
+  "FracNoise",
+  "GenAlg",
+  "Grad",
+  "KnapSack",
+  "NeuraNet",
+  "PBPhys",
+  "GenTree",
+  "JSON",
+  "MiniFrame",
+  "PixelToPosEstimator",
+  "PBDataAnalysis",
+  "PBImgAnalysis",
+  "PBFileSys",
+  "SDSIA",
+  "GDataSet",
+  "ResPublish",
+  "TheSquid",
+  "CBo",
+  "Cryptic",
+  "GradAutomaton",
+  "Smally",
+  "Buzzy",
+  "NeuraMorph"
+};
+
+// PBErr of the current thread, one per domain, allocated by
+// PBErrThreadInit and freed when the thread exits
+static _Thread_local PBErr* PBErrThreadCtx = NULL;
+
+// Key for the destructor of the PBErr of each thread
+static pthread_key_t PBErrThreadKey;
+static pthread_once_t PBErrThreadKeyOnce = PTHREAD_ONCE_INIT;
+
+// Fixed size record of a catched error
+typedef struct PBErrRecord {
+  // Copy of the catched error
+  PBErr _err;
+  // Value of errno at the time of the catch
+  int _errno;
+  // Height of the stack
+  int _stackHeight;
+  // Raw return addresses of the stack
+  void* _stack[PBERR_MAXSTACKHEIGHT];
+  // Number of occurences of the error summarized by this record, 0 if
+  // it's a full report
+  unsigned long _nbRepeat;
+  // Monotonic time of the catch, in nanoseconds
+  uint64_t _time;
+  // Identifier of the catching thread
+  unsigned int _thread;
+  // Context stack of the catching thread, one line per frame, 
+  // outermost first
+  char _context[PBERR_CONTEXTLENGTHMAX];
+} PBErrRecord;
+
+// Slot of the ring buffer of the asynchronous sink
+typedef struct PBErrSinkSlot {
+  // Sequence number used to synchronize producers and consumer
+  atomic_size_t _seq;
+  // Record
+  PBErrRecord _rec;
+} PBErrSinkSlot;
+
+// Asynchronous sink: bounded multi-producer ring buffer of records
+// (Vyukov's algorithm) drained by a flusher thread
+typedef struct PBErrSinkState {
+  // Slots of the ring buffer
+  PBErrSinkSlot* _slots;
+  // Number of slots minus one, the number of slots is a power of 2
+  size_t _mask;
+  // Position of the next push, alone on its cache line to avoid
+  // false sharing with the consumer
+  _Alignas(64) atomic_size_t _posPush;
+  // Position of the next pop
+  _Alignas(64) atomic_size_t _posPop;
+  // Number of records pushed, flushed and dropped
+  atomic_ulong _nbPushed;
+  atomic_ulong _nbFlushed;
+  atomic_ulong _nbDropped;
+  // Flag for the sink mode, and flag to request the flusher to stop
+  atomic_bool _active;
+  atomic_bool _stop;
+  // Number of producers currently pushing a record
+  atomic_int _nbPushing;
+  // Semaphore to wake up the flusher
+  sem_t _sem;
+  // Flusher thread
+  pthread_t _flusher;
+} PBErrSinkState;
+
+static PBErrSinkState PBErrSink;
+
+// Current symbolization mode
+static atomic_int PBErrSymbolModeCur = PBErrSymbolModeImmediate;
+
+// Maximum number of modules (executable and shared libraries)
+// memorized for symbolization
+#define PBERR_NBMAXMODULE 64
+
+// Loaded module, as reported by dl_iterate_phdr
+typedef struct PBErrModule {
+  // Load base of the module
+  unsigned long _base;
+  // Range of addresses of the module
+  unsigned long _start;
+  unsigned long _end;
+  // Path of the module
+  char _path[PBERR_MSGLENGTHMAX];
+} PBErrModule;
+
+// Number of entries of the cache of symbols, must be a power of 2
+#define PBERR_NBSYMBOLCACHE 1024
+// Maximum length of a symbol in the cache
+#define PBERR_SYMBOLLENGTHMAX 128
+
+// Entry of the cache of symbols
+typedef struct PBErrSymbol {
+  // Address, null if the entry is empty
+  const void* _addr;
+  // Symbol of the address
+  char _sym[PBERR_SYMBOLLENGTHMAX];
+} PBErrSymbol;
+
+// Symbolization data shared by all the reports
+typedef struct PBErrSymbolizer {
+  // Mutex protecting the data below
+  pthread_mutex_t _mutex;
+  // Loaded modules, refreshed when an address is in none of them
+  PBErrModule _modules[PBERR_NBMAXMODULE];
+  int _nbModule;
+  // Cache of symbols, open addressing with linear probing
+  PBErrSymbol _cache[PBERR_NBSYMBOLCACHE];
+  int _nbSymbol;
+  // Log of raw addresses for offline symbolization, may be null
+  FILE* _addrLog;
+  // Flag to check if the log is opened without locking the mutex
+  atomic_bool _isAddrLog;
+} PBErrSymbolizer;
+
+static PBErrSymbolizer PBErrSym = {._mutex = PTHREAD_MUTEX_INITIALIZER};
+
+// Current backend capturing the stacks
+static atomic_int PBErrUnwinderCur = PBErrUnwinderBacktrace;
+// Height of the stack captured in the reports
+static atomic_int PBErrStackHeightCur = PBERR_STACKHEIGHTDEFAULT;
+// Maximum number of addresses captured at once, skipped ones included
+#define PBERR_UNWINDMAX 64
+// Span above the first frame accepted by the frame pointer walk when
+// the bounds of the stack of the thread are unknown
+#define PBERR_UNWINDSPAN (8ul << 20)
+// Bounds of the stack of the thread for the frame pointer walk, 0 if
+// unknown, and flag raised once they have been looked for
+static _Thread_local uintptr_t PBErrStackLo = 0;
+static _Thread_local uintptr_t PBErrStackHi = 0;
+static _Thread_local bool PBErrStackBoundsDone = false;
+
+// Size in bytes of the alternate stack of the crash handler
+#define PBERR_CRASHSTACKSIZE 65536
+// Number of signals handled by the crash handler
+#define PBERR_NBCRASHSIG 4
+// Size of the buffer of the crash handler's report
+#define PBERR_CRASHBUFSIZE 1024
+
+// Last error catched in a domain, as read by the crash handler
+typedef struct PBErrLastErr {
+  // Sequence number, odd while the entry is written, 0 if there is
+  // no error yet
+  atomic_uint _seq;
+  // Copy of the data of the error
+  PBErrType _type;
+  bool _fatal;
+  unsigned int _thread;
+  const PBErrSite* _site;
+  PBErrArg _args[PBERR_NBMAXARG];
+  int _nbArg;
+  char _msg[PBERR_MSGLENGTHMAX];
+} PBErrLastErr;
+
+// Data of the crash handler, all preallocated
+typedef struct PBErrCrashHandler {
+  // Flag raised while the handler is installed
+  atomic_bool _active;
+  // Flag raised while a report is written
+  atomic_flag _reporting;
+  // File descriptor the report is written to
+  int _fd;
+  // Alternate stack of the handler in the installing thread, and the
+  // alternate stack of that thread before installation
+  _Alignas(16) char _stack[PBERR_CRASHSTACKSIZE];
+  stack_t _prevStack;
+  // Snapshot of the loaded modules taken at installation, to locate
+  // the addresses of the stack without locking
+  PBErrModule _modules[PBERR_NBMAXMODULE];
+  int _nbModule;
+  // Actions of the signals before installation
+  struct sigaction _prevAct[PBERR_NBCRASHSIG];
+  // Last error catched per domain
+  PBErrLastErr _last[PBErrDomainNb];
+} PBErrCrashHandler;
+
+static PBErrCrashHandler PBErrCrash = {._reporting = ATOMIC_FLAG_INIT};
+
+// Signals handled by the crash handler, and their name
+static const int PBErrCrashSig[PBERR_NBCRASHSIG] = {
+  SIGSEGV, SIGBUS, SIGFPE, SIGILL
+};
+static const char* PBErrCrashSigLbl[PBERR_NBCRASHSIG] = {
+  "SIGSEGV", "SIGBUS", "SIGFPE", "SIGILL"
+};
+
+// Number of entries of the table of stacks of the profiler, must be
+// a power of 2
+#define PBERR_PROFNBENTRY 4096
+// Maximum height of the stacks sampled by the profiler
+#define PBERR_PROFSTACKHEIGHT 32
+
+// Entry of the table of stacks of the profiler
+typedef struct PBErrProfEntry {
+  // Hash of the stack, 0 if the entry is empty
+  atomic_ulong _hash;
+  // Number of samples with this stack
+  atomic_ulong _nb;
+  // Height of the stack
+  int _height;
+  // Return addresses, innermost first
+  void* _stack[PBERR_PROFSTACKHEIGHT];
+} PBErrProfEntry;
+
+// Data of the sampling profiler
+typedef struct PBErrProfiler {
+  // Flag raised while the profiler is sampling
+  atomic_bool _active;
+  // Table of stacks, open addressing with linear probing, allocated
+  // at the first start
+  PBErrProfEntry* _entries;
+  // Number of samples, and samples dropped because the table is full
+  atomic_ulong _nbSample;
+  atomic_ulong _nbDropped;
+  // Action of SIGPROF before the start
+  struct sigaction _prevAct;
+} PBErrProfiler;
+
+static PBErrProfiler PBErrProf;
+
+// Number of entries of the table of live samples of the heap 
+// profiler, must be a power of 2
+#define PBERR_HEAPNBSAMPLE 65536
+// Number of entries of the table of stacks of the heap profiler, must
+// be a power of 2
+#define PBERR_HEAPNBSTACK 4096
+// Maximum distance of a live sample from its home entry in the table,
+// bounds the cost of the lookup at each free
+#define PBERR_HEAPNBPROBE 16
+// Bytes allocated by a thread between two checks of the start of the
+// heap profiler while it's stopped
+#define PBERR_HEAPIDLE 65536
+// Number of frames of the heap profiler at the top of the sampled 
+// stacks, below the sampling function itself
+#define PBERR_HEAPNBSKIP 1
+// Marker of the entries of freed samples
+#define PBERR_HEAPFREED ((uintptr_t)1)
+
+// Live sample of the heap profiler
+typedef struct PBErrHeapSample {
+  // Address of the sampled memory, 0 if the entry is empty, 
+  // PBERR_HEAPFREED if the memory has been freed
+  atomic_uintptr_t _ptr;
+  // Estimated number of bytes represented by the sample
+  unsigned long _weight;
+  // Index of the stack of the sample
+  int _iStack;
+} PBErrHeapSample;
+
+// Stack of the heap profiler
+typedef struct PBErrHeapStack {
+  // Hash of the stack, 0 if the entry is empty
+  unsigned long _hash;
+  // Height of the stack
+  int _height;
+  // Return addresses, innermost first
+  void* _stack[PBERR_PROFSTACKHEIGHT];
+} PBErrHeapStack;
+
+// Data of the heap profiler
+typedef struct PBErrHeapProfiler {
+  // Flag raised while the heap profiler is sampling
+  atomic_bool _active;
+  // Number of starts of the heap profiler
+  atomic_ulong _epoch;
+  // Mean number of bytes between two samples
+  atomic_ulong _rate;
+  // Number of live samples, the lookup at each free is skipped if 
+  // there is none
+  atomic_ulong _nbLive;
+  // Flag raised by the signal handler to request a dump
+  atomic_bool _dumpRequested;
+  // Path of the dump requested by signal
+  char _dumpPath[PATH_MAX];
+  // Protects the insertion of samples, the stacks and the dumps. The
+  // samples are removed without lock
+  pthread_mutex_t _mutex;
+  // Tables of live samples (open addressing with bounded linear 
+  // probing) and of stacks, allocated at the first start
+  PBErrHeapSample* _samples;
+  PBErrHeapStack* _stacks;
+} PBErrHeapProfiler;
+
+static PBErrHeapProfiler PBErrHeap = 
+  {._mutex = PTHREAD_MUTEX_INITIALIZER};
+
+#if defined(PBERR_ALLOCSTAT)
+// Number of bytes the calling thread allocates before its next sample
+static _Thread_local long PBErrHeapCountdown = 0;
+// Start of the heap profiler last noticed by the calling thread
+static _Thread_local unsigned long PBErrHeapEpochCur = 0;
+// State of the random generator of the calling thread for the heap
+// profiler, 0 until its first sample
+static _Thread_local uint64_t PBErrHeapRand = 0;
+#endif
+
+// Trace event
+typedef struct PBErrTraceEvent {
+  // Monotonic time in nanoseconds
+  uint64_t _time;
+  // Name of the event
+  const char* _name;
+  // Value of a counter, or type of an error
+  long _value;
+  // Domain of the event
+  PBErrDomain _domain;
+  // Phase of the event ('B', 'E', 'C' or 'i')
+  char _phase;
+} PBErrTraceEvent;
+
+// Ring buffer of the trace events of a thread
+typedef struct PBErrTraceRing {
+  // Next ring in the list of all the rings
+  struct PBErrTraceRing* _next;
+  // Identifier of the thread
+  unsigned int _thread;
+  // Flag raised once the thread has exited, the ring can then be 
+  // reused by a new thread
+  atomic_bool _isFree;
+  // Number of events recorded since the creation or reset, written
+  // only by the owning thread
+  atomic_ulong _nb;
+  // Events
+  PBErrTraceEvent _events[PBERR_TRACENBEVENT];
+} PBErrTraceRing;
+
+// Data of the trace
+typedef struct PBErrTracer {
+  // Flag raised while the events are recorded
+  atomic_bool _active;
+  // List of the rings of all the threads which have recorded events.
+  // The rings outlive their thread to be exported after the join, 
+  // until a new thread reuses them
+  _Atomic(PBErrTraceRing*) _rings;
+  // Number of events of exited threads discarded by the reuse of 
+  // their ring
+  atomic_ulong _nbDropped;
+} PBErrTracer;
+
+static PBErrTracer PBErrTrace;
+
+// Ring of the calling thread, null until it records its first event
+static _Thread_local PBErrTraceRing* PBErrTraceRingCur = NULL;
+
+// Key for the destructor of the ring of each thread
+static pthread_key_t PBErrTraceKey;
+static pthread_once_t PBErrTraceKeyOnce = PTHREAD_ONCE_INIT;
+
+// Reclaim callback
+typedef struct PBErrReclaimEntry {
+  PBErrDomain _domain;
+  int _priority;
+  PBErrReclaimFun _fun;
+  void* _data;
+} PBErrReclaimEntry;
+
+// Registry of the reclaim callbacks
+typedef struct PBErrReclaimer {
+  pthread_mutex_t _mutex;
+  // Callbacks in decreasing order of priority, then of registration
+  PBErrReclaimEntry _entries[PBERR_NBMAXRECLAIM];
+  int _nb;
+  // Soft budget of live bytes, 0 if disabled
+  atomic_ulong _budget;
+  // Flag raised while a thread calls the callbacks for the budget
+  atomic_flag _busy;
+} PBErrReclaimer;
+
+static PBErrReclaimer PBErrReclaimReg = 
+  {._mutex = PTHREAD_MUTEX_INITIALIZER, ._busy = ATOMIC_FLAG_INIT};
+
+// Flag raised while the calling thread calls the reclaim callbacks
+static _Thread_local bool PBErrReclaiming = false;
+
+#if defined(PBERR_ALLOCSTAT)
+// Bytes allocated or freed by a thread between two folds of its
+// allocation statistics into the ones of the domains, and checks of
+// the budget
+#define PBERR_ALLOCFOLD 65536
+// Bytes counted per allocation or free in addition to its size, so
+// that small allocations are folded too
+#define PBERR_ALLOCOPCOST 64
+// Number of bytes the calling thread allocates or frees before its
+// next fold
+static _Thread_local long PBErrAllocCountdown = PBERR_ALLOCFOLD;
+#endif
+
+// Buffer of the report of the crash handler, flushed with write()
+typedef struct PBErrCrashBuf {
+  int _fd;
+  size_t _len;
+  char _buf[PBERR_CRASHBUFSIZE];
+} PBErrCrashBuf;
+
+// Allocation statistics of a domain, aligned on cache lines to avoid
+// false sharing between domains
+typedef struct PBErrAllocCounter {
+  _Alignas(64) atomic_ulong _live;
+  atomic_ulong _peak;
+  atomic_ulong _nbAlloc;
+  atomic_ulong _nbFree;
+  atomic_ulong _hist[PBERR_NBSIZECLASS];
+} PBErrAllocCounter;
+
+static PBErrAllocCounter PBErrAllocCounters[PBErrDomainNb];
+
+#if defined(PBERR_ALLOCSTAT)
+// Allocation statistics of a thread not yet folded into the ones of 
+// the domains. Only the owner thread accesses them, so the accounting
+// needs no atomic operation
+typedef struct PBErrAllocLocal {
+  // Variation of the live bytes per domain
+  long _live[PBErrDomainNb];
+  unsigned long _nbAlloc[PBErrDomainNb];
+  unsigned long _nbFree[PBErrDomainNb];
+  unsigned long _hist[PBErrDomainNb][PBERR_NBSIZECLASS];
+  // Mask of the domains having variations
+  uint64_t _dirty;
+} PBErrAllocLocal;
+
+_Static_assert(PBErrDomainNb <= 64, "PBErrAllocLocal._dirty too small");
+
+// Allocation statistics of the calling thread, allocated at its first
+// accounting and released at its exit
+static _Thread_local PBErrAllocLocal* PBErrAllocLocalCur = NULL;
+static pthread_key_t PBErrAllocKey;
+static pthread_once_t PBErrAllocKeyOnce = PTHREAD_ONCE_INIT;
+static void PBErrAllocFoldLocal(PBErrAllocLocal* const local);
+#endif
+
+// Counters of catched errors of a domain, aligned on cache lines to
+// avoid false sharing between domains
+typedef struct PBErrCatchCounter {
+  _Alignas(64) atomic_ulong _nb[PBErrTypeNb];
+  atomic_ulong _nbFatal;
+} PBErrCatchCounter;
+
+static PBErrCatchCounter PBErrCatchCounters[PBErrDomainNb];
+
+// Number of entries of the table of deduplication, must be a power 
+// of 2
+#define PBERR_NBDEDUP 256
+
+// Entry of the table of deduplication
+typedef struct PBErrDedupEntry {
+  // Hash of the stack and type of the error, 0 if the entry is empty
+  atomic_ulong _key;
+  // Number of occurences of the error
+  atomic_ulong _nb;
+} PBErrDedupEntry;
+
+// Deduplication of the non fatal errors
+typedef struct PBErrDedupState {
+  // Number of occurences printed in full, 0 if the deduplication is
+  // disabled
+  atomic_ulong _nbFull;
+  // Period of the summaries after the occurences printed in full
+  atomic_ulong _period;
+  // Number of occurences neither printed nor summarized
+  atomic_ulong _nbSuppressed;
+  // Table of deduplication, open addressing with linear probing
+  PBErrDedupEntry _entries[PBERR_NBDEDUP];
+} PBErrDedupState;
+
+static PBErrDedupState PBErrDedup;
+
 // ================ Functions implementation ====================
 
+#if BUILDMODE == 0
+#include "pberr-inline.c"
+#endif
+
 // Static constructor
 PBErr PBErrCreateStatic(void) {
   PBErr that = {._msg[0] = '\0', ._type = PBErrTypeUnknown, 
@@ -71,460 +651,4646 @@ void PBErrReset(PBErr* const that) {
   that->_msg[0] = '\0';
   that->_type = PBErrTypeUnknown;
   that->_fatal = true;
+  that->_site = NULL;
+  that->_nbArg = 0;
 }
 
-// Hook for error handling
-// Print the error type, the error message, the stack
-// Exit if _fatal == true
-// Reset the PBErr
-void PBErrCatch(PBErr* const that) {
-  if (that == NULL)
-    return;
-  FILE* stream = (that->_stream ? that->_stream : stderr);
-  fprintf(stream, "---- PBErrCatch ----\n");
-  PBErrPrintln(that, stream);
-  fprintf(stream, "Stack:\n");
-  void* stack[PBERR_MAXSTACKHEIGHT] = {NULL};
-  int stackHeight = backtrace(stack, PBERR_MAXSTACKHEIGHT);
-  backtrace_symbols_fd(stack, stackHeight, fileno(stream));
-  if (errno != 0) {
-    fprintf(stream, "errno: %s\n", strerror(errno));
-    errno = 0;
-  }
-  if (that->_fatal) {
-    fprintf(stream, "Exiting\n");
-    fprintf(stream, "--------------------\n");
-    exit(that->_type);
+// Format into 'buf' of size 'size' the format of the call site 'site'
+// with the 'nbArg' raw arguments 'args' and return 'buf'
+static const char* PBErrFormatSite(const PBErrSite* const site,
+  const PBErrArg* const args, const int nbArg, char* const buf, 
+  const size_t size) {
+  const char* fmt = site->_format;
+  size_t len = 0;
+  int iArg = 0;
+  while (*fmt != '\0' && len < size - 1) {
+    if (*fmt != '%') {
+      buf[len++] = *(fmt++);
+      continue;
+    }
+    if (fmt[1] == '%') {
+      buf[len++] = '%';
+      fmt += 2;
+      continue;
+    }
+    // Extract the conversion
+    size_t lenSpec = 1;
+    while (fmt[lenSpec] != '\0' && 
+      strchr("diouxXeEfFgGaAcspn", fmt[lenSpec]) == NULL)
+      ++lenSpec;
+    if (fmt[lenSpec] == '\0') {
+      len += (size_t)snprintf(buf + len, size - len, "%s", fmt);
+      break;
+    }
+    ++lenSpec;
+    char spec[32];
+    bool isValid = (lenSpec < sizeof(spec) && iArg < nbArg);
+    if (isValid) {
+      memcpy(spec, fmt, lenSpec);
+      spec[lenSpec] = '\0';
+      isValid = (strchr(spec, '*') == NULL);
+    }
+    char conv = fmt[lenSpec - 1];
+    int nb = 0;
+    if (!isValid || conv == 'n') {
+      nb = snprintf(buf + len, size - len, "%.*s", (int)lenSpec, fmt);
+    } else {
+      PBErrArg arg = args[iArg++];
+      bool isLong = (strchr(spec, 'l') != NULL || 
+        strchr(spec, 'z') != NULL || strchr(spec, 'j') != NULL ||
+        strchr(spec, 't') != NULL);
+      if (strchr("di", conv) != NULL)
+        nb = (isLong ? snprintf(buf + len, size - len, spec, arg._i) :
+          snprintf(buf + len, size - len, spec, (int)(arg._i)));
+      else if (strchr("ouxXc", conv) != NULL)
+        nb = (isLong ? snprintf(buf + len, size - len, spec, arg._u) :
+          snprintf(buf + len, size - len, spec, 
+          (unsigned int)(arg._u)));
+      else if (strchr("eEfFgGaA", conv) != NULL)
+        nb = (strchr(spec, 'L') != NULL ? 
+          snprintf(buf + len, size - len, spec, (long double)(arg._f)) :
+          snprintf(buf + len, size - len, spec, arg._f));
+      else
+        nb = snprintf(buf + len, size - len, spec, arg._p);
+    }
+    if (nb < 0)
+      break;
+    len += (size_t)nb;
+    fmt += lenSpec;
   }
-  fprintf(stream, "--------------------\n");
-  PBErrReset(that);
+  if (len > size - 1)
+    len = size - 1;
+  buf[len] = '\0';
+  return buf;
 }
 
-// Print the PBErr 'that' on 'stream'
-void PBErrPrintln(const PBErr* const that, FILE* const stream) {
-  // If the PBErr or stream is null
-  if (that == NULL || stream == NULL)
-    // Nothing to do
-    return;
-  if (that->_type > 0 && that->_type < PBErrTypeNb)
-    fprintf(stream, "PBErrType: %s\n", PBErrTypeLbl[that->_type]);
-  if (that->_msg[0] != '\0')
-    fprintf(stream, "PBErrMsg: %s\n", that->_msg);
-  if (that->_fatal)
-    fprintf(stream, "PBErrFatal: true\n");
-  else
-    fprintf(stream, "PBErrFatal: false\n");
+// Format the message of the PBErr 'that' into 'buf' of size 'size'
+// and return 'buf'. The message is _msg if it's not empty, else it's
+// formatted from the format of the call site and the raw arguments
+// Each conversion of the format is formatted with snprintf and its
+// argument converted back to the type expected by the conversion.
+// Conversions without argument, '*' widths and %n are printed as is
+const char* PBErrFormatMsg(const PBErr* const that, char* const buf,
+  const size_t size) {
+  if (buf == NULL || size == 0)
+    return buf;
+  buf[0] = '\0';
+  if (that == NULL)
+    return buf;
+  if (that->_msg[0] != '\0' || that->_site == NULL ||
+    that->_site->_format == NULL) {
+    snprintf(buf, size, "%s", that->_msg);
+    return buf;
+  }
+  return PBErrFormatSite(that->_site, that->_args, that->_nbArg, buf,
+    size);
 }
 
-// Secured malloc
-#if defined(PBERRALL) || defined(PBERRSAFEMALLOC)
-void* PBErrMalloc(PBErr* const that, const size_t size) {
-  void* ret = malloc(size);
-  if (ret == NULL) {
-    that->_type = PBErrTypeMallocFailed;
-    sprintf(that->_msg, "malloc of %ld bytes failed\n", 
-      (unsigned long int)size);
-    that->_fatal = true;
-    PBErrCatch(that);
+// Return true if the format of the call site of the PBErr 'that' 
+// contains a string conversion
+static bool PBErrSiteHasStr(const PBErr* const that) {
+  if (that->_site == NULL || that->_site->_format == NULL)
+    return false;
+  const char* fmt = that->_site->_format;
+  while ((fmt = strchr(fmt, '%')) != NULL) {
+    ++fmt;
+    if (*fmt == '%') {
+      ++fmt;
+      continue;
+    }
+    while (*fmt != '\0' && strchr("diouxXeEfFgGaAcspn", *fmt) == NULL)
+      ++fmt;
+    if (*fmt == 's')
+      return true;
   }
-  return ret;
+  return false;
 }
-#endif
-
-// Secured I/O
-#if defined(PBERRALL) || defined(PBERRSAFEIO)
 
-FILE* PBErrOpenStreamIn(PBErr* const that, const char* const path) {
-#if BUILDMODE == 0
-  if (that == NULL) {
-    that->_type = PBErrTypeNullPointer;
-    sprintf(that->_msg, "'that' is null");
-    that->_fatal = true;
-    PBErrCatch(that);
-  }
-  if (path == NULL) {
-    that->_type = PBErrTypeNullPointer;
-    sprintf(that->_msg, "'path' is null");
-    that->_fatal = true;
-    PBErrCatch(that);
+// Callback for dl_iterate_phdr, memorize the module 'info'
+static int PBErrModuleAdd(struct dl_phdr_info* info, size_t size, 
+  void* data) {
+  (void)size;
+  (void)data;
+  if (PBErrSym._nbModule >= PBERR_NBMAXMODULE)
+    return 1;
+  PBErrModule* mod = PBErrSym._modules + PBErrSym._nbModule;
+  mod->_base = info->dlpi_addr;
+  mod->_start = ~0UL;
+  mod->_end = 0;
+  for (int iHdr = 0; iHdr < info->dlpi_phnum; ++iHdr) {
+    const ElfW(Phdr)* hdr = info->dlpi_phdr + iHdr;
+    if (hdr->p_type != PT_LOAD)
+      continue;
+    unsigned long start = info->dlpi_addr + hdr->p_vaddr;
+    if (start < mod->_start)
+      mod->_start = start;
+    if (start + hdr->p_memsz > mod->_end)
+      mod->_end = start + hdr->p_memsz;
   }
-#endif
-  FILE* fd = fopen(path, "r");
-  if (fd == NULL) {
-    that->_type = PBErrTypeIOError;
-    sprintf(that->_msg, "fopen failed for %s", path);
-    that->_fatal = false;
-    PBErrCatch(that);
+  if (mod->_start >= mod->_end)
+    return 0;
+  // The main executable has an empty name
+  const char* path = info->dlpi_name;
+  if (path == NULL || path[0] == '\0') {
+    ssize_t len = readlink("/proc/self/exe", mod->_path, 
+      PBERR_MSGLENGTHMAX - 1);
+    mod->_path[(len > 0 ? len : 0)] = '\0';
+  } else {
+    snprintf(mod->_path, PBERR_MSGLENGTHMAX, "%s", path);
   }
-  return fd;
+  ++(PBErrSym._nbModule);
+  return 0;
 }
 
-FILE* PBErrOpenStreamOut(PBErr* const that, const char* const path) {
-#if BUILDMODE == 0
-  if (that == NULL) {
-    that->_type = PBErrTypeNullPointer;
-    sprintf(that->_msg, "'that' is null");
-    that->_fatal = true;
-    PBErrCatch(that);
-  }
-  if (path == NULL) {
-    that->_type = PBErrTypeNullPointer;
-    sprintf(that->_msg, "'path' is null");
-    that->_fatal = true;
-    PBErrCatch(that);
-  }
-#endif
-  FILE* fd = fopen(path, "w");
-  if (fd == NULL) {
-    that->_type = PBErrTypeIOError;
-    sprintf(that->_msg, "fopen failed for %s", path);
-    that->_fatal = false;
-    PBErrCatch(that);
+// Find the module containing 'addr' and copy it into 'mod'
+// Must be called with PBErrSym._mutex locked
+// Return false if there is no such module
+static bool PBErrModuleFind(const void* const addr, 
+  PBErrModule* const mod) {
+  unsigned long a = (unsigned long)addr;
+  for (int retry = 0; retry < 2; ++retry) {
+    for (int iMod = 0; iMod < PBErrSym._nbModule; ++iMod) {
+      const PBErrModule* m = PBErrSym._modules + iMod;
+      if (a >= m->_start && a < m->_end) {
+        *mod = *m;
+        return true;
+      }
+    }
+    // The address may belong to a module loaded since the last
+    // snapshot
+    PBErrSym._nbModule = 0;
+    dl_iterate_phdr(PBErrModuleAdd, NULL);
   }
-  return fd;
+  return false;
 }
 
-void PBErrCloseStream(PBErr* const that, FILE* const fd) {
-#if BUILDMODE == 0
-  if (that == NULL) {
-    that->_type = PBErrTypeNullPointer;
-    sprintf(that->_msg, "'that' is null");
-    that->_fatal = true;
-    PBErrCatch(that);
+// Set the symbolization mode of the stack in the reports
+void PBErrSetSymbolMode(const PBErrSymbolMode mode) {
+  if ((int)mode < 0 || mode >= PBErrSymbolModeNb)
+    return;
+  atomic_store(&PBErrSymbolModeCur, mode);
+}
+
+// Symbolize the address 'addr' into 'buf' of size 'size', using the 
+// cache of symbols shared by all the reports
+// Return 'buf'
+const char* PBErrSymbolize(const void* const addr, char* const buf,
+  const size_t size) {
+  if (buf == NULL || size == 0)
+    return buf;
+  pthread_mutex_lock(&(PBErrSym._mutex));
+  size_t iEntry = ((unsigned long)addr >> 2) * 2654435761UL;
+  PBErrSymbol* entry = NULL;
+  for (int iProbe = 0; iProbe < PBERR_NBSYMBOLCACHE; ++iProbe) {
+    entry = PBErrSym._cache + 
+      ((iEntry + (size_t)iProbe) & (PBERR_NBSYMBOLCACHE - 1));
+    if (entry->_addr == addr || entry->_addr == NULL)
+      break;
   }
-  if (fd == NULL) {
-    that->_type = PBErrTypeNullPointer;
-    sprintf(that->_msg, "'fd' is null");
-    that->_fatal = true;
-    PBErrCatch(that);
+  if (entry->_addr != addr) {
+    char sym[PBERR_SYMBOLLENGTHMAX];
+    Dl_info info;
+    if (dladdr(addr, &info) != 0 && info.dli_fname != NULL) {
+      if (info.dli_sname != NULL)
+        snprintf(sym, PBERR_SYMBOLLENGTHMAX, "%s(%s+0x%lx)", 
+          info.dli_fname, info.dli_sname,
+          (unsigned long)addr - (unsigned long)info.dli_saddr);
+      else
+        snprintf(sym, PBERR_SYMBOLLENGTHMAX, "%s(+0x%lx)", 
+          info.dli_fname,
+          (unsigned long)addr - (unsigned long)info.dli_fbase);
+    } else {
+      snprintf(sym, PBERR_SYMBOLLENGTHMAX, "??");
+    }
+    // If the cache is almost full, flush it
+    if (PBErrSym._nbSymbol >= PBERR_NBSYMBOLCACHE * 3 / 4) {
+      memset(PBErrSym._cache, 0, sizeof(PBErrSym._cache));
+      PBErrSym._nbSymbol = 0;
+      entry = PBErrSym._cache + (iEntry & (PBERR_NBSYMBOLCACHE - 1));
+    }
+    entry->_addr = addr;
+    memcpy(entry->_sym, sym, PBERR_SYMBOLLENGTHMAX);
+    ++(PBErrSym._nbSymbol);
   }
-#endif
-  (void)that;
-  fclose(fd);
+  snprintf(buf, size, "%s", entry->_sym);
+  pthread_mutex_unlock(&(PBErrSym._mutex));
+  return buf;
 }
 
+// Open the log of raw addresses at 'path'. The stack of each report
+// is appended to it as lines '<module path> <offset in module>',
+// and an empty line after each report, for offline symbolization
+// (cf pberrsym.sh)
+// Return false if the log couldn't be opened
+bool PBErrAddrLogOpen(const char* const path) {
+  if (path == NULL)
+    return false;
+  FILE* fd = fopen(path, "a");
+  if (fd == NULL)
+    return false;
+  pthread_mutex_lock(&(PBErrSym._mutex));
+  if (PBErrSym._addrLog != NULL)
+    fclose(PBErrSym._addrLog);
+  PBErrSym._addrLog = fd;
+  atomic_store(&(PBErrSym._isAddrLog), true);
+  pthread_mutex_unlock(&(PBErrSym._mutex));
+  return true;
+}
 
-bool _PBErrScanfShort(PBErr* const that, 
-  FILE* const stream, const char* const format, short* const data) {
-#if BUILDMODE == 0
-  if (that == NULL) {
-    that->_type = PBErrTypeNullPointer;
-    sprintf(that->_msg, "'that' is null\n");
-    that->_fatal = true;
-    PBErrCatch(that);
-  }
-  if (stream == NULL) {
-    that->_type = PBErrTypeNullPointer;
-    sprintf(that->_msg, "'stream' is null\n");
-    that->_fatal = true;
-    PBErrCatch(that);
+// Close the log of raw addresses
+void PBErrAddrLogClose(void) {
+  pthread_mutex_lock(&(PBErrSym._mutex));
+  if (PBErrSym._addrLog != NULL)
+    fclose(PBErrSym._addrLog);
+  PBErrSym._addrLog = NULL;
+  atomic_store(&(PBErrSym._isAddrLog), false);
+  pthread_mutex_unlock(&(PBErrSym._mutex));
+}
+
+// Memorize the bounds of the stack of the calling thread for the 
+// frame pointer walk
+// Not async-signal-safe, pthread_getattr_np reads /proc/self/maps
+// for the main thread
+static void PBErrStackBoundsInit(void) {
+  if (PBErrStackBoundsDone)
+    return;
+  PBErrStackBoundsDone = true;
+  pthread_attr_t attr;
+  if (pthread_getattr_np(pthread_self(), &attr) != 0)
+    return;
+  void* addr = NULL;
+  size_t size = 0;
+  if (pthread_attr_getstack(&attr, &addr, &size) == 0) {
+    PBErrStackLo = (uintptr_t)addr;
+    PBErrStackHi = (uintptr_t)addr + size;
   }
-  if (format == NULL) {
-    that->_type = PBErrTypeNullPointer;
-    sprintf(that->_msg, "'format' is null\n");
-    that->_fatal = true;
-    PBErrCatch(that);
+  pthread_attr_destroy(&attr);
+}
+
+// Walk the chain of frame pointers from the frame 'fp' into 'stack' 
+// of size 'height', ignoring the 'skip' innermost return addresses
+// Each frame must be aligned, above the previous one and inside the 
+// stack of the thread or its alternate stack, so a broken chain ends
+// the walk instead of faulting. If the bounds of the stack are 
+// unknown, only a frame of the walker itself ('isOwn' true) is 
+// trusted, with a span of PBERR_UNWINDSPAN above it: the frame 
+// pointer of an interrupted code built without frame pointers may be
+// any value. Async-signal-safe
+// Return the number of captured addresses
+static int PBErrUnwindFp(uintptr_t fp, int skip, void** const stack,
+  const int height, const bool isOwn) {
+#if defined(__x86_64__) || defined(__aarch64__)
+  // On both architectures a frame starts with the frame pointer of 
+  // the caller followed by the return address
+  uintptr_t lo = PBErrStackLo;
+  uintptr_t hi = PBErrStackHi;
+  if (fp < lo || fp >= hi) {
+    stack_t alt;
+    if (sigaltstack(NULL, &alt) == 0 && 
+      (alt.ss_flags & SS_DISABLE) == 0 && 
+      fp >= (uintptr_t)(alt.ss_sp) && 
+      fp < (uintptr_t)(alt.ss_sp) + alt.ss_size) {
+      lo = (uintptr_t)(alt.ss_sp);
+      hi = lo + alt.ss_size;
+    } else if (hi == 0 && isOwn) {
+      lo = fp;
+      hi = fp + PBERR_UNWINDSPAN;
+    } else {
+      return 0;
+    }
   }
-  if (data == NULL) {
-    that->_type = PBErrTypeNullPointer;
-    sprintf(that->_msg, "'data' is null\n");
-    that->_fatal = true;
-    PBErrCatch(that);
+  int nb = 0;
+  while (nb < height && fp >= lo && fp + 2 * sizeof(uintptr_t) <= hi &&
+    (fp & (sizeof(uintptr_t) - 1)) == 0) {
+    const uintptr_t* frame = (const uintptr_t*)fp;
+    if (frame[1] == 0)
+      break;
+    if (skip > 0)
+      --skip;
+    else
+      stack[nb++] = (void*)(frame[1]);
+    if (frame[0] <= fp)
+      break;
+    fp = frame[0];
   }
+  return nb;
+#else
+  (void)fp;
+  (void)skip;
+  (void)stack;
+  (void)height;
+  (void)isOwn;
+  return 0;
 #endif
-  // Read from the stream
-  if (fscanf(stream, format, data) == EOF) {
-    that->_type = PBErrTypeIOError;
-    sprintf(that->_msg, "fscanf failed\n");
-    that->_fatal = false;
-    PBErrCatch(that);
-    return false;
-  }
-  return true;
 }
 
-bool _PBErrScanfInt(PBErr* const that, 
-  FILE* const stream, const char* const format, int* const data) {
-#if BUILDMODE == 0
-  if (that == NULL) {
-    that->_type = PBErrTypeNullPointer;
-    sprintf(that->_msg, "'that' is null\n");
-    that->_fatal = true;
-    PBErrCatch(that);
-  }
-  if (stream == NULL) {
-    that->_type = PBErrTypeNullPointer;
-    sprintf(that->_msg, "'stream' is null\n");
-    that->_fatal = true;
-    PBErrCatch(that);
-  }
-  if (format == NULL) {
-    that->_type = PBErrTypeNullPointer;
-    sprintf(that->_msg, "'format' is null\n");
-    that->_fatal = true;
-    PBErrCatch(that);
+// Capture with the current backend at most 'height' return addresses
+// of the stack of the calling function into 'stack', innermost first,
+// ignoring the 'skip' innermost ones. If 'ctx' is not null it's the
+// context of a signal handler and the stack of the interrupted code 
+// is captured instead, starting with the interrupted instruction
+// Inlined so that the frame of the calling function is the frame 
+// where the walk starts. Async-signal-safe once the backend has been
+// pre-warmed
+// Return the number of captured addresses
+static inline __attribute__((always_inline)) int PBErrUnwind(
+  void** const stack, const int height, const int skip, 
+  const ucontext_t* const ctx) {
+  if (height <= 0)
+    return 0;
+  if (atomic_load_explicit(&PBErrUnwinderCur, memory_order_relaxed) ==
+    PBErrUnwinderFramePointer) {
+    if (ctx == NULL)
+      return PBErrUnwindFp((uintptr_t)__builtin_frame_address(0), 
+        skip, stack, height, true);
+#if defined(__x86_64__)
+    stack[0] = (void*)(ctx->uc_mcontext.gregs[REG_RIP]);
+    return 1 + PBErrUnwindFp(
+      (uintptr_t)(ctx->uc_mcontext.gregs[REG_RBP]), 0, stack + 1, 
+      height - 1, false);
+#elif defined(__aarch64__)
+    stack[0] = (void*)(ctx->uc_mcontext.pc);
+    return 1 + PBErrUnwindFp((uintptr_t)(ctx->uc_mcontext.regs[29]),
+      0, stack + 1, height - 1, false);
+#endif
   }
-  if (data == NULL) {
-    that->_type = PBErrTypeNullPointer;
-    sprintf(that->_msg, "'data' is null\n");
-    that->_fatal = true;
-    PBErrCatch(that);
+  // backtrace() starts with the calling function itself, and in a 
+  // signal handler continues with the signal trampoline
+  int nbSkip = skip + 1 + (ctx != NULL ? 1 : 0);
+  void* buf[PBERR_UNWINDMAX];
+  int nb = backtrace(buf, 
+    (height + nbSkip < PBERR_UNWINDMAX ? height + nbSkip : 
+    PBERR_UNWINDMAX)) - nbSkip;
+  if (nb <= 0)
+    return 0;
+  memcpy(stack, buf + nbSkip, sizeof(void*) * (size_t)nb);
+  return nb;
+}
+
+// Pre-warm the current backend capturing the stacks in the calling
+// thread
+static void PBErrUnwindWarm(void) {
+  if (atomic_load(&PBErrUnwinderCur) == PBErrUnwinderFramePointer) {
+    PBErrStackBoundsInit();
+  } else {
+    // The first call of backtrace() loads libgcc, which is not 
+    // async-signal-safe
+    void* stack[1];
+    backtrace(stack, 1);
   }
-#endif
-  // Read from the stream
-  if (fscanf(stream, format, data) == EOF) {
-    that->_type = PBErrTypeIOError;
-    sprintf(that->_msg, "fscanf failed\n");
-    that->_fatal = false;
-    PBErrCatch(that);
+}
+
+// Select the backend 'unwinder' capturing the stacks and pre-warm it
+// in the calling thread
+// Return false if the backend is not available on this architecture
+bool PBErrUnwindInit(const PBErrUnwinder unwinder) {
+  if ((int)unwinder < 0 || unwinder >= PBErrUnwinderNb)
     return false;
-  }
+#if !defined(__x86_64__) && !defined(__aarch64__)
+  if (unwinder == PBErrUnwinderFramePointer)
+    return false;
+#endif
+  atomic_store(&PBErrUnwinderCur, unwinder);
+  PBErrUnwindWarm();
   return true;
 }
 
-bool _PBErrScanfFloat(PBErr* const that, 
-  FILE* const stream, const char* const format, float* const data) {
-#if BUILDMODE == 0
-  if (that == NULL) {
-    that->_type = PBErrTypeNullPointer;
-    sprintf(that->_msg, "'that' is null\n");
-    that->_fatal = true;
-    PBErrCatch(that);
+// Return the current backend capturing the stacks
+PBErrUnwinder PBErrGetUnwinder(void) {
+  return (PBErrUnwinder)atomic_load(&PBErrUnwinderCur);
+}
+
+// Capture with the current backend at most 'height' return addresses
+// of the stack of the calling function into 'stack', innermost first
+// Return the number of captured addresses
+int PBErrStackCapture(void** const stack, const int height) {
+  if (stack == NULL)
+    return 0;
+  if (atomic_load_explicit(&PBErrUnwinderCur, memory_order_relaxed) ==
+    PBErrUnwinderFramePointer)
+    PBErrStackBoundsInit();
+  return PBErrUnwind(stack, height, 0, NULL);
+}
+
+// Set the height of the stack captured in the reports and by the 
+// crash handler, clipped to [0, PBERR_MAXSTACKHEIGHT]
+void PBErrSetStackHeight(const int height) {
+  atomic_store(&PBErrStackHeightCur, 
+    (height < 0 ? 0 : 
+    (height > PBERR_MAXSTACKHEIGHT ? PBERR_MAXSTACKHEIGHT : height)));
+}
+
+// Return the height of the stack captured in the reports
+int PBErrGetStackHeight(void) {
+  return atomic_load(&PBErrStackHeightCur);
+}
+
+// Write the content of the buffer 'buf' of the crash handler
+static void PBErrCrashFlush(PBErrCrashBuf* const buf) {
+  const char* ptr = buf->_buf;
+  while (buf->_len > 0) {
+    ssize_t ret = write(buf->_fd, ptr, buf->_len);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret <= 0)
+      break;
+    ptr += ret;
+    buf->_len -= (size_t)ret;
   }
-  if (stream == NULL) {
-    that->_type = PBErrTypeNullPointer;
-    sprintf(that->_msg, "'stream' is null\n");
-    that->_fatal = true;
-    PBErrCatch(that);
+  buf->_len = 0;
+}
+
+// Append the string 'str' to the buffer 'buf' of the crash handler
+static void PBErrCrashStr(PBErrCrashBuf* const buf, 
+  const char* const str) {
+  if (str == NULL)
+    return;
+  for (const char* c = str; *c != '\0'; ++c) {
+    if (buf->_len == PBERR_CRASHBUFSIZE)
+      PBErrCrashFlush(buf);
+    buf->_buf[(buf->_len)++] = *c;
   }
-  if (format == NULL) {
-    that->_type = PBErrTypeNullPointer;
-    sprintf(that->_msg, "'format' is null\n");
-    that->_fatal = true;
-    PBErrCatch(that);
+}
+
+// Append 'val' in hexadecimal to the buffer 'buf' of the crash 
+// handler
+static void PBErrCrashHex(PBErrCrashBuf* const buf, 
+  const unsigned long val) {
+  char str[2 + 2 * sizeof(unsigned long) + 1];
+  str[0] = '0';
+  str[1] = 'x';
+  int nbDigit = 2 * (int)sizeof(unsigned long);
+  for (int iDigit = 0; iDigit < nbDigit; ++iDigit)
+    str[2 + iDigit] = "0123456789abcdef"[
+      (val >> (4 * (nbDigit - 1 - iDigit))) & 0xf];
+  str[2 + nbDigit] = '\0';
+  PBErrCrashStr(buf, str);
+}
+
+// Append 'val' in decimal to the buffer 'buf' of the crash handler
+static void PBErrCrashDec(PBErrCrashBuf* const buf, const long val) {
+  char str[24];
+  int pos = 23;
+  str[pos] = '\0';
+  unsigned long v = (val < 0 ? 0ul - (unsigned long)val : 
+    (unsigned long)val);
+  do {
+    str[--pos] = (char)('0' + v % 10);
+    v /= 10;
+  } while (v > 0);
+  if (val < 0)
+    str[--pos] = '-';
+  PBErrCrashStr(buf, str + pos);
+}
+
+// Append the registers of the context 'ctx' to the buffer 'buf' of
+// the crash handler
+static void PBErrCrashRegisters(PBErrCrashBuf* const buf, 
+  const ucontext_t* const ctx) {
+  PBErrCrashStr(buf, "Registers:");
+#if defined(__x86_64__)
+  static const char* lbl[] = {"rip", "rsp", "rbp", "rax", "rbx", 
+    "rcx", "rdx", "rsi", "rdi", "r8", "r9", "r10", "r11", "r12", 
+    "r13", "r14", "r15", "eflags"};
+  static const int reg[] = {REG_RIP, REG_RSP, REG_RBP, REG_RAX,
+    REG_RBX, REG_RCX, REG_RDX, REG_RSI, REG_RDI, REG_R8, REG_R9,
+    REG_R10, REG_R11, REG_R12, REG_R13, REG_R14, REG_R15, REG_EFL};
+  for (size_t iReg = 0; iReg < sizeof(reg) / sizeof(reg[0]); ++iReg) {
+    PBErrCrashStr(buf, (iReg % 4 == 0 ? "\n  " : " "));
+    PBErrCrashStr(buf, lbl[iReg]);
+    PBErrCrashStr(buf, " ");
+    PBErrCrashHex(buf, 
+      (unsigned long)(ctx->uc_mcontext.gregs[reg[iReg]]));
   }
-  if (data == NULL) {
-    that->_type = PBErrTypeNullPointer;
-    sprintf(that->_msg, "'data' is null\n");
-    that->_fatal = true;
-    PBErrCatch(that);
+  PBErrCrashStr(buf, "\n");
+#elif defined(__aarch64__)
+  for (int iReg = 0; iReg < 31; ++iReg) {
+    PBErrCrashStr(buf, (iReg % 4 == 0 ? "\n  x" : " x"));
+    PBErrCrashDec(buf, iReg);
+    PBErrCrashStr(buf, " ");
+    PBErrCrashHex(buf, ctx->uc_mcontext.regs[iReg]);
   }
+  PBErrCrashStr(buf, "\n  sp ");
+  PBErrCrashHex(buf, ctx->uc_mcontext.sp);
+  PBErrCrashStr(buf, " pc ");
+  PBErrCrashHex(buf, ctx->uc_mcontext.pc);
+  PBErrCrashStr(buf, " pstate ");
+  PBErrCrashHex(buf, ctx->uc_mcontext.pstate);
+  PBErrCrashStr(buf, "\n");
+#else
+  (void)ctx;
+  PBErrCrashStr(buf, " unavailable on this architecture\n");
 #endif
-  // Read from the stream
-  if (fscanf(stream, format, data) == EOF) {
-    that->_type = PBErrTypeIOError;
-    sprintf(that->_msg, "fscanf failed\n");
-    that->_fatal = false;
-    PBErrCatch(that);
-    return false;
-  }
-  return true;
 }
-  
-bool _PBErrScanfStr(PBErr* const that, 
-  FILE* const stream, const char* const format, char* const data) {
-#if BUILDMODE == 0
-  if (that == NULL) {
-    that->_type = PBErrTypeNullPointer;
-    sprintf(that->_msg, "'that' is null\n");
-    that->_fatal = true;
-    PBErrCatch(that);
+
+// Append the last error catched in the domain 'domain' to the buffer
+// 'buf' of the crash handler, if there is one
+static void PBErrCrashLastErr(PBErrCrashBuf* const buf, 
+  const int domain) {
+  PBErrLastErr* last = PBErrCrash._last + domain;
+  unsigned int seq = 
+    atomic_load_explicit(&(last->_seq), memory_order_acquire);
+  if (seq == 0)
+    return;
+  PBErrCrashStr(buf, "PBErrLast: ");
+  PBErrCrashStr(buf, PBErrDomainLbl[domain]);
+  PBErrCrashStr(buf, "\n");
+  // The entry is being written by a thread interrupted by the crash
+  if (seq & 1u) {
+    PBErrCrashStr(buf, "  (being written)\n");
+    return;
   }
-  if (stream == NULL) {
-    that->_type = PBErrTypeNullPointer;
-    sprintf(that->_msg, "'stream' is null\n");
-    that->_fatal = true;
-    PBErrCatch(that);
+  PBErrCrashStr(buf, "  PBErrType: ");
+  PBErrCrashStr(buf, ((int)(last->_type) >= 0 && 
+    last->_type < PBErrTypeNb ? PBErrTypeLbl[last->_type] : "?"));
+  PBErrCrashStr(buf, "\n  PBErrThread: ");
+  PBErrCrashDec(buf, last->_thread);
+  PBErrCrashStr(buf, (last->_fatal ? "\n  PBErrFatal: true\n" : 
+    "\n  PBErrFatal: false\n"));
+  if (last->_msg[0] != '\0') {
+    PBErrCrashStr(buf, "  PBErrMsg: ");
+    PBErrCrashStr(buf, last->_msg);
+    PBErrCrashStr(buf, "\n");
   }
-  if (format == NULL) {
-    that->_type = PBErrTypeNullPointer;
-    sprintf(that->_msg, "'format' is null\n");
-    that->_fatal = true;
-    PBErrCatch(that);
+  // Lazily formatted message: formatting isn't async-signal-safe, 
+  // give the format and the raw arguments
+  if (last->_site != NULL) {
+    PBErrCrashStr(buf, "  PBErrFormat: ");
+    PBErrCrashStr(buf, last->_site->_format);
+    PBErrCrashStr(buf, "\n  PBErrArgs:");
+    for (int iArg = 0; iArg < last->_nbArg && 
+      iArg < PBERR_NBMAXARG; ++iArg) {
+      PBErrCrashStr(buf, " ");
+      PBErrCrashHex(buf, last->_args[iArg]._u);
+    }
+    PBErrCrashStr(buf, "\n  PBErrSite: ");
+    PBErrCrashStr(buf, last->_site->_file);
+    PBErrCrashStr(buf, ":");
+    PBErrCrashDec(buf, last->_site->_line);
+    PBErrCrashStr(buf, " (");
+    PBErrCrashStr(buf, last->_site->_func);
+    PBErrCrashStr(buf, ")\n");
   }
-  if (data == NULL) {
-    that->_type = PBErrTypeNullPointer;
-    sprintf(that->_msg, "'data' is null\n");
-    that->_fatal = true;
-    PBErrCatch(that);
+  if (atomic_load_explicit(&(last->_seq), memory_order_acquire) != seq)
+    PBErrCrashStr(buf, "  (modified while written)\n");
+}
+
+// Handler of the crash signals, it uses only async-signal-safe calls
+// and memory preallocated
+static void PBErrCrashHandle(int sig, siginfo_t* info, void* ctx) {
+  int errnoSave = errno;
+  // Only one thread reports, the other ones wait for the process to
+  // be killed by the signal reraised at the end of the report
+  while (atomic_flag_test_and_set(&(PBErrCrash._reporting)))
+    sleep(1);
+  PBErrCrashBuf buf;
+  buf._fd = PBErrCrash._fd;
+  buf._len = 0;
+  PBErrCrashStr(&buf, "---- PBErrCrash ----\nSignal: ");
+  PBErrCrashDec(&buf, sig);
+  for (int iSig = 0; iSig < PBERR_NBCRASHSIG; ++iSig) 
+    if (PBErrCrashSig[iSig] == sig) {
+      PBErrCrashStr(&buf, " (");
+      PBErrCrashStr(&buf, PBErrCrashSigLbl[iSig]);
+      PBErrCrashStr(&buf, ")");
+    }
+  PBErrCrashStr(&buf, "\nCode: ");
+  PBErrCrashDec(&buf, info->si_code);
+  PBErrCrashStr(&buf, "\nAddress: ");
+  PBErrCrashHex(&buf, (unsigned long)(info->si_addr));
+  PBErrCrashStr(&buf, "\nThread: ");
+  PBErrCrashDec(&buf, PBErrThreadId());
+  PBErrCrashStr(&buf, "\n");
+  PBErrCrashRegisters(&buf, ctx);
+  // The unwinder has been pre-warmed at installation
+  void* stack[PBERR_MAXSTACKHEIGHT];
+  int height = PBErrUnwind(stack, 
+    atomic_load_explicit(&PBErrStackHeightCur, memory_order_relaxed), 
+    0, (const ucontext_t*)ctx);
+  PBErrCrashStr(&buf, "Stack:\n");
+  for (int iAddr = 0; iAddr < height; ++iAddr) {
+    unsigned long addr = (unsigned long)(stack[iAddr]);
+    PBErrCrashStr(&buf, "  ");
+    PBErrCrashHex(&buf, addr);
+    for (int iMod = 0; iMod < PBErrCrash._nbModule; ++iMod) {
+      const PBErrModule* mod = PBErrCrash._modules + iMod;
+      if (addr >= mod->_start && addr < mod->_end) {
+        PBErrCrashStr(&buf, " ");
+        PBErrCrashStr(&buf, mod->_path);
+        PBErrCrashStr(&buf, " ");
+        PBErrCrashHex(&buf, addr - mod->_base);
+        break;
+      }
+    }
+    PBErrCrashStr(&buf, "\n");
   }
-#endif
-  // Read from the stream
-  if (fscanf(stream, format, data) == EOF) {
-    that->_type = PBErrTypeIOError;
-    sprintf(that->_msg, "fscanf failed\n");
-    that->_fatal = false;
-    PBErrCatch(that);
+  for (int iDomain = 0; iDomain < PBErrDomainNb; ++iDomain)
+    PBErrCrashLastErr(&buf, iDomain);
+  PBErrCrashStr(&buf, "--------------------\n");
+  PBErrCrashFlush(&buf);
+  // The action has been reset to the default one, the signal is 
+  // blocked until the handler returns and is then delivered again
+  // to get the default behaviour (core dump)
+  raise(sig);
+  errno = errnoSave;
+}
+
+// Install the crash handler: on SIGSEGV, SIGBUS, SIGFPE and SIGILL a
+// report is written on the file descriptor 'fd' (stderr if 'fd' is 
+// negative), then the signal is raised again with its default action
+// Return false if the handler couldn't be installed
+bool PBErrCrashHandlerInstall(const int fd) {
+  PBErrCrash._fd = (fd >= 0 ? fd : STDERR_FILENO);
+  if (atomic_load(&(PBErrCrash._active)))
+    return true;
+  // The unwinder must not be warmed up in the handler
+  PBErrUnwindWarm();
+  pthread_mutex_lock(&(PBErrSym._mutex));
+  PBErrSym._nbModule = 0;
+  dl_iterate_phdr(PBErrModuleAdd, NULL);
+  memcpy(PBErrCrash._modules, PBErrSym._modules, 
+    sizeof(PBErrModule) * (size_t)(PBErrSym._nbModule));
+  PBErrCrash._nbModule = PBErrSym._nbModule;
+  pthread_mutex_unlock(&(PBErrSym._mutex));
+  stack_t altStack = {.ss_sp = PBErrCrash._stack, .ss_flags = 0,
+    .ss_size = PBERR_CRASHSTACKSIZE};
+  if (sigaltstack(&altStack, &(PBErrCrash._prevStack)) != 0)
     return false;
-  }
+  struct sigaction act;
+  memset(&act, 0, sizeof(act));
+  act.sa_sigaction = PBErrCrashHandle;
+  sigemptyset(&(act.sa_mask));
+  act.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_RESETHAND;
+  for (int iSig = 0; iSig < PBERR_NBCRASHSIG; ++iSig)
+    if (sigaction(PBErrCrashSig[iSig], &act, 
+      PBErrCrash._prevAct + iSig) != 0) {
+      for (int jSig = 0; jSig < iSig; ++jSig)
+        sigaction(PBErrCrashSig[jSig], PBErrCrash._prevAct + jSig, 
+          NULL);
+      sigaltstack(&(PBErrCrash._prevStack), NULL);
+      return false;
+    }
+  atomic_store(&(PBErrCrash._active), true);
   return true;
 }
-  
-bool _PBErrPrintfShort(PBErr* const that, 
-  FILE* const stream, const char* const format, const short data) {
-#if BUILDMODE == 0
-  if (that == NULL) {
-    that->_type = PBErrTypeNullPointer;
-    sprintf(that->_msg, "'that' is null\n");
-    that->_fatal = true;
-    PBErrCatch(that);
-  }
-  if (stream == NULL) {
-    that->_type = PBErrTypeNullPointer;
-    sprintf(that->_msg, "'stream' is null\n");
-    that->_fatal = true;
-    PBErrCatch(that);
-  }
-  if (format == NULL) {
-    that->_type = PBErrTypeNullPointer;
-    sprintf(that->_msg, "'format' is null\n");
-    that->_fatal = true;
-    PBErrCatch(that);
+
+// Uninstall the crash handler, restore the previous actions and the
+// previous alternate stack of the installing thread
+void PBErrCrashHandlerUninstall(void) {
+  if (!atomic_load(&(PBErrCrash._active)))
+    return;
+  for (int iSig = 0; iSig < PBERR_NBCRASHSIG; ++iSig)
+    sigaction(PBErrCrashSig[iSig], PBErrCrash._prevAct + iSig, NULL);
+  // Restore the previous stack only if ours is still the current one
+  stack_t cur;
+  if (sigaltstack(NULL, &cur) == 0 && cur.ss_sp == PBErrCrash._stack)
+    sigaltstack(&(PBErrCrash._prevStack), NULL);
+  atomic_store(&(PBErrCrash._active), false);
+}
+
+// Key for the destructor of the alternate stack of each thread
+static pthread_key_t PBErrCrashKey;
+static pthread_once_t PBErrCrashKeyOnce = PTHREAD_ONCE_INIT;
+
+// Destructor of the alternate stack 'stack' of a thread
+static void PBErrCrashThreadRelease(void* stack) {
+  stack_t cur;
+  if (sigaltstack(NULL, &cur) == 0 && cur.ss_sp == stack) {
+    stack_t altStack = {.ss_sp = NULL, .ss_flags = SS_DISABLE,
+      .ss_size = 0};
+    sigaltstack(&altStack, NULL);
   }
-#endif
-  // Print to the stream
-  if (fprintf(stream, format, data) < 0) {
-    that->_type = PBErrTypeIOError;
-    sprintf(that->_msg, "fprintf failed\n");
-    that->_fatal = false;
-    PBErrCatch(that);
+  free(stack);
+}
+
+// Create the key for the destructor of the alternate stack of each
+// thread
+static void PBErrCrashKeyCreate(void) {
+  pthread_key_create(&PBErrCrashKey, PBErrCrashThreadRelease);
+}
+
+// Give the calling thread an alternate stack for the crash handler,
+// freed when the thread exits. An alternate stack already set by the
+// user is kept
+// Return false if the stack couldn't be allocated or set
+bool PBErrCrashHandlerThreadInit(void) {
+  stack_t cur;
+  if (sigaltstack(NULL, &cur) != 0)
+    return false;
+  if ((cur.ss_flags & SS_DISABLE) == 0)
+    return true;
+  pthread_once(&PBErrCrashKeyOnce, PBErrCrashKeyCreate);
+  void* stack = malloc(PBERR_CRASHSTACKSIZE);
+  if (stack == NULL)
+    return false;
+  stack_t altStack = {.ss_sp = stack, .ss_flags = 0,
+    .ss_size = PBERR_CRASHSTACKSIZE};
+  if (sigaltstack(&altStack, NULL) != 0 ||
+    pthread_setspecific(PBErrCrashKey, stack) != 0) {
+    PBErrCrashThreadRelease(stack);
     return false;
   }
   return true;
 }
 
-bool _PBErrPrintfLong(PBErr* const that, 
-  FILE* const stream, const char* const format, const long data) {
-#if BUILDMODE == 0
-  if (that == NULL) {
-    that->_type = PBErrTypeNullPointer;
-    sprintf(that->_msg, "'that' is null\n");
-    that->_fatal = true;
-    PBErrCatch(that);
-  }
-  if (stream == NULL) {
-    that->_type = PBErrTypeNullPointer;
-    sprintf(that->_msg, "'stream' is null\n");
-    that->_fatal = true;
-    PBErrCatch(that);
+// Handler of SIGPROF, record the stack of the interrupted thread
+static void PBErrProfHandle(int sig, siginfo_t* info, void* ctx) {
+  (void)sig;
+  (void)info;
+  if (!atomic_load_explicit(&(PBErrProf._active), memory_order_relaxed))
+    return;
+  int errnoSave = errno;
+  void* stack[PBERR_PROFSTACKHEIGHT];
+  int height = PBErrUnwind(stack, PBERR_PROFSTACKHEIGHT, 0, 
+    (const ucontext_t*)ctx);
+  if (height <= 0) {
+    errno = errnoSave;
+    return;
   }
-  if (format == NULL) {
-    that->_type = PBErrTypeNullPointer;
-    sprintf(that->_msg, "'format' is null\n");
-    that->_fatal = true;
-    PBErrCatch(that);
+  // FNV-1a hash of the stack, never 0 which marks the empty entries
+  unsigned long hash = 14695981039346656037ul;
+  for (int iAddr = 0; iAddr < height; ++iAddr) {
+    hash ^= (unsigned long)(stack[iAddr]);
+    hash *= 1099511628211ul;
   }
-#endif
-  // Print to the stream
-  if (fprintf(stream, format, data) < 0) {
-    that->_type = PBErrTypeIOError;
-    sprintf(that->_msg, "fprintf failed\n");
-    that->_fatal = false;
-    PBErrCatch(that);
-    return false;
+  if (hash == 0)
+    hash = 1;
+  atomic_fetch_add_explicit(&(PBErrProf._nbSample), 1, 
+    memory_order_relaxed);
+  // Two stacks with the same 64 bits hash are considered identical
+  for (int iProbe = 0; iProbe < PBERR_PROFNBENTRY; ++iProbe) {
+    PBErrProfEntry* entry = PBErrProf._entries +
+      ((hash + (unsigned long)iProbe) & (PBERR_PROFNBENTRY - 1));
+    unsigned long cur = 
+      atomic_load_explicit(&(entry->_hash), memory_order_relaxed);
+    if (cur == 0) {
+      if (atomic_compare_exchange_strong_explicit(&(entry->_hash), 
+        &cur, hash, memory_order_relaxed, memory_order_relaxed)) {
+        entry->_height = height;
+        memcpy(entry->_stack, stack, 
+          sizeof(void*) * (size_t)height);
+      }
+    }
+    if (cur == 0 || cur == hash) {
+      atomic_fetch_add_explicit(&(entry->_nb), 1, memory_order_relaxed);
+      errno = errnoSave;
+      return;
+    }
   }
-  return true;
+  atomic_fetch_add_explicit(&(PBErrProf._nbDropped), 1, 
+    memory_order_relaxed);
+  errno = errnoSave;
 }
 
-bool _PBErrPrintfInt(PBErr* const that, 
-  FILE* const stream, const char* const format, const int data) {
-#if BUILDMODE == 0
-  if (that == NULL) {
-    that->_type = PBErrTypeNullPointer;
-    sprintf(that->_msg, "'that' is null\n");
-    that->_fatal = true;
-    PBErrCatch(that);
-  }
-  if (stream == NULL) {
-    that->_type = PBErrTypeNullPointer;
-    sprintf(that->_msg, "'stream' is null\n");
-    that->_fatal = true;
-    PBErrCatch(that);
-  }
-  if (format == NULL) {
-    that->_type = PBErrTypeNullPointer;
-    sprintf(that->_msg, "'format' is null\n");
-    that->_fatal = true;
-    PBErrCatch(that);
+// Start the sampling profiler at 'frequency' samples per second of
+// CPU time of the process
+// Return false if it couldn't be started
+bool PBErrProfStart(const unsigned int frequency) {
+  if (frequency == 0 || frequency > 1000000 ||
+    atomic_load(&(PBErrProf._active)))
+    return false;
+  if (PBErrProf._entries == NULL) {
+    PBErrProf._entries = 
+      calloc(PBERR_PROFNBENTRY, sizeof(PBErrProfEntry));
+    if (PBErrProf._entries == NULL)
+      return false;
+  } else {
+    memset(PBErrProf._entries, 0, 
+      sizeof(PBErrProfEntry) * PBERR_PROFNBENTRY);
   }
-#endif
-  // Print to the stream
-  if (fprintf(stream, format, data) < 0) {
-    that->_type = PBErrTypeIOError;
-    sprintf(that->_msg, "fprintf failed\n");
-    that->_fatal = false;
-    PBErrCatch(that);
+  atomic_store(&(PBErrProf._nbSample), 0);
+  atomic_store(&(PBErrProf._nbDropped), 0);
+  // The unwinder must not be warmed up in the handler
+  PBErrUnwindWarm();
+  struct sigaction act;
+  memset(&act, 0, sizeof(act));
+  act.sa_sigaction = PBErrProfHandle;
+  sigemptyset(&(act.sa_mask));
+  act.sa_flags = SA_SIGINFO | SA_RESTART;
+  if (sigaction(SIGPROF, &act, &(PBErrProf._prevAct)) != 0)
+    return false;
+  atomic_store(&(PBErrProf._active), true);
+  struct itimerval timer;
+  timer.it_interval.tv_sec = 0;
+  timer.it_interval.tv_usec = (suseconds_t)(1000000 / frequency);
+  timer.it_value = timer.it_interval;
+  if (setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+    atomic_store(&(PBErrProf._active), false);
+    sigaction(SIGPROF, &(PBErrProf._prevAct), NULL);
     return false;
   }
   return true;
 }
 
-bool _PBErrPrintfFloat(PBErr* const that, 
-  FILE* const stream, const char* const format, const float data) {
-#if BUILDMODE == 0
-  if (that == NULL) {
-    that->_type = PBErrTypeNullPointer;
-    sprintf(that->_msg, "'that' is null\n");
-    that->_fatal = true;
-    PBErrCatch(that);
+// Append to 'buf' of size 'size' the name of the function containing
+// 'addr' for the folded stacks
+static void PBErrProfFrameName(const void* const addr, char* const buf,
+  const size_t size) {
+  char sym[PBERR_SYMBOLLENGTHMAX];
+  PBErrSymbolize(addr, sym, PBERR_SYMBOLLENGTHMAX);
+  // The symbol is 'module(function+offset)' or 'module(+offset)', 
+  // keep only the function, or the module and offset if it's unknown
+  char* open = strrchr(sym, '(');
+  char* name = sym;
+  if (open != NULL && open[1] != '+') {
+    name = open + 1;
+    char* plus = strrchr(name, '+');
+    if (plus != NULL)
+      *plus = '\0';
+  } else if (open != NULL) {
+    char* slash = memrchr(sym, '/', (size_t)(open - sym));
+    name = (slash != NULL ? slash + 1 : sym);
+    char* close = strrchr(name, ')');
+    if (close != NULL)
+      *close = '\0';
+    *open = '+';
+    memmove(open + 1, open + 2, strlen(open + 2) + 1);
   }
-  if (stream == NULL) {
-    that->_type = PBErrTypeNullPointer;
-    sprintf(that->_msg, "'stream' is null\n");
-    that->_fatal = true;
-    PBErrCatch(that);
+  // ';' and ' ' are separators in the folded stacks
+  for (char* c = name; *c != '\0'; ++c)
+    if (*c == ';' || *c == ' ')
+      *c = '_';
+  size_t len = strlen(buf);
+  snprintf(buf + len, size - len, "%s", name);
+}
+
+// Line of the folded stacks
+typedef struct PBErrProfLine {
+  char* _line;
+  unsigned long _nb;
+} PBErrProfLine;
+
+// Comparison of the lines of the folded stacks for qsort
+static int PBErrProfLineCmp(const void* a, const void* b) {
+  return strcmp(((const PBErrProfLine*)a)->_line, 
+    ((const PBErrProfLine*)b)->_line);
+}
+
+// Write into 'line' of size 'size' the folded stack 'stack' of 
+// height 'height', innermost first. If 'isInterrupted' the innermost
+// address is the interrupted instruction, else all the addresses are
+// return addresses
+static void PBErrFoldedStack(void* const* const stack, 
+  const int height, const bool isInterrupted, char* const line, 
+  const size_t size) {
+  line[0] = '\0';
+  for (int iAddr = height - 1; iAddr >= 0; --iAddr) {
+    // The return addresses point after the call
+    const char* addr = stack[iAddr];
+    PBErrProfFrameName((iAddr > 0 || !isInterrupted ? addr - 1 : addr), 
+      line, size);
+    if (iAddr > 0)
+      strncat(line, ";", size - strlen(line) - 1);
   }
-  if (format == NULL) {
-    that->_type = PBErrTypeNullPointer;
-    sprintf(that->_msg, "'format' is null\n");
-    that->_fatal = true;
-    PBErrCatch(that);
+}
+
+// Print the 'nbLine' lines of folded stacks 'lines' on 'stream', 
+// sorted and with the identical stacks merged, and free them
+static void PBErrFoldedPrint(FILE* const stream, 
+  PBErrProfLine* const lines, const int nbLine) {
+  qsort(lines, (size_t)nbLine, sizeof(PBErrProfLine), PBErrProfLineCmp);
+  for (int iLine = 0; iLine < nbLine; ++iLine) {
+    unsigned long nb = lines[iLine]._nb;
+    while (iLine + 1 < nbLine && 
+      strcmp(lines[iLine]._line, lines[iLine + 1]._line) == 0) {
+      free(lines[iLine]._line);
+      ++iLine;
+      nb += lines[iLine]._nb;
+    }
+    fprintf(stream, "%s %lu\n", lines[iLine]._line, nb);
+    free(lines[iLine]._line);
   }
-#endif
-  // Print to the stream
-  if (fprintf(stream, format, data) < 0) {
-    that->_type = PBErrTypeIOError;
-    sprintf(that->_msg, "fprintf failed\n");
-    that->_fatal = false;
-    PBErrCatch(that);
+}
+
+// Stop the sampling profiler and print the sampled stacks on 'stream'
+// in the folded format (one line per stack, frames from the 
+// outermost to the innermost separated by ';', then the number of 
+// samples) as read by the flame graph tools
+// Return false if the profiler wasn't started or the stacks couldn't
+// be printed
+bool PBErrProfStop(FILE* const stream) {
+  if (!atomic_load(&(PBErrProf._active)))
+    return false;
+  struct itimerval timer;
+  memset(&timer, 0, sizeof(timer));
+  setitimer(ITIMER_PROF, &timer, NULL);
+  atomic_store(&(PBErrProf._active), false);
+  // Ignoring the signal discards the ones still pending, which would
+  // terminate the process if the previous action is the default one
+  signal(SIGPROF, SIG_IGN);
+  sigaction(SIGPROF, &(PBErrProf._prevAct), NULL);
+  if (stream == NULL)
+    return true;
+  // Stacks differing only by their addresses in the same functions
+  // are merged on the same line
+  PBErrProfLine* lines = malloc(sizeof(PBErrProfLine) * 
+    PBERR_PROFNBENTRY);
+  if (lines == NULL)
     return false;
+  int nbLine = 0;
+  char line[PBERR_PROFSTACKHEIGHT * PBERR_SYMBOLLENGTHMAX];
+  for (int iEntry = 0; iEntry < PBERR_PROFNBENTRY; ++iEntry) {
+    const PBErrProfEntry* entry = PBErrProf._entries + iEntry;
+    unsigned long nb = atomic_load(&(entry->_nb));
+    if (nb == 0 || entry->_height <= 0)
+      continue;
+    PBErrFoldedStack(entry->_stack, entry->_height, true, line, 
+      sizeof(line));
+    lines[nbLine]._line = strdup(line);
+    lines[nbLine]._nb = nb;
+    if (lines[nbLine]._line != NULL)
+      ++nbLine;
   }
+  PBErrFoldedPrint(stream, lines, nbLine);
+  free(lines);
   return true;
 }
 
-bool _PBErrPrintfStr(PBErr* const that, 
-  FILE* const stream, const char* const format, 
-  const char* const data) {
+// Return the number of samples of the profiler since its last start
+unsigned long PBErrProfGetNbSample(void) {
+  return atomic_load(&(PBErrProf._nbSample));
+}
+
+// Return the number of samples dropped because the table of stacks
+// of the profiler was full
+unsigned long PBErrProfGetNbDropped(void) {
+  return atomic_load(&(PBErrProf._nbDropped));
+}
+
+// Memorize the PBErr 'that' as the last error of its domain for the
+// crash handler. If another thread is memorizing an error of the same
+// domain, 'that' is ignored
+static void PBErrCrashRecord(const PBErr* const that, 
+  const PBErrDomain domain) {
+  PBErrLastErr* last = PBErrCrash._last + domain;
+  unsigned int seq = 
+    atomic_load_explicit(&(last->_seq), memory_order_relaxed);
+  if ((seq & 1u) || !atomic_compare_exchange_strong_explicit(
+    &(last->_seq), &seq, seq + 1, memory_order_acquire,
+    memory_order_relaxed))
+    return;
+  last->_type = that->_type;
+  last->_fatal = that->_fatal;
+  last->_thread = PBErrThreadId();
+  last->_site = that->_site;
+  last->_nbArg = that->_nbArg;
+  memcpy(last->_args, that->_args, sizeof(last->_args));
+  if (that->_msg[0] != '\0')
+    memcpy(last->_msg, that->_msg, PBERR_MSGLENGTHMAX);
+  else
+    last->_msg[0] = '\0';
+  last->_msg[PBERR_MSGLENGTHMAX - 1] = '\0';
+  atomic_store_explicit(&(last->_seq), seq + 2, memory_order_release);
+}
+
+// Print the stack 'stack' of height 'height' on 'stream' according
+// to the current symbolization mode, and append it to the log of
+// raw addresses if it's opened
+static void PBErrStackPrint(void* const* const stack, const int height,
+  FILE* const stream) {
+  PBErrSymbolMode mode = atomic_load(&PBErrSymbolModeCur);
+  if (mode == PBErrSymbolModeImmediate) {
+    // Flush the stream before writing directly to its file descriptor
+    fflush(stream);
+    backtrace_symbols_fd(stack, height, fileno(stream));
+  } else if (mode == PBErrSymbolModeCached) {
+    char sym[PBERR_SYMBOLLENGTHMAX];
+    for (int iLvl = 0; iLvl < height; ++iLvl)
+      fprintf(stream, "%s[%p]\n", 
+        PBErrSymbolize(stack[iLvl], sym, PBERR_SYMBOLLENGTHMAX),
+        stack[iLvl]);
+  }
+  if (mode != PBErrSymbolModeRaw && !atomic_load(&(PBErrSym._isAddrLog)))
+    return;
+  pthread_mutex_lock(&(PBErrSym._mutex));
+  PBErrModule mod;
+  for (int iLvl = 0; iLvl < height; ++iLvl) {
+    bool found = PBErrModuleFind(stack[iLvl], &mod);
+    unsigned long offset = 
+      (unsigned long)stack[iLvl] - (found ? mod._base : 0UL);
+    const char* path = (found ? mod._path : "??");
+    if (mode == PBErrSymbolModeRaw)
+      fprintf(stream, "%s(+0x%lx)[%p]\n", path, offset, stack[iLvl]);
+    if (PBErrSym._addrLog != NULL)
+      fprintf(PBErrSym._addrLog, "%s 0x%lx\n", path, offset);
+  }
+  if (PBErrSym._addrLog != NULL) {
+    fprintf(PBErrSym._addrLog, "\n");
+    fflush(PBErrSym._addrLog);
+  }
+  pthread_mutex_unlock(&(PBErrSym._mutex));
+}
+
+// Return the monotonic time in nanoseconds
+static inline uint64_t PBErrNow(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+// Size of the buffer of the JSON and binary reports
+#define PBERR_RECBUFSIZE 4096
+
+// Append the formatted string to the 'buf' of size PBERR_RECBUFSIZE
+// and length '*len', truncated if the buffer is full
+static void PBErrRecordCat(char* const buf, size_t* const len,
+  const char* const format, ...) {
+  if (*len >= PBERR_RECBUFSIZE - 1)
+    return;
+  va_list ap;
+  va_start(ap, format);
+  int ret = vsnprintf(buf + *len, PBERR_RECBUFSIZE - *len, format, ap);
+  va_end(ap);
+  if (ret > 0)
+    *len += ((size_t)ret < PBERR_RECBUFSIZE - *len ? 
+      (size_t)ret : PBERR_RECBUFSIZE - 1 - *len);
+}
+
+// Append the string 'str' escaped for JSON to the 'buf' of size
+// PBERR_RECBUFSIZE and length '*len'
+static void PBErrRecordCatJSONStr(char* const buf, size_t* const len,
+  const char* const str) {
+  PBErrRecordCat(buf, len, "\"");
+  for (const unsigned char* c = (const unsigned char*)str; *c != '\0';
+    ++c) {
+    if (*c == '"' || *c == '\\')
+      PBErrRecordCat(buf, len, "\\%c", *c);
+    else if (*c == '\n')
+      PBErrRecordCat(buf, len, "\\n");
+    else if (*c < 0x20)
+      PBErrRecordCat(buf, len, "\\u%04x", *c);
+    else
+      PBErrRecordCat(buf, len, "%c", *c);
+  }
+  PBErrRecordCat(buf, len, "\"");
+}
+
+// Append the 'nbByte' lowest bytes of 'val' in little endian to the
+// 'buf' of length '*len'
+static void PBErrRecordPut(unsigned char* const buf, size_t* const len,
+  const uint64_t val, const int nbByte) {
+  for (int iByte = 0; iByte < nbByte; ++iByte)
+    buf[(*len)++] = (unsigned char)(val >> (8 * iByte));
+}
+
+// Encode the record 'rec' in JSON into 'buf' of size PBERR_RECBUFSIZE
+// Return the length of the encoded record
+static size_t PBErrRecordToJSON(const PBErrRecord* const rec,
+  char* const buf) {
+  const PBErr* err = &(rec->_err);
+  char msg[PBERR_MSGLENGTHMAX];
+  size_t len = 0;
+  PBErrRecordCat(buf, &len, "{\"time\":%llu,\"thread\":%u,",
+    (unsigned long long)rec->_time, rec->_thread);
+  PBErrRecordCat(buf, &len, 
+    "\"domain\":\"%s\",\"type\":\"%s\",\"msg\":",
+    ((int)err->_domain >= 0 && err->_domain < PBErrDomainNb ? 
+      PBErrDomainLbl[err->_domain] : ""),
+    ((int)err->_type >= 0 && err->_type < PBErrTypeNb ?
+      PBErrTypeLbl[err->_type] : ""));
+  PBErrRecordCatJSONStr(buf, &len, 
+    PBErrFormatMsg(err, msg, PBERR_MSGLENGTHMAX));
+  PBErrRecordCat(buf, &len, 
+    ",\"fatal\":%s,\"errno\":%d,\"repeat\":%lu",
+    (err->_fatal ? "true" : "false"), rec->_errno, rec->_nbRepeat);
+  if (err->_site != NULL) {
+    PBErrRecordCat(buf, &len, ",\"site\":");
+    snprintf(msg, PBERR_MSGLENGTHMAX, "%s:%d (%s)", err->_site->_file,
+      err->_site->_line, err->_site->_func);
+    PBErrRecordCatJSONStr(buf, &len, msg);
+  }
+  if (rec->_context[0] != '\0') {
+    PBErrRecordCat(buf, &len, ",\"context\":[");
+    for (const char* line = rec->_context; *line != '\0';) {
+      const char* end = strchr(line, '\n');
+      size_t lenLine = 
+        (end != NULL ? (size_t)(end - line) : strlen(line));
+      snprintf(msg, PBERR_MSGLENGTHMAX, "%.*s", (int)lenLine, line);
+      if (line > rec->_context)
+        PBErrRecordCat(buf, &len, ",");
+      PBErrRecordCatJSONStr(buf, &len, msg);
+      line += lenLine + (end != NULL ? 1 : 0);
+    }
+    PBErrRecordCat(buf, &len, "]");
+  }
+  PBErrRecordCat(buf, &len, ",\"stack\":[");
+  for (int iAddr = 0; iAddr < rec->_stackHeight; ++iAddr)
+    PBErrRecordCat(buf, &len, "%s\"%p\"", (iAddr > 0 ? "," : ""),
+      rec->_stack[iAddr]);
+  // Make sure the line is terminated even if it was truncated
+  if (len > PBERR_RECBUFSIZE - 3)
+    len = PBERR_RECBUFSIZE - 3;
+  buf[len++] = ']';
+  buf[len++] = '}';
+  buf[len++] = '\n';
+  return len;
+}
+
+// Encode the record 'rec' in binary into 'buf' of size 
+// PBERR_RECBUFSIZE
+// Return the length of the encoded record
+static size_t PBErrRecordToBin(const PBErrRecord* const rec,
+  unsigned char* const buf) {
+  const PBErr* err = &(rec->_err);
+  char msg[PBERR_MSGLENGTHMAX];
+  PBErrFormatMsg(err, msg, PBERR_MSGLENGTHMAX);
+  size_t lenMsg = strlen(msg);
+  // Leave room for the size, filled at the end
+  size_t len = 4;
+  PBErrRecordPut(buf, &len, PBERR_RECVERSION, 1);
+  PBErrRecordPut(buf, &len, (err->_fatal ? 1 : 0), 1);
+  PBErrRecordPut(buf, &len, (uint64_t)err->_domain, 2);
+  PBErrRecordPut(buf, &len, (uint64_t)err->_type, 2);
+  PBErrRecordPut(buf, &len, (uint64_t)rec->_stackHeight, 2);
+  PBErrRecordPut(buf, &len, rec->_thread, 4);
+  PBErrRecordPut(buf, &len, rec->_time, 8);
+  PBErrRecordPut(buf, &len, rec->_nbRepeat, 8);
+  PBErrRecordPut(buf, &len, (uint32_t)rec->_errno, 4);
+  PBErrRecordPut(buf, &len, lenMsg, 2);
+  memcpy(buf + len, msg, lenMsg);
+  len += lenMsg;
+  for (int iAddr = 0; iAddr < rec->_stackHeight; ++iAddr)
+    PBErrRecordPut(buf, &len, (uintptr_t)(rec->_stack[iAddr]), 8);
+  size_t lenContext = strlen(rec->_context);
+  PBErrRecordPut(buf, &len, lenContext, 2);
+  memcpy(buf + len, rec->_context, lenContext);
+  len += lenContext;
+  size_t lenHead = 0;
+  PBErrRecordPut(buf, &lenHead, len - 4, 4);
+  return len;
+}
+
+// Write the 'len' bytes of 'buf' on 'stream' at once
+static void PBErrRecordWrite(FILE* const stream, const void* const buf,
+  const size_t len) {
+  // Flush what may have been written through the stream before to
+  // keep the order of the outputs
+  fflush(stream);
+  int fd = fileno(stream);
+  // Streams without file descriptor (cf PBErrOpenStreamOutAsync) 
+  // are locked for the whole fwrite
+  if (fd < 0) {
+    fwrite(buf, 1, len, stream);
+    fflush(stream);
+    return;
+  }
+  const char* ptr = buf;
+  size_t nbLeft = len;
+  while (nbLeft > 0) {
+    ssize_t ret = write(fd, ptr, nbLeft);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret <= 0)
+      return;
+    ptr += ret;
+    nbLeft -= (size_t)ret;
+  }
+}
+
+// Print the record 'rec' of a catched error
+static void PBErrRecordPrint(const PBErrRecord* const rec) {
+  FILE* stream = (rec->_err._stream ? rec->_err._stream : stderr);
+  if (rec->_err._format == PBErrFormatJSON || 
+    rec->_err._format == PBErrFormatBin) {
+    _Alignas(8) char buf[PBERR_RECBUFSIZE];
+    size_t len = (rec->_err._format == PBErrFormatJSON ?
+      PBErrRecordToJSON(rec, buf) : 
+      PBErrRecordToBin(rec, (unsigned char*)buf));
+    int errnoSave = errno;
+    PBErrRecordWrite(stream, buf, len);
+    errno = errnoSave;
+    return;
+  }
+  if (rec->_nbRepeat > 0) {
+    fprintf(stream, "---- PBErrCatch ----\n");
+    PBErrPrintln(&(rec->_err), stream);
+    fprintf(stream, "Repeated %lu times\n", rec->_nbRepeat);
+    fprintf(stream, "--------------------\n");
+    return;
+  }
+  fprintf(stream, "---- PBErrCatch ----\n");
+  PBErrPrintln(&(rec->_err), stream);
+  if (rec->_context[0] != '\0') {
+    fprintf(stream, "Context:\n");
+    for (const char* line = rec->_context; *line != '\0';) {
+      const char* end = strchr(line, '\n');
+      size_t lenLine = 
+        (end != NULL ? (size_t)(end - line) : strlen(line));
+      fprintf(stream, "  %.*s\n", (int)lenLine, line);
+      line += lenLine + (end != NULL ? 1 : 0);
+    }
+  }
+  fprintf(stream, "Stack:\n");
+  PBErrStackPrint(rec->_stack, rec->_stackHeight, stream);
+  if (rec->_errno != 0)
+    fprintf(stream, "errno: %s\n", strerror(rec->_errno));
+  if (rec->_err._fatal)
+    fprintf(stream, "Exiting\n");
+  fprintf(stream, "--------------------\n");
+}
+
+// Enable or disable the recording of the trace events
+void PBErrTraceEnable(const bool enable) {
+  atomic_store(&(PBErrTrace._active), enable);
+}
+
+// Destructor of the ring 'ring' of a thread, released for reuse
+static void PBErrTraceRingRelease(void* ring) {
+  PBErrTraceRingCur = NULL;
+  atomic_store_explicit(&(((PBErrTraceRing*)ring)->_isFree), true,
+    memory_order_release);
+}
+
+// Create the key for the destructor of the ring of each thread
+static void PBErrTraceKeyCreate(void) {
+  pthread_key_create(&PBErrTraceKey, PBErrTraceRingRelease);
+}
+
+// Return a ring for the calling thread, the ring of an exited thread
+// if any, else a new one, or null if it couldn't be allocated
+static __attribute__((cold, noinline)) PBErrTraceRing* 
+  PBErrTraceRingCreate(void) {
+  pthread_once(&PBErrTraceKeyOnce, PBErrTraceKeyCreate);
+  PBErrTraceRing* ring = atomic_load(&(PBErrTrace._rings));
+  for (; ring != NULL; ring = ring->_next) {
+    bool isFree = true;
+    if (atomic_load_explicit(&(ring->_isFree), memory_order_relaxed) &&
+      atomic_compare_exchange_strong_explicit(&(ring->_isFree), 
+      &isFree, false, memory_order_acquire, memory_order_relaxed))
+      break;
+  }
+  if (ring != NULL) {
+    unsigned long nb = atomic_load(&(ring->_nb));
+    atomic_fetch_add(&(PBErrTrace._nbDropped), 
+      (nb < PBERR_TRACENBEVENT ? nb : PBERR_TRACENBEVENT));
+    atomic_store(&(ring->_nb), 0);
+  } else {
+    ring = malloc(sizeof(PBErrTraceRing));
+    if (ring == NULL)
+      return NULL;
+    atomic_init(&(ring->_nb), 0);
+    atomic_init(&(ring->_isFree), false);
+    ring->_next = atomic_load(&(PBErrTrace._rings));
+    while (!atomic_compare_exchange_weak(&(PBErrTrace._rings), 
+      &(ring->_next), ring));
+  }
+  ring->_thread = PBErrThreadId();
+  pthread_setspecific(PBErrTraceKey, ring);
+  PBErrTraceRingCur = ring;
+  return ring;
+}
+
+// Record a trace event of phase 'phase' named 'name' in the domain 
+// 'domain' with the value 'value' into the ring buffer of the calling
+// thread
+void PBErrTraceRecord(const PBErrDomain domain, const char* const name,
+  const char phase, const long value) {
+  if (!atomic_load_explicit(&(PBErrTrace._active), 
+    memory_order_relaxed))
+    return;
+  PBErrTraceRing* ring = PBErrTraceRingCur;
+  if (PBERR_UNLIKELY(ring == NULL)) {
+    ring = PBErrTraceRingCreate();
+    if (ring == NULL)
+      return;
+  }
+  unsigned long nb = 
+    atomic_load_explicit(&(ring->_nb), memory_order_relaxed);
+  PBErrTraceEvent* event = 
+    ring->_events + (nb & (PBERR_TRACENBEVENT - 1));
+  event->_time = PBErrNow();
+  event->_name = name;
+  event->_value = value;
+  event->_domain = domain;
+  event->_phase = phase;
+  atomic_store_explicit(&(ring->_nb), nb + 1, memory_order_release);
+}
+
+// Print the trace events recorded by all the threads on 'stream' in
+// the Chrome trace event JSON format
+// Return false if the trace couldn't be printed
+bool PBErrTraceExport(FILE* const stream) {
+  if (stream == NULL)
+    return false;
+  fprintf(stream, "{\"traceEvents\":[");
+  const char* sep = "\n";
+  int pid = (int)getpid();
+  for (PBErrTraceRing* ring = atomic_load(&(PBErrTrace._rings)); 
+    ring != NULL; ring = ring->_next) {
+    fprintf(stream, "%s{\"name\":\"thread_name\",\"ph\":\"M\","
+      "\"pid\":%d,\"tid\":%u,\"args\":{\"name\":\"PBErr thread %u\"}}",
+      sep, pid, ring->_thread, ring->_thread);
+    sep = ",\n";
+    unsigned long nb = 
+      atomic_load_explicit(&(ring->_nb), memory_order_acquire);
+    unsigned long first = 
+      (nb > PBERR_TRACENBEVENT ? nb - PBERR_TRACENBEVENT : 0);
+    for (unsigned long iEvent = first; iEvent < nb; ++iEvent) {
+      const PBErrTraceEvent* event = 
+        ring->_events + (iEvent & (PBERR_TRACENBEVENT - 1));
+      const char* domain = ((int)(event->_domain) >= 0 && 
+        event->_domain < PBErrDomainNb ? 
+        PBErrDomainLbl[event->_domain] : "");
+      fprintf(stream, "%s{\"name\":", sep);
+      char name[PBERR_RECBUFSIZE];
+      size_t len = 0;
+      PBErrRecordCatJSONStr(name, &len, event->_name);
+      fprintf(stream, "%s,\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,"
+        "\"pid\":%d,\"tid\":%u", name, domain, event->_phase, 
+        (double)(event->_time) / 1000.0, pid, ring->_thread);
+      if (event->_phase == 'C')
+        fprintf(stream, ",\"args\":{\"value\":%ld}", event->_value);
+      else if (event->_phase == 'i')
+        fprintf(stream, ",\"s\":\"t\",\"args\":{\"fatal\":%s}",
+          (event->_value ? "true" : "false"));
+      fprintf(stream, "}");
+    }
+  }
+  fprintf(stream, "\n]}\n");
+  return (ferror(stream) == 0);
+}
+
+// Forget the trace events recorded by all the threads
+void PBErrTraceReset(void) {
+  for (PBErrTraceRing* ring = atomic_load(&(PBErrTrace._rings)); 
+    ring != NULL; ring = ring->_next)
+    atomic_store(&(ring->_nb), 0);
+  atomic_store(&(PBErrTrace._nbDropped), 0);
+}
+
+// Return the number of events of exited threads discarded since the
+// last reset because a new thread reused their ring
+unsigned long PBErrTraceGetNbDropped(void) {
+  return atomic_load(&(PBErrTrace._nbDropped));
+}
+
+// Push the record 'rec' into the ring buffer of the sink. If the 
+// ring buffer is full the record is dropped
+// Return false if the sink isn't active anymore, the record must 
+// then be printed by the caller
+static bool PBErrSinkPush(const PBErrRecord* const rec) {
+  // The sink may have been stopped since the caller checked it. Once
+  // the producer is counted, PBErrSinkStop waits for it to complete
+  // its push before stopping the flusher, so the record isn't 
+  // stranded in the ring buffer
+  atomic_fetch_add(&(PBErrSink._nbPushing), 1);
+  if (!atomic_load(&(PBErrSink._active))) {
+    atomic_fetch_sub(&(PBErrSink._nbPushing), 1);
+    return false;
+  }
+  size_t pos = 
+    atomic_load_explicit(&(PBErrSink._posPush), memory_order_relaxed);
+  PBErrSinkSlot* slot = NULL;
+  while (true) {
+    slot = PBErrSink._slots + (pos & PBErrSink._mask);
+    size_t seq = 
+      atomic_load_explicit(&(slot->_seq), memory_order_acquire);
+    long diff = (long)seq - (long)pos;
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&(PBErrSink._posPush),
+        &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+        break;
+    } else if (diff < 0) {
+      atomic_fetch_add_explicit(&(PBErrSink._nbDropped), 1, 
+        memory_order_relaxed);
+      atomic_fetch_sub(&(PBErrSink._nbPushing), 1);
+      return true;
+    } else {
+      pos = atomic_load_explicit(&(PBErrSink._posPush), 
+        memory_order_relaxed);
+    }
+  }
+  slot->_rec = *rec;
+  atomic_store_explicit(&(slot->_seq), pos + 1, memory_order_release);
+  atomic_fetch_add_explicit(&(PBErrSink._nbPushed), 1, 
+    memory_order_relaxed);
+  sem_post(&(PBErrSink._sem));
+  atomic_fetch_sub(&(PBErrSink._nbPushing), 1);
+  return true;
+}
+
+// Pop the next record of the ring buffer of the sink into 'rec'
+// Return false if the ring buffer is empty
+static bool PBErrSinkPop(PBErrRecord* const rec) {
+  size_t pos = 
+    atomic_load_explicit(&(PBErrSink._posPop), memory_order_relaxed);
+  PBErrSinkSlot* slot = PBErrSink._slots + (pos & PBErrSink._mask);
+  size_t seq = atomic_load_explicit(&(slot->_seq), memory_order_acquire);
+  if ((long)seq - (long)(pos + 1) < 0)
+    return false;
+  *rec = slot->_rec;
+  atomic_store_explicit(&(slot->_seq), pos + PBErrSink._mask + 1,
+    memory_order_release);
+  atomic_store_explicit(&(PBErrSink._posPop), pos + 1, 
+    memory_order_relaxed);
+  return true;
+}
+
+// Main function of the flusher thread of the sink
+static void* PBErrSinkFlusher(void* arg) {
+  (void)arg;
+  PBErrRecord rec;
+  while (true) {
+    sem_wait(&(PBErrSink._sem));
+    while (PBErrSinkPop(&rec)) {
+      PBErrRecordPrint(&rec);
+      atomic_fetch_add_explicit(&(PBErrSink._nbFlushed), 1, 
+        memory_order_release);
+    }
+    if (atomic_load(&(PBErrSink._stop)))
+      break;
+  }
+  return NULL;
+}
+
+// Start the asynchronous sink with a ring buffer of at least
+// 'capacity' records
+// Return false if the sink couldn't be started
+bool PBErrSinkStart(const unsigned int capacity) {
+  if (atomic_load(&(PBErrSink._active)) || capacity == 0)
+    return false;
+  size_t nbSlot = 1;
+  while (nbSlot < capacity)
+    nbSlot <<= 1;
+  // The ring buffer is allocated at the first start and reused as is
+  // by the following ones, so it's never released or reset while a 
+  // late producer may use it. A larger capacity can't be given later
+  if (PBErrSink._slots == NULL) {
+    PBErrSinkSlot* slots = malloc(sizeof(PBErrSinkSlot) * nbSlot);
+    if (slots == NULL)
+      return false;
+    for (size_t iSlot = 0; iSlot < nbSlot; ++iSlot)
+      atomic_init(&(slots[iSlot]._seq), iSlot);
+    atomic_init(&(PBErrSink._posPush), 0);
+    atomic_init(&(PBErrSink._posPop), 0);
+    PBErrSink._mask = nbSlot - 1;
+    PBErrSink._slots = slots;
+  } else if (PBErrSink._mask + 1 < nbSlot) {
+    return false;
+  }
+  atomic_init(&(PBErrSink._nbPushed), 0);
+  atomic_init(&(PBErrSink._nbFlushed), 0);
+  atomic_init(&(PBErrSink._nbDropped), 0);
+  atomic_init(&(PBErrSink._stop), false);
+  if (sem_init(&(PBErrSink._sem), 0, 0) != 0)
+    return false;
+  if (pthread_create(&(PBErrSink._flusher), NULL, 
+    PBErrSinkFlusher, NULL) != 0) {
+    sem_destroy(&(PBErrSink._sem));
+    return false;
+  }
+  // Guarantee the flush of pending records when the process exits
+  static bool isAtExitSet = false;
+  if (!isAtExitSet) {
+    atexit(PBErrSinkStop);
+    isAtExitSet = true;
+  }
+  atomic_store(&(PBErrSink._active), true);
+  return true;
+}
+
+// Stop the asynchronous sink after writing all the pending records
+void PBErrSinkStop(void) {
+  bool active = true;
+  if (!atomic_compare_exchange_strong(&(PBErrSink._active), 
+    &active, false))
+    return;
+  // Wait for the producers which have seen the sink active, then the
+  // flusher empties the ring buffer before stopping
+  while (atomic_load(&(PBErrSink._nbPushing)) > 0)
+    sched_yield();
+  atomic_store(&(PBErrSink._stop), true);
+  sem_post(&(PBErrSink._sem));
+  pthread_join(PBErrSink._flusher, NULL);
+  sem_destroy(&(PBErrSink._sem));
+}
+
+// Wait until all the records pushed into the sink so far have been
+// written
+void PBErrSinkFlush(void) {
+  if (!atomic_load(&(PBErrSink._active)))
+    return;
+  unsigned long nbPushed = atomic_load(&(PBErrSink._nbPushed));
+  while (atomic_load_explicit(&(PBErrSink._nbFlushed), 
+    memory_order_acquire) < nbPushed)
+    sched_yield();
+}
+
+// Return the number of records dropped by the sink because its ring
+// buffer was full
+unsigned long PBErrSinkGetNbDropped(void) {
+  return atomic_load(&(PBErrSink._nbDropped));
+}
+
+// Deduplicate the non fatal errors: the first 'nbFull' occurences of
+// an error (same type and same stack) are printed in full, then only
+// one summary every 'period' occurences
+// If 'nbFull' is 0 the deduplication is disabled (default)
+void PBErrSetDedup(const unsigned long nbFull, 
+  const unsigned long period) {
+  atomic_store(&(PBErrDedup._period), (period > 0 ? period : 1));
+  atomic_store(&(PBErrDedup._nbFull), nbFull);
+}
+
+// Forget the occurences counted by the deduplication
+// Must not be called while other threads may catch errors
+void PBErrDedupReset(void) {
+  for (int iEntry = 0; iEntry < PBERR_NBDEDUP; ++iEntry) {
+    atomic_store(&(PBErrDedup._entries[iEntry]._key), 0);
+    atomic_store(&(PBErrDedup._entries[iEntry]._nb), 0);
+  }
+  atomic_store(&(PBErrDedup._nbSuppressed), 0);
+}
+
+// Return the number of occurences of errors neither printed nor 
+// summarized because of the deduplication
+unsigned long PBErrDedupGetNbSuppressed(void) {
+  return atomic_load(&(PBErrDedup._nbSuppressed));
+}
+
+// Count the occurence of the error recorded in 'rec' in the table of 
+// deduplication
+// Return false if the error must not be printed, else true, and set 
+// rec->_nbRepeat if only a summary must be printed
+static bool PBErrDedupCount(PBErrRecord* const rec) {
+  unsigned long nbFull = 
+    atomic_load_explicit(&(PBErrDedup._nbFull), memory_order_relaxed);
+  if (nbFull == 0)
+    return true;
+  // FNV-1a hash of the type, raise site and stack. The site tells
+  // apart errors raised at different lines of the same function, even
+  // if the stack isn't captured
+  unsigned long key = 14695981039346656037UL;
+  key = (key ^ (unsigned long)(rec->_err._type)) * 1099511628211UL;
+  const PBErrSite* site = rec->_err._site;
+  if (site != NULL) {
+    key = (key ^ (unsigned long)(uintptr_t)(site->_file)) * 
+      1099511628211UL;
+    key = (key ^ (unsigned long)(site->_line)) * 1099511628211UL;
+  }
+  for (int iLvl = 0; iLvl < rec->_stackHeight; ++iLvl)
+    key = (key ^ (unsigned long)(rec->_stack[iLvl])) * 1099511628211UL;
+  if (key == 0)
+    key = 1;
+  PBErrDedupEntry* entry = NULL;
+  for (int iProbe = 0; iProbe < PBERR_NBDEDUP && entry == NULL; 
+    ++iProbe) {
+    PBErrDedupEntry* e = 
+      PBErrDedup._entries + ((key + (unsigned long)iProbe) & 
+      (PBERR_NBDEDUP - 1));
+    unsigned long keyEntry = 
+      atomic_load_explicit(&(e->_key), memory_order_relaxed);
+    if (keyEntry == 0 && atomic_compare_exchange_strong(&(e->_key), 
+      &keyEntry, key))
+      keyEntry = key;
+    if (keyEntry == key)
+      entry = e;
+  }
+  // If the table is full, print the error
+  if (entry == NULL)
+    return true;
+  unsigned long nb = 
+    atomic_fetch_add_explicit(&(entry->_nb), 1, memory_order_relaxed) + 1;
+  if (nb <= nbFull)
+    return true;
+  unsigned long period = 
+    atomic_load_explicit(&(PBErrDedup._period), memory_order_relaxed);
+  if ((nb - nbFull) % period == 0) {
+    rec->_nbRepeat = period;
+    return true;
+  }
+  atomic_fetch_add_explicit(&(PBErrDedup._nbSuppressed), 1, 
+    memory_order_relaxed);
+  return false;
+}
+
+// Report the failure 'fail' of a secured function through 'that' 
+// (thePBErr if null). 'name' is the name of the null argument for
+// PBErrFailNull, 'size' the requested size (or alignment for 
+// PBErrFailAlignment)
+void PBErrFailed(PBErr* const that, const PBErrFail fail,
+  const char* const name, const size_t size) {
+  PBErr* err = (that != NULL ? that : &thePBErr);
+  switch (fail) {
+    case PBErrFailNull:
+      PBErrRaise(err, PBErrTypeNullPointer, true, "'%s' is null\n", 
+        name);
+      break;
+    case PBErrFailScanf:
+      PBErrRaise(err, PBErrTypeIOError, false, "fscanf failed\n");
+      break;
+    case PBErrFailPrintf:
+      PBErrRaise(err, PBErrTypeIOError, false, "fprintf failed\n");
+      break;
+    case PBErrFailMalloc:
+      PBErrRaise(err, PBErrTypeMallocFailed, true,
+        "malloc of %lu bytes failed\n", (unsigned long)size);
+      break;
+    case PBErrFailAlignment:
+      PBErrRaise(err, PBErrTypeInvalidArg, true,
+        "alignment %lu is not a power of 2 multiple of %lu\n", 
+        (unsigned long)size, (unsigned long)sizeof(void*));
+      break;
+    case PBErrFailMallocAligned:
+      PBErrRaise(err, PBErrTypeMallocFailed, true,
+        "aligned malloc of %lu bytes failed\n", (unsigned long)size);
+      break;
+    case PBErrFailCalloc:
+      PBErrRaise(err, PBErrTypeMallocFailed, true,
+        "calloc of %lu bytes failed\n", (unsigned long)size);
+      break;
+    case PBErrFailRealloc:
+      PBErrRaise(err, PBErrTypeMallocFailed, true,
+        "realloc of %lu bytes failed\n", (unsigned long)size);
+      break;
+    case PBErrFailMallocHuge:
+      PBErrRaise(err, PBErrTypeMallocFailed, true,
+        "huge malloc of %lu bytes failed\n", (unsigned long)size);
+      break;
+    default:
+      PBErrRaise(err, PBErrTypeInvalidArg, true, 
+        "invalid failure (%d)\n", fail);
+      break;
+  }
+}
+
+// Format the context stack of the calling thread into 'buf' of size
+// 'size', one line per frame, outermost first
+static void PBErrContextFormat(char* const buf, const size_t size) {
+  buf[0] = '\0';
+  const PBErrContextStack* stack = &PBErrContextCur;
+  int nb = (stack->_nb < PBERR_NBMAXCONTEXT ? 
+    stack->_nb : PBERR_NBMAXCONTEXT);
+  size_t len = 0;
+  for (int iFrame = 0; iFrame < nb && len < size - 1; ++iFrame) {
+    const PBErrContext* context = stack->_frames + iFrame;
+    PBErrFormatSite(context->_site, context->_args, context->_nbArg,
+      buf + len, size - len);
+    len += strlen(buf + len);
+    if (len < size - 1) {
+      buf[len++] = '\n';
+      buf[len] = '\0';
+    }
+  }
+  if (stack->_nb > nb && len < size - 1)
+    snprintf(buf + len, size - len, "(%d more)\n", stack->_nb - nb);
+}
+
+// Hook for error handling
+// Print the error type, the error message, the stack
+// Exit if _fatal == true, or unwind to the innermost PBErrTry scope of
+// the calling thread if any
+// Reset the PBErr
+// Non fatal errors may be deduplicated (cf PBErrSetDedup)
+// If the asynchronous sink is active, non fatal errors are only
+// recorded, and printed later by the flusher thread. Fatal errors
+// stop the sink (which writes the pending records) before being
+// printed
+void PBErrCatch(PBErr* const that) {
+  if (that == NULL)
+    return;
+  // Count the error
+  PBErrCatchCounter* counter = PBErrCatchCounters + 
+    ((int)(that->_domain) >= 0 && that->_domain < PBErrDomainNb ?
+    that->_domain : PBErrDomainPBErr);
+  atomic_fetch_add_explicit(counter->_nb + 
+    ((int)(that->_type) >= 0 && that->_type < PBErrTypeNb ?
+    that->_type : PBErrTypeUnknown), 1, memory_order_relaxed);
+  if (that->_fatal)
+    atomic_fetch_add_explicit(&(counter->_nbFatal), 1, 
+      memory_order_relaxed);
+  bool isCrash = 
+    atomic_load_explicit(&(PBErrCrash._active), memory_order_relaxed);
+  // The strings of a lazily formatted message may not be valid anymore
+  // when the copies of the error kept by the collector and the crash
+  // handler are read, so format it now
+  if ((that->_collector != NULL || isCrash) && that->_msg[0] == '\0' &&
+    PBErrSiteHasStr(that)) {
+    char msg[PBERR_MSGLENGTHMAX];
+    PBErrFormatMsg(that, msg, PBERR_MSGLENGTHMAX);
+    memcpy(that->_msg, msg, PBERR_MSGLENGTHMAX);
+  }
+  if (isCrash)
+    PBErrCrashRecord(that, (PBErrDomain)(counter - PBErrCatchCounters));
+#if BUILDMODE != 2
+  // Put the error on the timeline of the trace
+  if (atomic_load_explicit(&(PBErrTrace._active), memory_order_relaxed))
+    PBErrTraceRecord((PBErrDomain)(counter - PBErrCatchCounters),
+      PBErrTypeLbl[((int)(that->_type) >= 0 && 
+      that->_type < PBErrTypeNb ? that->_type : PBErrTypeUnknown)],
+      'i', that->_fatal);
+#endif
+  // Memorize a copy of the error for the coordinator of the
+  // parallel region if any
+  if (that->_collector != NULL)
+    PBErrCollectorPush(that->_collector, that);
+  // Unwind a fatal error to the innermost PBErrTry scope if any
+  PBErrScope* scope = PBErrScopeTop;
+  if (that->_fatal && scope != NULL) {
+    PBErrScopeTop = scope->_prev;
+    PBErrContextCur._nb = scope->_nbContext;
+    scope->_err = *that;
+    // The strings of a lazily formatted message may be on the 
+    // unwound part of the stack, so format it now
+    if (PBErrSiteHasStr(that))
+      PBErrFormatMsg(that, scope->_err._msg, PBERR_MSGLENGTHMAX);
+    PBErrReset(that);
+    PBErrScopeCaught = scope;
+    siglongjmp(scope->_env, 1);
+  }
+  PBErrRecord rec;
+  rec._err = *that;
+  // The default PBErr of the repositories are printed as thePBErr
+  // unless their stream has been set
+  if (that->_stream == NULL && 
+    (uintptr_t)that >= (uintptr_t)PBErrDomainErr && 
+    (uintptr_t)that < (uintptr_t)(PBErrDomainErr + PBErrDomainNb)) {
+    rec._err._stream = thePBErr._stream;
+    rec._err._format = thePBErr._format;
+  }
+  rec._errno = errno;
+  errno = 0;
+  if (atomic_load_explicit(&PBErrUnwinderCur, memory_order_relaxed) ==
+    PBErrUnwinderFramePointer)
+    PBErrStackBoundsInit();
+  rec._stackHeight = PBErrUnwind(rec._stack, 
+    atomic_load_explicit(&PBErrStackHeightCur, memory_order_relaxed), 
+    0, NULL);
+  rec._nbRepeat = 0;
+  rec._time = PBErrNow();
+  rec._thread = PBErrThreadId();
+  // Repeated non fatal errors are printed in full only the first 
+  // times, then periodically summarized
+  if (!that->_fatal && !PBErrDedupCount(&rec)) {
+    PBErrReset(that);
+    return;
+  }
+  PBErrContextFormat(rec._context, PBERR_CONTEXTLENGTHMAX);
+  if (atomic_load_explicit(&(PBErrSink._active), memory_order_relaxed)) {
+    if (!that->_fatal) {
+      // The strings of a lazily formatted message may not be valid 
+      // anymore when the flusher prints it, so format it now
+      if (PBErrSiteHasStr(that))
+        PBErrFormatMsg(that, rec._err._msg, PBERR_MSGLENGTHMAX);
+      // If the sink has been stopped meanwhile, print it here
+      if (PBErrSinkPush(&rec)) {
+        PBErrReset(that);
+        return;
+      }
+    } else {
+      PBErrSinkStop();
+    }
+  }
+  PBErrRecordPrint(&rec);
+  if (that->_fatal)
+    exit(that->_type);
+  PBErrReset(that);
+}
+
+// Print the PBErr 'that' on 'stream'
+void PBErrPrintln(const PBErr* const that, FILE* const stream) {
+  // If the PBErr or stream is null
+  if (that == NULL || stream == NULL)
+    // Nothing to do
+    return;
+  if (that->_type > 0 && that->_type < PBErrTypeNb)
+    fprintf(stream, "PBErrType: %s\n", PBErrTypeLbl[that->_type]);
+  if (that->_domain > PBErrDomainPBErr && that->_domain < PBErrDomainNb)
+    fprintf(stream, "PBErrDomain: %s\n", PBErrDomainLbl[that->_domain]);
+  if (that->_msg[0] != '\0') {
+    fprintf(stream, "PBErrMsg: %s\n", that->_msg);
+  } else if (that->_site != NULL) {
+    char msg[PBERR_MSGLENGTHMAX];
+    fprintf(stream, "PBErrMsg: %s\n", 
+      PBErrFormatMsg(that, msg, PBERR_MSGLENGTHMAX));
+  }
+  if (that->_site != NULL)
+    fprintf(stream, "PBErrSite: %s:%d (%s)\n", that->_site->_file,
+      that->_site->_line, that->_site->_func);
+  if (that->_fatal)
+    fprintf(stream, "PBErrFatal: true\n");
+  else
+    fprintf(stream, "PBErrFatal: false\n");
+}
+
+// Make the pointers per repository of the calling thread point 
+// toward the PBErr 'errs' of each domain, or toward the default ones
+// if 'errs' is null
+static void PBErrThreadPoint(PBErr* const errs) {
+  // Addresses of the pointers of the calling thread, in the same
+  // order as PBErrDomain. The default domain has no pointer
+  PBErr** ptrs[PBErrDomainNb] = {
+    NULL,
+    &PBMathErr,
+    &GSetErr,
+    &ELORankErr,
+    &ShapoidErr,
+    &BCurveErr,
+    &GenBrushErr,
+    &FracNoiseErr,
+    &GenAlgErr,
+    &GradErr,
+    &KnapSackErr,
+    &NeuraNetErr,
+    &PBPhysErr,
+    &GenTreeErr,
+    &JSONErr,
+    &MiniFrameErr,
+    &PixelToPosEstimatorErr,
+    &PBDataAnalysisErr,
+    &PBImgAnalysisErr,
+    &PBFileSysErr,
+    &SDSIAErr,
+    &GDataSetErr,
+    &ResPublishErr,
+    &TheSquidErr,
+    &CBoErr,
+    &CrypticErr,
+    &GradAutomatonErr,
+    &SmallyErr,
+    &BuzzyErr,
+    &NeuraMorphErr
+  };
+  for (int iDomain = 0; iDomain < PBErrDomainNb; ++iDomain)
+    if (ptrs[iDomain] != NULL)
+      *(ptrs[iDomain]) = 
+        (errs != NULL ? errs : PBErrDomainErr) + iDomain;
+}
+
+// Destructor of the PBErr 'errs' of a thread, the pointers per 
+// repository are reset first as they may still be used by the 
+// destructors of other keys
+static void PBErrThreadRelease(void* errs) {
+  PBErrThreadPoint(NULL);
+  PBErrThreadCtx = NULL;
+  free(errs);
+}
+
+// Create the key for the destructor of the PBErr of each thread
+static void PBErrThreadKeyCreate(void) {
+  pthread_key_create(&PBErrThreadKey, PBErrThreadRelease);
+}
+
+// Give the calling thread its own PBErr per domain and make the
+// pointers per repository point toward them. The errors catched
+// through these PBErr are copied into 'collector' if it's not null
+// The stream and format of the new PBErr are the ones of thePBErr
+// They are allocated at the first call, to keep the threads not
+// calling this function light, and freed when the thread exits
+// Return false if they couldn't be allocated
+bool PBErrThreadInit(PBErrCollector* const collector) {
+  PBErrStackBoundsInit();
+  if (PBErrThreadCtx == NULL) {
+    pthread_once(&PBErrThreadKeyOnce, PBErrThreadKeyCreate);
+    PBErr* errs = malloc(sizeof(PBErr) * PBErrDomainNb);
+    if (errs == NULL)
+      return false;
+    if (pthread_setspecific(PBErrThreadKey, errs) != 0) {
+      free(errs);
+      return false;
+    }
+    PBErrThreadCtx = errs;
+  }
+  for (int iDomain = 0; iDomain < PBErrDomainNb; ++iDomain) {
+    PBErr* err = PBErrThreadCtx + iDomain;
+    *err = PBErrCreateStatic();
+    err->_stream = thePBErr._stream;
+    err->_format = thePBErr._format;
+    err->_domain = (PBErrDomain)iDomain;
+    err->_collector = collector;
+  }
+  PBErrThreadPoint(PBErrThreadCtx);
+  return true;
+}
+
+// Return the identifier of the calling thread, numbered from 1 in
+// the order of the first call per thread
+unsigned int PBErrThreadId(void) {
+  static atomic_uint nbThread = 0;
+  static _Thread_local unsigned int id = 0;
+  if (id == 0)
+    id = atomic_fetch_add_explicit(&nbThread, 1, 
+      memory_order_relaxed) + 1;
+  return id;
+}
+
+// Return the PBErr of the calling thread for the domain 'domain', or
+// the default one of the domain if PBErrThreadInit() hasn't been 
+// called by this thread
+PBErr* PBErrThread(const PBErrDomain domain) {
+#if BUILDMODE == 0
+  if ((int)domain < 0 || domain >= PBErrDomainNb) {
+    PBErrRaise(&thePBErr, PBErrTypeInvalidArg, true,
+      "'domain' is invalid (%d)", domain);
+  }
+#endif
+  if (PBErrThreadCtx != NULL)
+    return PBErrThreadCtx + domain;
+  return PBErrDomainDefault(domain);
+}
+
+// Create a collector able to memorize up to 'capacity' errors
+PBErrCollector* PBErrCollectorCreate(const int capacity) {
+#if BUILDMODE == 0
+  if (capacity <= 0) {
+    PBErrRaise(&thePBErr, PBErrTypeInvalidArg, true,
+      "'capacity' is invalid (%d>0)", capacity);
+  }
+#endif
+  PBErrCollector* that = malloc(sizeof(PBErrCollector));
+  PBErrCollectorSlot* slots = 
+    malloc(sizeof(PBErrCollectorSlot) * (size_t)capacity);
+  if (that == NULL || slots == NULL) {
+    free(that);
+    free(slots);
+    PBErrRaise(&thePBErr, PBErrTypeMallocFailed, true,
+      "malloc failed for collector of %d errors", capacity);
+    return NULL;
+  }
+  that->_slots = slots;
+  that->_capacity = capacity;
+  for (int iSlot = 0; iSlot < capacity; ++iSlot)
+    atomic_init(&(slots[iSlot]._ready), false);
+  atomic_init(&(that->_nb), 0);
+  atomic_init(&(that->_nbDropped), 0);
+  return that;
+}
+
+// Free the memory used by the collector 'that'
+void PBErrCollectorFree(PBErrCollector** that) {
+  if (that == NULL || *that == NULL)
+    return;
+  free((*that)->_slots);
+  free(*that);
+  *that = NULL;
+}
+
+// Empty the collector 'that'
+// Must not be called while other threads may push into it
+void PBErrCollectorReset(PBErrCollector* const that) {
+  if (that == NULL)
+    return;
+  for (int iSlot = 0; iSlot < that->_capacity; ++iSlot)
+    atomic_store(&(that->_slots[iSlot]._ready), false);
+  atomic_store(&(that->_nb), 0);
+  atomic_store(&(that->_nbDropped), 0);
+}
+
+// Push a copy of the PBErr 'err' into the collector 'that'
+// Return false if the collector is full
+// The slot is reserved with a compare and swap stopping at the 
+// capacity, then the copy is published by raising the slot's flag, 
+// so pushers never wait on each other
+bool PBErrCollectorPush(PBErrCollector* const that,
+  const PBErr* const err) {
+  if (that == NULL || err == NULL)
+    return false;
+  int iSlot = atomic_load_explicit(&(that->_nb), memory_order_relaxed);
+  do {
+    if (iSlot >= that->_capacity) {
+      atomic_fetch_add_explicit(&(that->_nbDropped), 1, 
+        memory_order_relaxed);
+      return false;
+    }
+  } while (!atomic_compare_exchange_weak_explicit(&(that->_nb), &iSlot,
+    iSlot + 1, memory_order_relaxed, memory_order_relaxed));
+  PBErrCollectorSlot* slot = that->_slots + iSlot;
+  slot->_err = *err;
+  slot->_err._collector = NULL;
+  atomic_store_explicit(&(slot->_ready), true, memory_order_release);
+  return true;
+}
+
+// Return the number of errors pushed into the collector 'that',
+// including the ones dropped because it was full
+unsigned long PBErrCollectorGetNbPushed(
+  const PBErrCollector* const that) {
+  if (that == NULL)
+    return 0;
+  return (unsigned long)atomic_load_explicit(&(that->_nb), 
+    memory_order_relaxed) + 
+    atomic_load_explicit(&(that->_nbDropped), memory_order_relaxed);
+}
+
+// Return the 'iErr'-th error memorized by the collector 'that', or
+// null if there is no such error or it's not yet completely written
+const PBErr* PBErrCollectorGet(const PBErrCollector* const that,
+  const int iErr) {
+  if (that == NULL || iErr < 0 || iErr >= that->_capacity)
+    return NULL;
+  const PBErrCollectorSlot* slot = that->_slots + iErr;
+  if (!atomic_load_explicit(&(slot->_ready), memory_order_acquire))
+    return NULL;
+  return &(slot->_err);
+}
+
+// Return the first error pushed into the collector 'that', or null
+// if there is none yet
+const PBErr* PBErrCollectorFirst(const PBErrCollector* const that) {
+  return PBErrCollectorGet(that, 0);
+}
+
+// Default size in bytes of the chunks of the arena of each thread
+#define PBERR_ARENACHUNKSIZE 65536
+
+// Key for the destructor of the arena of each thread
+static pthread_key_t PBErrArenaKey;
+static pthread_once_t PBErrArenaKeyOnce = PTHREAD_ONCE_INIT;
+
+// Arena of the current thread
+static _Thread_local PBErrArena PBErrArenaCur;
+
+// Static constructor for an arena allocating chunks of at least
+// 'chunkSize' bytes, and reporting errors through 'err'
+// No memory is allocated until the first allocation
+PBErrArena PBErrArenaCreateStatic(PBErr* const err, 
+  const size_t chunkSize) {
+  PBErrArena that = {._err = err, ._first = NULL, ._cur = NULL, 
+    ._chunkSize = chunkSize};
+  return that;
+}
+
+// Report through the error of the arena 'that' the failed allocation
+// of a chunk of 'size' bytes
+static __attribute__((cold, noinline)) void PBErrArenaFailed(
+  const PBErrArena* const that, const size_t size) {
+  PBErr* err = (that->_err != NULL ? that->_err : &thePBErr);
+  PBErrRaise(err, PBErrTypeMallocFailed, true,
+    "malloc of %lu bytes failed for the arena\n", (unsigned long)size);
+}
+
+// Allocate 'size' bytes in the arena 'that'
+// The memory is aligned as for malloc
+// If the current chunk is full, move to the next one, or allocate a 
+// new one at least twice as big as the current one
+void* PBErrArenaAlloc(PBErrArena* const that, const size_t size) {
+#if BUILDMODE == 0
+  if (that == NULL) {
+    PBErrRaise(&thePBErr, PBErrTypeNullPointer, true, "'that' is null");
+  }
+#endif
+  const size_t align = _Alignof(max_align_t);
+  // The aligned size and the chunk header must not wrap around
+  if (PBERR_UNLIKELY(size > SIZE_MAX - sizeof(PBErrArenaChunk) - 
+    align)) {
+    PBErrArenaFailed(that, size);
+    return NULL;
+  }
+  size_t sizeAligned = (size + align - 1) & ~(align - 1);
+  PBErrArenaChunk* chunk = that->_cur;
+  if (chunk != NULL && chunk->_size - chunk->_used >= sizeAligned) {
+    void* ret = (char*)(chunk->_mem) + chunk->_used;
+    chunk->_used += sizeAligned;
+    return ret;
+  }
+  // Reuse the next chunk if it's big enough
+  if (chunk != NULL && chunk->_next != NULL && 
+    chunk->_next->_size >= sizeAligned) {
+    chunk = chunk->_next;
+    chunk->_used = sizeAligned;
+    that->_cur = chunk;
+    return chunk->_mem;
+  }
+  // Chunks stop growing before their size wraps around
+  const size_t sizeChunkMax = SIZE_MAX - sizeof(PBErrArenaChunk);
+  size_t sizeChunk = 
+    (that->_chunkSize < sizeChunkMax ? that->_chunkSize : sizeChunkMax);
+  if (chunk != NULL && chunk->_size <= sizeChunkMax / 2 && 
+    chunk->_size * 2 > sizeChunk)
+    sizeChunk = chunk->_size * 2;
+  if (sizeChunk < sizeAligned)
+    sizeChunk = sizeAligned;
+  PBErrArenaChunk* newChunk = 
+    malloc(sizeof(PBErrArenaChunk) + sizeChunk);
+  if (newChunk == NULL) {
+    PBErrArenaFailed(that, sizeof(PBErrArenaChunk) + sizeChunk);
+    return NULL;
+  }
+  newChunk->_size = sizeChunk;
+  newChunk->_used = sizeAligned;
+  // Insert the new chunk after the current one to keep the
+  // following ones for reuse
+  if (chunk == NULL) {
+    newChunk->_next = that->_first;
+    that->_first = newChunk;
+  } else {
+    newChunk->_next = chunk->_next;
+    chunk->_next = newChunk;
+  }
+  that->_cur = newChunk;
+  return newChunk->_mem;
+}
+
+// Release at once all the allocations in the arena 'that', its 
+// chunks are kept for the following allocations
+void PBErrArenaReset(PBErrArena* const that) {
+  if (that == NULL || that->_first == NULL)
+    return;
+  that->_cur = that->_first;
+  that->_cur->_used = 0;
+}
+
+// Free the chunks of the arena 'that'
+void PBErrArenaRelease(PBErrArena* const that) {
+  if (that == NULL)
+    return;
+  while (that->_first != NULL) {
+    PBErrArenaChunk* chunk = that->_first;
+    that->_first = chunk->_next;
+    free(chunk);
+  }
+  that->_cur = NULL;
+}
+
+// Destructor of the arena of a thread
+static void PBErrArenaThreadRelease(void* arena) {
+  PBErrArenaRelease((PBErrArena*)arena);
+}
+
+// Create the key for the destructor of the arena of each thread
+static void PBErrArenaKeyCreate(void) {
+  pthread_key_create(&PBErrArenaKey, PBErrArenaThreadRelease);
+}
+
+// Return the arena of the calling thread, released when the thread
+// exits
+// Its errors are reported through thePBErr unless the user changes
+// its _err
+PBErrArena* PBErrArenaThread(void) {
+  PBErrArena* that = &PBErrArenaCur;
+  if (that->_chunkSize == 0) {
+    *that = PBErrArenaCreateStatic(&thePBErr, PBERR_ARENACHUNKSIZE);
+    pthread_once(&PBErrArenaKeyOnce, PBErrArenaKeyCreate);
+    pthread_setspecific(PBErrArenaKey, that);
+  }
+  return that;
+}
+
+// Get a snapshot of the allocation statistics of the domain 'domain'
+// into 'stat'
+void PBErrAllocStatGet(const PBErrDomain domain, 
+  PBErrAllocStat* const stat) {
+  if (stat == NULL)
+    return;
+  memset(stat, 0, sizeof(PBErrAllocStat));
+  if ((int)domain < 0 || domain >= PBErrDomainNb)
+    return;
+#if defined(PBERR_ALLOCSTAT)
+  // The statistics of the calling thread are exact, the ones of the 
+  // other threads are the ones at their last fold
+  if (PBErrAllocLocalCur != NULL)
+    PBErrAllocFoldLocal(PBErrAllocLocalCur);
+#endif
+  PBErrAllocCounter* counter = PBErrAllocCounters + domain;
+  stat->_live = atomic_load_explicit(&(counter->_live), 
+    memory_order_relaxed);
+  // The folds of other threads freeing memory allocated by this one 
+  // may temporarily make it negative
+  if ((long)(stat->_live) < 0)
+    stat->_live = 0;
+  stat->_peak = atomic_load_explicit(&(counter->_peak), 
+    memory_order_relaxed);
+  if (stat->_peak < stat->_live)
+    stat->_peak = stat->_live;
+  stat->_nbAlloc = atomic_load_explicit(&(counter->_nbAlloc), 
+    memory_order_relaxed);
+  stat->_nbFree = atomic_load_explicit(&(counter->_nbFree), 
+    memory_order_relaxed);
+  for (int iClass = 0; iClass < PBERR_NBSIZECLASS; ++iClass)
+    stat->_hist[iClass] = atomic_load_explicit(
+      counter->_hist + iClass, memory_order_relaxed);
+}
+
+// Print the allocation statistics of the domains having allocated
+// memory on the stream 'stream'
+void PBErrAllocStatPrint(FILE* const stream) {
+  if (stream == NULL)
+    return;
+  for (int iDomain = 0; iDomain < PBErrDomainNb; ++iDomain) {
+    PBErrAllocStat stat;
+    PBErrAllocStatGet((PBErrDomain)iDomain, &stat);
+    if (stat._nbAlloc == 0)
+      continue;
+    fprintf(stream, "%s: live %lu peak %lu alloc %lu free %lu\n",
+      PBErrDomainLbl[iDomain], stat._live, stat._peak, stat._nbAlloc,
+      stat._nbFree);
+    fprintf(stream, "  size classes:");
+    for (int iClass = 0; iClass < PBERR_NBSIZECLASS; ++iClass)
+      fprintf(stream, " %lu", stat._hist[iClass]);
+    fprintf(stream, "\n");
+  }
+}
+
+// Get a snapshot of the counters of catched errors into 'stat'
+void PBErrCountGet(PBErrCountStat* const stat) {
+  if (stat == NULL)
+    return;
+  for (int iDomain = 0; iDomain < PBErrDomainNb; ++iDomain) {
+    PBErrCatchCounter* counter = PBErrCatchCounters + iDomain;
+    for (int iType = 0; iType < PBErrTypeNb; ++iType)
+      stat->_nb[iDomain][iType] = atomic_load_explicit(
+        counter->_nb + iType, memory_order_relaxed);
+    stat->_nbFatal[iDomain] = atomic_load_explicit(
+      &(counter->_nbFatal), memory_order_relaxed);
+  }
+}
+
+// Reset the counters of catched errors
+void PBErrCountReset(void) {
+  for (int iDomain = 0; iDomain < PBErrDomainNb; ++iDomain) {
+    PBErrCatchCounter* counter = PBErrCatchCounters + iDomain;
+    for (int iType = 0; iType < PBErrTypeNb; ++iType)
+      atomic_store_explicit(counter->_nb + iType, 0, 
+        memory_order_relaxed);
+    atomic_store_explicit(&(counter->_nbFatal), 0, 
+      memory_order_relaxed);
+  }
+}
+
+// Print the counters of catched errors, the statistics of the 
+// deduplication, sink and allocations on 'stream' in the text format
+// of Prometheus
+void PBErrCountPrint(FILE* const stream) {
+  if (stream == NULL)
+    return;
+  PBErrCountStat stat;
+  PBErrCountGet(&stat);
+  fprintf(stream, 
+    "# HELP pberr_errors_total Number of catched errors\n"
+    "# TYPE pberr_errors_total counter\n");
+  for (int iDomain = 0; iDomain < PBErrDomainNb; ++iDomain)
+    for (int iType = 0; iType < PBErrTypeNb; ++iType)
+      if (stat._nb[iDomain][iType] > 0)
+        fprintf(stream, 
+          "pberr_errors_total{domain=\"%s\",type=\"%s\"} %lu\n",
+          PBErrDomainLbl[iDomain], PBErrTypeLbl[iType], 
+          stat._nb[iDomain][iType]);
+  fprintf(stream, 
+    "# HELP pberr_fatal_errors_total Number of catched fatal errors\n"
+    "# TYPE pberr_fatal_errors_total counter\n");
+  for (int iDomain = 0; iDomain < PBErrDomainNb; ++iDomain)
+    if (stat._nbFatal[iDomain] > 0)
+      fprintf(stream, "pberr_fatal_errors_total{domain=\"%s\"} %lu\n",
+        PBErrDomainLbl[iDomain], stat._nbFatal[iDomain]);
+  fprintf(stream, 
+    "# HELP pberr_suppressed_total Number of errors suppressed by "
+    "the deduplication\n"
+    "# TYPE pberr_suppressed_total counter\n"
+    "pberr_suppressed_total %lu\n", PBErrDedupGetNbSuppressed());
+  fprintf(stream, 
+    "# HELP pberr_dropped_total Number of errors dropped by the sink\n"
+    "# TYPE pberr_dropped_total counter\n"
+    "pberr_dropped_total %lu\n", PBErrSinkGetNbDropped());
+  fprintf(stream, 
+    "# HELP pberr_alloc_live_bytes Number of bytes allocated\n"
+    "# TYPE pberr_alloc_live_bytes gauge\n");
+  for (int iDomain = 0; iDomain < PBErrDomainNb; ++iDomain) {
+    PBErrAllocStat alloc;
+    PBErrAllocStatGet((PBErrDomain)iDomain, &alloc);
+    if (alloc._nbAlloc > 0)
+      fprintf(stream, "pberr_alloc_live_bytes{domain=\"%s\"} %lu\n",
+        PBErrDomainLbl[iDomain], alloc._live);
+  }
+  fprintf(stream, 
+    "# HELP pberr_allocs_total Number of allocations\n"
+    "# TYPE pberr_allocs_total counter\n");
+  for (int iDomain = 0; iDomain < PBErrDomainNb; ++iDomain) {
+    PBErrAllocStat alloc;
+    PBErrAllocStatGet((PBErrDomain)iDomain, &alloc);
+    if (alloc._nbAlloc > 0)
+      fprintf(stream, "pberr_allocs_total{domain=\"%s\"} %lu\n",
+        PBErrDomainLbl[iDomain], alloc._nbAlloc);
+  }
+}
+
+// Print the metrics as PBErrCountPrint into the file at 'path'. The
+// file is written aside and renamed
+// Return false if the file couldn't be written
+bool PBErrCountExport(const char* const path) {
+  if (path == NULL)
+    return false;
+  char pathTmp[PATH_MAX];
+  if (snprintf(pathTmp, PATH_MAX, "%s.tmp", path) >= PATH_MAX)
+    return false;
+  FILE* stream = fopen(pathTmp, "w");
+  if (stream == NULL)
+    return false;
+  PBErrCountPrint(stream);
+  bool ret = (ferror(stream) == 0);
+  if (fclose(stream) != 0)
+    ret = false;
+  if (ret && rename(pathTmp, path) != 0)
+    ret = false;
+  if (!ret)
+    remove(pathTmp);
+  return ret;
+}
+
+// Print the heap profile on 'stream' in the folded format (one line 
+// per stack, functions from the outermost to the innermost separated
+// by ';', then the estimated number of live bytes allocated from this
+// stack)
+// Return false if the heap profiler isn't started
+bool PBErrHeapProfDump(FILE* const stream) {
+  if (stream == NULL)
+    return false;
+  pthread_mutex_lock(&(PBErrHeap._mutex));
+  if (!atomic_load(&(PBErrHeap._active))) {
+    pthread_mutex_unlock(&(PBErrHeap._mutex));
+    return false;
+  }
+  unsigned long* bytes = calloc(PBERR_HEAPNBSTACK, 
+    sizeof(unsigned long));
+  PBErrProfLine* lines = malloc(sizeof(PBErrProfLine) * 
+    PBERR_HEAPNBSTACK);
+  bool ret = (bytes != NULL && lines != NULL);
+  if (ret) {
+    // The samples can't be inserted while the mutex is locked, only
+    // freed
+    for (int iSample = 0; iSample < PBERR_HEAPNBSAMPLE; ++iSample) {
+      const PBErrHeapSample* sample = PBErrHeap._samples + iSample;
+      uintptr_t ptr = 
+        atomic_load_explicit(&(sample->_ptr), memory_order_acquire);
+      if (ptr > PBERR_HEAPFREED)
+        bytes[sample->_iStack] += sample->_weight;
+    }
+    int nbLine = 0;
+    char line[PBERR_PROFSTACKHEIGHT * PBERR_SYMBOLLENGTHMAX];
+    for (int iStack = 0; iStack < PBERR_HEAPNBSTACK; ++iStack) {
+      const PBErrHeapStack* stack = PBErrHeap._stacks + iStack;
+      if (bytes[iStack] == 0 || stack->_height <= 0)
+        continue;
+      PBErrFoldedStack(stack->_stack, stack->_height, false, line, 
+        sizeof(line));
+      lines[nbLine]._line = strdup(line);
+      lines[nbLine]._nb = bytes[iStack];
+      if (lines[nbLine]._line != NULL)
+        ++nbLine;
+    }
+    PBErrFoldedPrint(stream, lines, nbLine);
+  }
+  pthread_mutex_unlock(&(PBErrHeap._mutex));
+  free(bytes);
+  free(lines);
+  return ret;
+}
+
+// Write the dump of the heap profile into the file at 'path'. The 
+// file is written aside and renamed
+// Return false if the file couldn't be written
+static bool PBErrHeapProfDumpFile(const char* const path) {
+  char pathTmp[PATH_MAX];
+  if (snprintf(pathTmp, PATH_MAX, "%s.tmp", path) >= PATH_MAX)
+    return false;
+  FILE* stream = fopen(pathTmp, "w");
+  if (stream == NULL)
+    return false;
+  bool ret = PBErrHeapProfDump(stream);
+  if (ferror(stream) != 0)
+    ret = false;
+  if (fclose(stream) != 0)
+    ret = false;
+  if (ret && rename(pathTmp, path) != 0)
+    ret = false;
+  if (!ret)
+    remove(pathTmp);
+  return ret;
+}
+
+// Handler of the signal requesting a dump of the heap profile
+static void PBErrHeapProfSignal(int sig) {
+  (void)sig;
+  atomic_store(&(PBErrHeap._dumpRequested), true);
+}
+
+// Request a dump of the heap profile into the file at 'path' when the
+// signal 'sig' is received
+// Return false if the handler couldn't be installed
+bool PBErrHeapProfDumpOnSignal(const int sig, const char* const path) {
+  if (path == NULL || strlen(path) >= PATH_MAX)
+    return false;
+  pthread_mutex_lock(&(PBErrHeap._mutex));
+  strcpy(PBErrHeap._dumpPath, path);
+  pthread_mutex_unlock(&(PBErrHeap._mutex));
+  struct sigaction act;
+  memset(&act, 0, sizeof(act));
+  act.sa_handler = PBErrHeapProfSignal;
+  sigemptyset(&(act.sa_mask));
+  act.sa_flags = SA_RESTART;
+  return (sigaction(sig, &act, NULL) == 0);
+}
+
+// Write the dump of the heap profile requested by signal, if any
+void PBErrHeapProfPoll(void) {
+  if (!atomic_load_explicit(&(PBErrHeap._dumpRequested), 
+    memory_order_relaxed) ||
+    !atomic_exchange(&(PBErrHeap._dumpRequested), false))
+    return;
+  char path[PATH_MAX];
+  pthread_mutex_lock(&(PBErrHeap._mutex));
+  strcpy(path, PBErrHeap._dumpPath);
+  pthread_mutex_unlock(&(PBErrHeap._mutex));
+  if (path[0] != '\0')
+    PBErrHeapProfDumpFile(path);
+}
+
+// Start the sampling heap profiler with one sample every 'rate' bytes
+// on average
+// Return false if it couldn't be started
+bool PBErrHeapProfStart(const size_t rate) {
+#if defined(PBERR_ALLOCSTAT)
+  if (rate == 0)
+    return false;
+  pthread_mutex_lock(&(PBErrHeap._mutex));
+  bool ret = !atomic_load(&(PBErrHeap._active));
+  if (ret && PBErrHeap._samples == NULL) {
+    PBErrHeap._samples = 
+      calloc(PBERR_HEAPNBSAMPLE, sizeof(PBErrHeapSample));
+    PBErrHeap._stacks = 
+      calloc(PBERR_HEAPNBSTACK, sizeof(PBErrHeapStack));
+    if (PBErrHeap._samples == NULL || PBErrHeap._stacks == NULL) {
+      free(PBErrHeap._samples);
+      free(PBErrHeap._stacks);
+      PBErrHeap._samples = NULL;
+      PBErrHeap._stacks = NULL;
+      ret = false;
+    }
+  }
+  if (ret) {
+    // Warm up the unwinder now rather than at the first sample
+    PBErrUnwindWarm();
+    atomic_store(&(PBErrHeap._rate), rate);
+    atomic_fetch_add(&(PBErrHeap._epoch), 1);
+    atomic_store(&(PBErrHeap._active), true);
+  }
+  pthread_mutex_unlock(&(PBErrHeap._mutex));
+  return ret;
+#else
+  (void)rate;
+  return false;
+#endif
+}
+
+// Stop the heap profiler and forget its live samples
+void PBErrHeapProfStop(void) {
+  pthread_mutex_lock(&(PBErrHeap._mutex));
+  atomic_store(&(PBErrHeap._active), false);
+  if (PBErrHeap._samples != NULL) {
+    // The samples may be freed concurrently, exchange them to count
+    // each one once
+    for (int iSample = 0; iSample < PBERR_HEAPNBSAMPLE; ++iSample) {
+      uintptr_t ptr = 
+        atomic_exchange(&(PBErrHeap._samples[iSample]._ptr), 0);
+      if (ptr > PBERR_HEAPFREED)
+        atomic_fetch_sub(&(PBErrHeap._nbLive), 1);
+    }
+    memset(PBErrHeap._stacks, 0, 
+      sizeof(PBErrHeapStack) * PBERR_HEAPNBSTACK);
+  }
+  pthread_mutex_unlock(&(PBErrHeap._mutex));
+}
+
+// Return the number of live samples of the heap profiler
+unsigned long PBErrHeapProfGetNbLive(void) {
+  return atomic_load(&(PBErrHeap._nbLive));
+}
+
+#if defined(PBERR_ALLOCSTAT)
+// Return the index of the home entry of the memory 'ptr' in the table
+// of live samples of the heap profiler
+static inline unsigned long PBErrHeapHome(const uintptr_t ptr) {
+  return (unsigned long)(((uint64_t)ptr * 11400714819323198485ull) >> 
+    32) & (PBERR_HEAPNBSAMPLE - 1);
+}
+
+// Return a random number uniformly distributed in ]0, 1] 
+// (xorshift64*)
+static double PBErrHeapRandom(void) {
+  if (PBErrHeapRand == 0)
+    PBErrHeapRand = (PBErrNow() ^ (uint64_t)(uintptr_t)&PBErrHeapRand) 
+      | 1;
+  PBErrHeapRand ^= PBErrHeapRand >> 12;
+  PBErrHeapRand ^= PBErrHeapRand << 25;
+  PBErrHeapRand ^= PBErrHeapRand >> 27;
+  uint64_t rnd = PBErrHeapRand * 2685821657736338717ull;
+  return ((double)(rnd >> 11) + 1.0) / 9007199254740992.0;
+}
+
+// Called when the countdown of the calling thread to its next sample
+// has expired at the allocation of the memory 'ptr' of 'size' bytes
+// Sample it if the heap profiler is started, and draw the next 
+// countdown
+static __attribute__((cold, noinline)) void PBErrHeapProfSample(
+  void* const ptr, const size_t size) {
+  PBErrHeapProfPoll();
+  if (!atomic_load_explicit(&(PBErrHeap._active), 
+    memory_order_relaxed)) {
+    PBErrHeapCountdown = PBERR_HEAPIDLE;
+    return;
+  }
+  // The sampled bytes are Bernoulli trials of probability 1/rate, the
+  // countdown to the next one follows a geometric distribution
+  double rate = (double)atomic_load_explicit(&(PBErrHeap._rate), 
+    memory_order_relaxed);
+  double next = -log(PBErrHeapRandom()) * rate;
+  PBErrHeapCountdown = (next < (double)LONG_MAX ? (long)next : LONG_MAX);
+  // If the thread has just noticed the start, this allocation wasn't
+  // drawn by the geometric distribution
+  unsigned long epoch = atomic_load_explicit(&(PBErrHeap._epoch), 
+    memory_order_relaxed);
+  if (epoch != PBErrHeapEpochCur) {
+    PBErrHeapEpochCur = epoch;
+    return;
+  }
+  // Unbiased estimate of the number of bytes represented by the sample
+  double sizeSample = (double)size;
+  unsigned long weight = 
+    (unsigned long)(sizeSample / (1.0 - exp(-sizeSample / rate)));
+  if (atomic_load_explicit(&PBErrUnwinderCur, memory_order_relaxed) ==
+    PBErrUnwinderFramePointer)
+    PBErrStackBoundsInit();
+  void* stack[PBERR_PROFSTACKHEIGHT];
+  int height = PBErrUnwind(stack, PBERR_PROFSTACKHEIGHT, 
+    PBERR_HEAPNBSKIP, NULL);
+  if (height <= 0)
+    return;
+  // FNV-1a hash of the stack, never 0 which marks the empty entries
+  unsigned long hash = 14695981039346656037ul;
+  for (int iAddr = 0; iAddr < height; ++iAddr) {
+    hash ^= (unsigned long)(stack[iAddr]);
+    hash *= 1099511628211ul;
+  }
+  if (hash == 0)
+    hash = 1;
+  pthread_mutex_lock(&(PBErrHeap._mutex));
+  if (!atomic_load(&(PBErrHeap._active))) {
+    pthread_mutex_unlock(&(PBErrHeap._mutex));
+    return;
+  }
+  // Two stacks with the same 64 bits hash are considered identical
+  int iStack = -1;
+  for (int iProbe = 0; iProbe < PBERR_HEAPNBSTACK && iStack < 0; 
+    ++iProbe) {
+    int iEntry = (int)((hash + (unsigned long)iProbe) & 
+      (PBERR_HEAPNBSTACK - 1));
+    PBErrHeapStack* entry = PBErrHeap._stacks + iEntry;
+    if (entry->_hash == 0) {
+      entry->_hash = hash;
+      entry->_height = height;
+      memcpy(entry->_stack, stack, 
+        sizeof(void*) * (size_t)height);
+    }
+    if (entry->_hash == hash)
+      iStack = iEntry;
+  }
+  // The sample is dropped if the tables are full
+  unsigned long iHome = PBErrHeapHome((uintptr_t)ptr);
+  for (int iProbe = 0; iProbe < PBERR_HEAPNBPROBE && iStack >= 0; 
+    ++iProbe) {
+    PBErrHeapSample* sample = PBErrHeap._samples + 
+      ((iHome + (unsigned long)iProbe) & (PBERR_HEAPNBSAMPLE - 1));
+    uintptr_t cur = 
+      atomic_load_explicit(&(sample->_ptr), memory_order_relaxed);
+    if (cur == 0 || cur == PBERR_HEAPFREED) {
+      sample->_weight = weight;
+      sample->_iStack = iStack;
+      atomic_store_explicit(&(sample->_ptr), (uintptr_t)ptr, 
+        memory_order_release);
+      atomic_fetch_add_explicit(&(PBErrHeap._nbLive), 1, 
+        memory_order_release);
+      break;
+    }
+  }
+  pthread_mutex_unlock(&(PBErrHeap._mutex));
+}
+
+// Forget the memory 'ptr' in the heap profiler if it's sampled
+static inline void PBErrHeapProfForget(const void* const ptr) {
+  if (atomic_load_explicit(&(PBErrHeap._nbLive), 
+    memory_order_acquire) == 0)
+    return;
+  unsigned long iHome = PBErrHeapHome((uintptr_t)ptr);
+  for (int iProbe = 0; iProbe < PBERR_HEAPNBPROBE; ++iProbe) {
+    PBErrHeapSample* sample = PBErrHeap._samples + 
+      ((iHome + (unsigned long)iProbe) & (PBERR_HEAPNBSAMPLE - 1));
+    uintptr_t cur = 
+      atomic_load_explicit(&(sample->_ptr), memory_order_relaxed);
+    if (cur == 0)
+      return;
+    if (cur == (uintptr_t)ptr) {
+      if (atomic_compare_exchange_strong_explicit(&(sample->_ptr), 
+        &cur, PBERR_HEAPFREED, memory_order_relaxed, 
+        memory_order_relaxed))
+        atomic_fetch_sub_explicit(&(PBErrHeap._nbLive), 1, 
+          memory_order_relaxed);
+      return;
+    }
+  }
+}
+
+// Return the index of the sample of the memory 'ptr' in the heap
+// profiler and set 'sample' to its content, or return -1 if it's not
+// sampled
+static inline long PBErrHeapProfFind(const void* const ptr,
+  uintptr_t* const sample) {
+  if (atomic_load_explicit(&(PBErrHeap._nbLive), 
+    memory_order_acquire) == 0)
+    return -1;
+  unsigned long iHome = PBErrHeapHome((uintptr_t)ptr);
+  for (int iProbe = 0; iProbe < PBERR_HEAPNBPROBE; ++iProbe) {
+    unsigned long iSample = 
+      (iHome + (unsigned long)iProbe) & (PBERR_HEAPNBSAMPLE - 1);
+    uintptr_t cur = atomic_load_explicit(
+      &(PBErrHeap._samples[iSample]._ptr), memory_order_relaxed);
+    if (cur == 0)
+      return -1;
+    if (cur == (uintptr_t)ptr) {
+      *sample = cur;
+      return (long)iSample;
+    }
+  }
+  return -1;
+}
+
+// Forget the sample 'iSample' found by PBErrHeapProfFind, if it still
+// holds 'sample'
+static inline void PBErrHeapProfForgetSample(const long iSample,
+  uintptr_t sample) {
+  if (iSample < 0)
+    return;
+  if (atomic_compare_exchange_strong_explicit(
+    &(PBErrHeap._samples[iSample]._ptr), &sample, PBERR_HEAPFREED, 
+    memory_order_relaxed, memory_order_relaxed))
+    atomic_fetch_sub_explicit(&(PBErrHeap._nbLive), 1, 
+      memory_order_relaxed);
+}
+#endif
+
+#if defined(PBERRALL) || defined(PBERRSAFEMALLOC)
+// Return the domain of the PBErr 'that' in the allocation statistics
+static inline PBErrDomain PBErrAllocDomain(const PBErr* const that) {
+  if (that == NULL || (int)(that->_domain) < 0 || 
+    that->_domain >= PBErrDomainNb)
+    return PBErrDomainPBErr;
+  return that->_domain;
+}
+#endif
+
+#if defined(PBERR_ALLOCSTAT)
+
+// Size class of an allocation of 'size' bytes
+static inline int PBErrAllocClass(const size_t size) {
+  int iClass = (size < 16 ? 0 : 
+    (int)(sizeof(unsigned long) * 8) - 
+    __builtin_clzl((unsigned long)size) - 4);
+  if (iClass >= PBERR_NBSIZECLASS)
+    iClass = PBERR_NBSIZECLASS - 1;
+  return iClass;
+}
+
+// Fold the allocation statistics 'local' of a thread into the ones
+// of the domains, and reset them
+static void PBErrAllocFoldLocal(PBErrAllocLocal* const local) {
+  uint64_t dirty = local->_dirty;
+  while (dirty != 0) {
+    int iDomain = __builtin_ctzll(dirty);
+    dirty &= dirty - 1;
+    PBErrAllocCounter* counter = PBErrAllocCounters + iDomain;
+    // The variation may be negative, the addition wraps around
+    unsigned long live = atomic_fetch_add_explicit(&(counter->_live), 
+      (unsigned long)(local->_live[iDomain]), memory_order_relaxed) + 
+      (unsigned long)(local->_live[iDomain]);
+    unsigned long peak = 
+      atomic_load_explicit(&(counter->_peak), memory_order_relaxed);
+    while ((long)live > 0 && live > peak && 
+      !atomic_compare_exchange_weak_explicit(&(counter->_peak), &peak,
+      live, memory_order_relaxed, memory_order_relaxed));
+    atomic_fetch_add_explicit(&(counter->_nbAlloc), 
+      local->_nbAlloc[iDomain], memory_order_relaxed);
+    atomic_fetch_add_explicit(&(counter->_nbFree), 
+      local->_nbFree[iDomain], memory_order_relaxed);
+    for (int iClass = 0; iClass < PBERR_NBSIZECLASS; ++iClass)
+      if (local->_hist[iDomain][iClass] != 0)
+        atomic_fetch_add_explicit(counter->_hist + iClass, 
+          local->_hist[iDomain][iClass], memory_order_relaxed);
+    local->_live[iDomain] = 0;
+    local->_nbAlloc[iDomain] = 0;
+    local->_nbFree[iDomain] = 0;
+    memset(local->_hist[iDomain], 0, 
+      sizeof(unsigned long) * PBERR_NBSIZECLASS);
+  }
+  local->_dirty = 0;
+}
+
+// Fold the allocation statistics of an exiting thread and release 
+// them
+static void PBErrAllocLocalRelease(void* const local) {
+  PBErrAllocFoldLocal(local);
+  free(local);
+  PBErrAllocLocalCur = NULL;
+}
+
+static void PBErrAllocKeyCreate(void) {
+  pthread_key_create(&PBErrAllocKey, PBErrAllocLocalRelease);
+}
+
+// Allocate the allocation statistics of the calling thread
+// Return null if they couldn't be allocated
+static __attribute__((cold, noinline)) PBErrAllocLocal* 
+  PBErrAllocLocalCreate(void) {
+  PBErrAllocLocal* local = calloc(1, sizeof(PBErrAllocLocal));
+  if (local == NULL)
+    return NULL;
+  pthread_once(&PBErrAllocKeyOnce, PBErrAllocKeyCreate);
+  pthread_setspecific(PBErrAllocKey, local);
+  PBErrAllocLocalCur = local;
+  return local;
+}
+
+static void PBErrAllocFold(const PBErrDomain domain) 
+  __attribute__((cold, noinline));
+
+// Return the allocation statistics of the calling thread, or null if
+// they couldn't be allocated, in which case the accounting is lost
+static inline PBErrAllocLocal* PBErrAllocLocalGet(void) {
+  PBErrAllocLocal* local = PBErrAllocLocalCur;
+  if (PBERR_UNLIKELY(local == NULL))
+    local = PBErrAllocLocalCreate();
+  return local;
+}
+
+// Account the allocation of 'size' bytes in the domain 'domain'
+static inline void PBErrAllocStatAdd(const PBErrDomain domain, 
+  const size_t size) {
+  PBErrAllocLocal* local = PBErrAllocLocalGet();
+  if (PBERR_UNLIKELY(local == NULL))
+    return;
+  local->_live[domain] += (long)size;
+  ++(local->_nbAlloc[domain]);
+  ++(local->_hist[domain][PBErrAllocClass(size)]);
+  local->_dirty |= (uint64_t)1 << domain;
+  PBErrAllocCountdown -= (long)size + PBERR_ALLOCOPCOST;
+  if (PBERR_UNLIKELY(PBErrAllocCountdown < 0))
+    PBErrAllocFold(domain);
+}
+
+// Account the free of 'size' bytes in the domain 'domain'
+static inline void PBErrAllocStatSub(const PBErrDomain domain, 
+  const size_t size) {
+  PBErrAllocLocal* local = PBErrAllocLocalGet();
+  if (PBERR_UNLIKELY(local == NULL))
+    return;
+  local->_live[domain] -= (long)size;
+  ++(local->_nbFree[domain]);
+  local->_dirty |= (uint64_t)1 << domain;
+  PBErrAllocCountdown -= (long)size + PBERR_ALLOCOPCOST;
+  if (PBERR_UNLIKELY(PBErrAllocCountdown < 0))
+    PBErrAllocFold(domain);
+}
+#endif
+
+#if defined(PBERRALL) || defined(PBERRSAFEMALLOC)
+// Size of the huge pages
+#define PBERR_HUGEPAGESIZE (2ul << 20)
+
+// Return the size of the mapping of 'size' bytes allocated with 
+// PBErrMallocHuge, 0 if it overflows
+static inline size_t PBErrHugeLength(const size_t size) {
+  if (size > SIZE_MAX - 2 * PBERR_HUGEPAGESIZE)
+    return 0;
+  return (size + PBERR_HUGEPAGESIZE - 1) & ~(PBERR_HUGEPAGESIZE - 1);
+}
+
+
+// Map 'len' bytes aligned on a huge page, 'len' being a multiple of
+// the size of the huge pages
+// Return null if it fails
+static void* PBErrHugeMap(const size_t len) {
+  // Map one more huge page to align the block on a huge page, and
+  // unmap the unused head and tail
+  size_t lenMap = len + PBERR_HUGEPAGESIZE;
+  char* map = mmap(NULL, lenMap, PROT_READ | PROT_WRITE, 
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED)
+    return NULL;
+  char* ptr = (char*)(((uintptr_t)map + PBERR_HUGEPAGESIZE - 1) & 
+    ~(uintptr_t)(PBERR_HUGEPAGESIZE - 1));
+  if (ptr > map)
+    munmap(map, (size_t)(ptr - map));
+  size_t lenTail = (size_t)((map + lenMap) - (ptr + len));
+  if (lenTail > 0)
+    munmap(ptr + len, lenTail);
+  return ptr;
+}
+#endif
+
+// Register the reclaim callback 'fun' with 'data' for the domain
+// 'domain' and priority 'priority'
+// Return false if there are already PBERR_NBMAXRECLAIM callbacks
+bool PBErrReclaimAdd(const PBErrDomain domain, const int priority,
+  const PBErrReclaimFun fun, void* const data) {
+  if (fun == NULL || (int)domain < 0 || domain >= PBErrDomainNb)
+    return false;
+  pthread_mutex_lock(&(PBErrReclaimReg._mutex));
+  bool ret = (PBErrReclaimReg._nb < PBERR_NBMAXRECLAIM);
+  if (ret) {
+    int iEntry = PBErrReclaimReg._nb;
+    while (iEntry > 0 && 
+      PBErrReclaimReg._entries[iEntry - 1]._priority < priority) {
+      PBErrReclaimReg._entries[iEntry] = 
+        PBErrReclaimReg._entries[iEntry - 1];
+      --iEntry;
+    }
+    PBErrReclaimEntry* entry = PBErrReclaimReg._entries + iEntry;
+    entry->_domain = domain;
+    entry->_priority = priority;
+    entry->_fun = fun;
+    entry->_data = data;
+    ++(PBErrReclaimReg._nb);
+  }
+  pthread_mutex_unlock(&(PBErrReclaimReg._mutex));
+  return ret;
+}
+
+// Unregister the reclaim callback 'fun' with 'data'
+// Return false if it wasn't registered
+bool PBErrReclaimRemove(const PBErrReclaimFun fun, void* const data) {
+  pthread_mutex_lock(&(PBErrReclaimReg._mutex));
+  bool ret = false;
+  for (int iEntry = 0; iEntry < PBErrReclaimReg._nb && !ret; 
+    ++iEntry) {
+    PBErrReclaimEntry* entry = PBErrReclaimReg._entries + iEntry;
+    if (entry->_fun == fun && entry->_data == data) {
+      memmove(entry, entry + 1, sizeof(PBErrReclaimEntry) * 
+        (size_t)(PBErrReclaimReg._nb - iEntry - 1));
+      --(PBErrReclaimReg._nb);
+      ret = true;
+    }
+  }
+  pthread_mutex_unlock(&(PBErrReclaimReg._mutex));
+  return ret;
+}
+
+// Copy into 'entries' the reclaim callbacks in their calling order:
+// the ones of 'domain' first, then the other ones, each in decreasing
+// order of priority. They are copied so that they can be called 
+// without holding the lock
+// Return the number of callbacks
+static int PBErrReclaimOrder(const PBErrDomain domain,
+  PBErrReclaimEntry* const entries) {
+  int nb = 0;
+  pthread_mutex_lock(&(PBErrReclaimReg._mutex));
+  for (int iPass = 0; iPass < 2; ++iPass)
+    for (int iEntry = 0; iEntry < PBErrReclaimReg._nb; ++iEntry) {
+      const PBErrReclaimEntry* entry = 
+        PBErrReclaimReg._entries + iEntry;
+      if ((entry->_domain == domain) == (iPass == 0))
+        entries[nb++] = *entry;
+    }
+  pthread_mutex_unlock(&(PBErrReclaimReg._mutex));
+  return nb;
+}
+
+// Call the reclaim callbacks, the ones of 'domain' first, until 'size'
+// bytes are released
+// Return the number of bytes released
+size_t PBErrReclaim(const PBErrDomain domain, const size_t size) {
+  if (PBErrReclaiming)
+    return 0;
+  PBErrReclaiming = true;
+  PBErrReclaimEntry entries[PBERR_NBMAXRECLAIM];
+  int nb = PBErrReclaimOrder(domain, entries);
+  size_t released = 0;
+  for (int iEntry = 0; iEntry < nb && released < size; ++iEntry)
+    released += entries[iEntry]._fun(size - released, 
+      entries[iEntry]._data);
+  PBErrReclaiming = false;
+  return released;
+}
+
+// Set the soft budget of live bytes allocated with the PBErrMalloc
+// functions to 'budget' (0 to disable it)
+// Return false if the allocations are not accounted
+bool PBErrReclaimSetBudget(const size_t budget) {
+#if defined(PBERR_ALLOCSTAT)
+  atomic_store(&(PBErrReclaimReg._budget), budget);
+  return true;
+#else
+  (void)budget;
+  return false;
+#endif
+}
+
+#if defined(PBERR_ALLOCSTAT)
+// Called when the countdown of the calling thread to its next fold
+// has expired. Fold its allocation statistics, then if the live bytes
+// of all the domains exceed the budget, call the reclaim callbacks 
+// (the ones of 'domain' first) to release the excess
+static void PBErrAllocFold(const PBErrDomain domain) {
+  PBErrAllocCountdown = PBERR_ALLOCFOLD;
+  if (PBErrAllocLocalCur != NULL)
+    PBErrAllocFoldLocal(PBErrAllocLocalCur);
+  unsigned long budget = atomic_load_explicit(
+    &(PBErrReclaimReg._budget), memory_order_relaxed);
+  if (budget == 0)
+    return;
+  unsigned long live = 0;
+  for (int iDomain = 0; iDomain < PBErrDomainNb; ++iDomain)
+    live += atomic_load_explicit(&(PBErrAllocCounters[iDomain]._live),
+      memory_order_relaxed);
+  // Only one thread calls the callbacks, the other ones go on
+  if ((long)live <= 0 || live <= budget || 
+    atomic_flag_test_and_set(&(PBErrReclaimReg._busy)))
+    return;
+  PBErrReclaim(domain, live - budget);
+  atomic_flag_clear(&(PBErrReclaimReg._busy));
+}
+#endif
+
+#if defined(PBERRALL) || defined(PBERRSAFEMALLOC)
+// Call the reclaim callbacks and retry the allocation which failed
+// with 'fail' after each callback releasing memory. 'ptr' is the 
+// memory to realloc, 'arg' the alignment or number of elements
+// Return the allocated memory, or null if it still fails
+void* _PBErrReclaimRetry(PBErr* const that, const PBErrFail fail,
+  void* const ptr, const size_t arg, const size_t size) {
+  // An overflowing calloc can't succeed
+  if (PBErrReclaiming || 
+    (fail == PBErrFailCalloc && size != 0 && arg > SIZE_MAX / size))
+    return NULL;
+  size_t sizeTotal = (fail == PBErrFailCalloc ? arg * size : size);
+  PBErrReclaiming = true;
+  PBErrReclaimEntry entries[PBERR_NBMAXRECLAIM];
+  int nb = PBErrReclaimOrder(PBErrAllocDomain(that), entries);
+  void* ret = NULL;
+  for (int iEntry = 0; iEntry < nb && ret == NULL; ++iEntry) {
+    if (entries[iEntry]._fun(sizeTotal, entries[iEntry]._data) == 0)
+      continue;
+    switch (fail) {
+      case PBErrFailMalloc:
+        ret = malloc(size);
+        break;
+      case PBErrFailMallocAligned:
+        if (posix_memalign(&ret, arg, size) != 0)
+          ret = NULL;
+        break;
+      case PBErrFailCalloc:
+        ret = calloc(arg, size);
+        break;
+      case PBErrFailRealloc:
+        ret = realloc(ptr, size);
+        break;
+      case PBErrFailMallocHuge:
+        ret = PBErrHugeMap(size);
+        break;
+      default:
+        break;
+    }
+  }
+  PBErrReclaiming = false;
+  return ret;
+}
+#endif
+
+// Account the allocation of 'ptr' in the statistics of the domain
+// of 'that', in the heap profiler and for the budget
+#if defined(PBERR_ALLOCSTAT)
+void _PBErrAllocStatAdd(const PBErr* const that, 
+  void* const ptr) {
+  size_t size = malloc_usable_size(ptr);
+  // Sample before accounting, so that the sampling isn't a tail call 
+  // and the stack has the expected frames
+  PBErrHeapCountdown -= (long)size;
+  if (PBERR_UNLIKELY(PBErrHeapCountdown < 0))
+    PBErrHeapProfSample(ptr, size);
+  PBErrAllocStatAdd(PBErrAllocDomain(that), size);
+}
+
+// Account the free of 'ptr' in the statistics of the domain of 'that'
+// and in the heap profiler
+void _PBErrAllocStatSub(const PBErr* const that, 
+  void* const ptr) {
+  PBErrAllocStatSub(PBErrAllocDomain(that), malloc_usable_size(ptr));
+  PBErrHeapProfForget(ptr);
+}
+
+// Account the realloc of a memory of 'sizeOld' bytes into 'ptr' in
+// the statistics of the domain of 'that', as a free and an allocation.
+// The old memory is forgotten in the heap profiler with its sample
+// 'iSample' holding 'sample', as looked up by _PBErrAllocStatPeek
+void _PBErrAllocStatResize(const PBErr* const that, const long iSample,
+  const uintptr_t sample, const size_t sizeOld, void* const ptr) {
+  PBErrHeapProfForgetSample(iSample, sample);
+  PBErrAllocStatSub(PBErrAllocDomain(that), sizeOld);
+  _PBErrAllocStatAdd(that, ptr);
+}
+
+// Return the usable size of the memory 'ptr', and set 'iSample' and 
+// 'sample' to the index and content of its sample in the heap 
+// profiler, or -1 if it's not sampled. Nothing is modified, so the
+// memory is still correctly accounted if its realloc fails
+size_t _PBErrAllocStatPeek(void* const ptr, long* const iSample, 
+  uintptr_t* const sample) {
+  *iSample = PBErrHeapProfFind(ptr, sample);
+  return malloc_usable_size(ptr);
+}
+#endif
+
+#if defined(PBERRALL) || defined(PBERRSAFEMALLOC)
+// Allocate 'size' bytes with mmap, aligned on a huge page and advised
+// to use transparent huge pages
+void* PBErrMallocHuge(PBErr* const that, const size_t size) {
+  size_t len = PBErrHugeLength(size);
+  char* ptr = NULL;
+  if (len > 0) {
+    ptr = PBErrHugeMap(len);
+    if (ptr == NULL)
+      ptr = _PBErrReclaimRetry(that, PBErrFailMallocHuge, NULL, 0, len);
+  }
+  if (ptr == NULL) {
+    PBErrFailed(that, PBErrFailMallocHuge, NULL, size);
+    return NULL;
+  }
+  // If transparent huge pages are unavailable the advice fails and
+  // the block uses normal pages
+  madvise(ptr, len, MADV_HUGEPAGE);
+#if defined(PBERR_ALLOCSTAT)
+  PBErrAllocStatAdd(PBErrAllocDomain(that), len);
+#endif
+  return ptr;
+}
+
+// Free the memory 'ptr' of 'size' bytes allocated with 
+// PBErrMallocHuge
+void PBErrFreeHuge(PBErr* const that, void* const ptr, 
+  const size_t size) {
+  if (ptr == NULL)
+    return;
+  size_t len = PBErrHugeLength(size);
+#if defined(PBERR_ALLOCSTAT)
+  PBErrAllocStatSub(PBErrAllocDomain(that), len);
+#else
+  (void)that;
+#endif
+  munmap(ptr, len);
+}
+#endif
+
+// Secured I/O
+#if defined(PBERRALL) || defined(PBERRSAFEIO)
+
+FILE* PBErrOpenStreamIn(PBErr* const that, const char* const path) {
+#if BUILDMODE == 0
+  if (that == NULL) {
+    PBErrRaise(that, PBErrTypeNullPointer, true, "'that' is null");
+  }
+  if (path == NULL) {
+    PBErrRaise(that, PBErrTypeNullPointer, true, "'path' is null");
+  }
+#endif
+  FILE* fd = fopen(path, "r");
+  if (fd == NULL) {
+    PBErrRaise(that, PBErrTypeIOError, false,
+      "fopen failed for %s", path);
+  }
+  return fd;
+}
+
+FILE* PBErrOpenStreamOut(PBErr* const that, const char* const path) {
+#if BUILDMODE == 0
+  if (that == NULL) {
+    PBErrRaise(that, PBErrTypeNullPointer, true, "'that' is null");
+  }
+  if (path == NULL) {
+    PBErrRaise(that, PBErrTypeNullPointer, true, "'path' is null");
+  }
+#endif
+  FILE* fd = fopen(path, "w");
+  if (fd == NULL) {
+    PBErrRaise(that, PBErrTypeIOError, false,
+      "fopen failed for %s", path);
+  }
+  return fd;
+}
+
+void PBErrCloseStream(PBErr* const that, FILE* const fd) {
+#if BUILDMODE == 0
+  if (that == NULL) {
+    PBErrRaise(that, PBErrTypeNullPointer, true, "'that' is null");
+  }
+  if (fd == NULL) {
+    PBErrRaise(that, PBErrTypeNullPointer, true, "'fd' is null");
+  }
+#endif
+  if (fclose(fd) != 0) {
+    PBErrRaise(that, PBErrTypeIOError, false, "fclose failed");
+  }
+}
+
+// Size in bytes of each of the two buffers of an asynchronous output
+// stream
+#define PBERR_ASYNCBUFSIZE 1048576
+
+// Data of an asynchronous output stream, the cookie of its FILE
+typedef struct PBErrAsyncOut {
+  // PBErr the data and buffers are accounted in
+  PBErr* _err;
+  // File descriptor of the file
+  int _fd;
+  // Buffers, following the data in the same allocation, one filled
+  // by the user while the other one is written
+  char* _buf[2];
+  // Number of bytes in each buffer
+  size_t _len[2];
+  // Index of the buffer filled by the user
+  int _cur;
+  // Flag raised while the other buffer waits or is being written
+  bool _isPending;
+  // Flag to request the writer to stop
+  bool _stop;
+  // errno of the last write failure of the writer, 0 if none
+  int _errno;
+  // Mutex and condition synchronizing the user and the writer
+  pthread_mutex_t _mutex;
+  pthread_cond_t _cond;
+  // Writer thread
+  pthread_t _writer;
+} PBErrAsyncOut;
+
+// Main function of the writer thread of an asynchronous output stream
+static void* PBErrAsyncOutWriter(void* arg) {
+  PBErrAsyncOut* that = arg;
+  pthread_mutex_lock(&(that->_mutex));
+  while (true) {
+    while (!that->_isPending && !that->_stop)
+      pthread_cond_wait(&(that->_cond), &(that->_mutex));
+    if (!that->_isPending)
+      break;
+    int iBuf = 1 - that->_cur;
+    pthread_mutex_unlock(&(that->_mutex));
+    const char* ptr = that->_buf[iBuf];
+    size_t len = that->_len[iBuf];
+    int err = 0;
+    while (len > 0 && err == 0) {
+      ssize_t nb = write(that->_fd, ptr, len);
+      if (nb < 0 && errno != EINTR) {
+        err = errno;
+      } else if (nb > 0) {
+        ptr += nb;
+        len -= (size_t)nb;
+      }
+    }
+    pthread_mutex_lock(&(that->_mutex));
+    if (err != 0)
+      that->_errno = err;
+    that->_len[iBuf] = 0;
+    that->_isPending = false;
+    pthread_cond_broadcast(&(that->_cond));
+  }
+  pthread_mutex_unlock(&(that->_mutex));
+  return NULL;
+}
+
+// Hand over the current buffer of 'that' to the writer and swap the
+// buffers, waiting first for the writer to be done with the other one
+// Must be called with the mutex locked
+static void PBErrAsyncOutSwap(PBErrAsyncOut* const that) {
+  while (that->_isPending)
+    pthread_cond_wait(&(that->_cond), &(that->_mutex));
+  that->_isPending = true;
+  that->_cur = 1 - that->_cur;
+  pthread_cond_broadcast(&(that->_cond));
+}
+
+// Write callback of an asynchronous output stream
+// Copy the data into the current buffer, swapping the buffers when 
+// it's full
+// Fail if a previous write of the writer has failed
+static ssize_t PBErrAsyncOutWrite(void* cookie, const char* data, 
+  size_t size) {
+  PBErrAsyncOut* that = cookie;
+  pthread_mutex_lock(&(that->_mutex));
+  if (that->_errno != 0) {
+    errno = that->_errno;
+    pthread_mutex_unlock(&(that->_mutex));
+    return -1;
+  }
+  size_t done = 0;
+  while (done < size) {
+    size_t space = PBERR_ASYNCBUFSIZE - that->_len[that->_cur];
+    size_t nb = (size - done < space ? size - done : space);
+    memcpy(that->_buf[that->_cur] + that->_len[that->_cur], 
+      data + done, nb);
+    that->_len[that->_cur] += nb;
+    done += nb;
+    if (that->_len[that->_cur] == PBERR_ASYNCBUFSIZE)
+      PBErrAsyncOutSwap(that);
+  }
+  pthread_mutex_unlock(&(that->_mutex));
+  return (ssize_t)size;
+}
+
+// Close callback of an asynchronous output stream
+// Write the remaining data, stop the writer and close the file
+// Fail if a write of the writer has failed
+static int PBErrAsyncOutClose(void* cookie) {
+  PBErrAsyncOut* that = cookie;
+  pthread_mutex_lock(&(that->_mutex));
+  if (that->_len[that->_cur] > 0)
+    PBErrAsyncOutSwap(that);
+  that->_stop = true;
+  pthread_cond_broadcast(&(that->_cond));
+  pthread_mutex_unlock(&(that->_mutex));
+  pthread_join(that->_writer, NULL);
+  int ret = 0;
+  if (that->_errno != 0) {
+    errno = that->_errno;
+    ret = -1;
+  }
+  if (close(that->_fd) != 0)
+    ret = -1;
+  pthread_mutex_destroy(&(that->_mutex));
+  pthread_cond_destroy(&(that->_cond));
+  PBErrFree(that->_err, that);
+  return ret;
+}
+
+// Open an output stream whose writes are buffered in memory and
+// written to the file by a background thread, closed with
+// PBErrCloseStream
+// The stream uses two buffers: when the one filled by the user is 
+// full, it's handed over to the writer thread and the user continues
+// with the other one. A failure of the writer is reported by the 
+// following write or by the close of the stream
+FILE* PBErrOpenStreamOutAsync(PBErr* const that, 
+  const char* const path) {
+#if BUILDMODE == 0
+  if (that == NULL) {
+    PBErrRaise(that, PBErrTypeNullPointer, true, "'that' is null");
+  }
+  if (path == NULL) {
+    PBErrRaise(that, PBErrTypeNullPointer, true, "'path' is null");
+  }
+#endif
+  // The data and the buffers are allocated at once, before opening
+  // the file, so a failure doesn't leak the file descriptor. They are
+  // accounted in the domain of 'that' through its default PBErr, 
+  // which is still valid when the stream is closed
+  PBErr* err = PBErrDomainDefault(that->_domain);
+  PBErrAsyncOut* async = 
+    PBErrMalloc(err, sizeof(PBErrAsyncOut) + 2 * PBERR_ASYNCBUFSIZE);
+  if (async == NULL)
+    return NULL;
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd == -1) {
+    PBErrFree(err, async);
+    PBErrRaise(that, PBErrTypeIOError, false,
+      "open failed for %s", path);
+    return NULL;
+  }
+  async->_err = err;
+  async->_buf[0] = (char*)(async + 1);
+  async->_buf[1] = async->_buf[0] + PBERR_ASYNCBUFSIZE;
+  async->_fd = fd;
+  async->_len[0] = async->_len[1] = 0;
+  async->_cur = 0;
+  async->_isPending = false;
+  async->_stop = false;
+  async->_errno = 0;
+  pthread_mutex_init(&(async->_mutex), NULL);
+  pthread_cond_init(&(async->_cond), NULL);
+  cookie_io_functions_t funs = {.read = NULL, 
+    .write = PBErrAsyncOutWrite, .seek = NULL, 
+    .close = PBErrAsyncOutClose};
+  FILE* stream = NULL;
+  if (pthread_create(&(async->_writer), NULL, PBErrAsyncOutWriter, 
+    async) == 0) {
+    stream = fopencookie(async, "w", funs);
+    if (stream == NULL)
+      PBErrAsyncOutClose(async);
+  } else {
+    close(fd);
+    pthread_mutex_destroy(&(async->_mutex));
+    pthread_cond_destroy(&(async->_cond));
+    PBErrFree(err, async);
+  }
+  if (stream == NULL) {
+    PBErrRaise(that, PBErrTypeIOError, false,
+      "can't create the stream for %s", path);
+  }
+  return stream;
+}
+
+// Maximum number of directories synced once per group commit, the
+// other ones are synced once per stream
+#define PBERR_SYNCNBDIR 16
+
+// Data of a durable output stream, the cookie of its FILE
+typedef struct PBErrDurableOut {
+  // File descriptor of the temporary file
+  int _fd;
+  // errno of the first failure, 0 if none
+  int _errno;
+  // Destination path, and path of the temporary file, stored after
+  // the structure
+  char* _path;
+  char* _pathTmp;
+  // Next stream in the queue of the syncer
+  struct PBErrDurableOut* _next;
+} PBErrDurableOut;
+
+// Group commit syncer of the durable output streams
+typedef struct PBErrSyncer {
+  pthread_mutex_t _mutex;
+  // Signaled when streams are queued, and when a group is committed
+  pthread_cond_t _cond;
+  // Queue of the closed streams waiting to be committed
+  PBErrDurableOut* _head;
+  PBErrDurableOut** _tail;
+  // Number of streams queued, and committed or failed, so far
+  unsigned long _nbQueued;
+  unsigned long _nbDone;
+  // Number of failures since the last PBErrDurableSync, and the 
+  // first of them
+  unsigned long _nbFailed;
+  int _failedErrno;
+  char _failedPath[PATH_MAX];
+  // Number of temporary files created so far, to name them
+  atomic_ulong _nbTmp;
+  // Flag raised once the syncer thread is running
+  bool _isRunning;
+} PBErrSyncer;
+
+static PBErrSyncer PBErrSync = {._mutex = PTHREAD_MUTEX_INITIALIZER,
+  ._cond = PTHREAD_COND_INITIALIZER, ._tail = &(PBErrSync._head)};
+static pthread_once_t PBErrSyncOnce = PTHREAD_ONCE_INIT;
+
+// Directory synced by a group commit
+typedef struct PBErrSyncDir {
+  // Path of the directory, as the first '_len' characters of '_path'
+  const char* _path;
+  size_t _len;
+  // errno of the failure of its sync, 0 if none
+  int _errno;
+} PBErrSyncDir;
+
+// Sync the directory containing the file at 'path', made of its 
+// first 'len' characters ("." if 'len' is 0)
+// Return 0, or the errno of the failure
+static int PBErrSyncDirectory(const char* const path, const size_t len) {
+  char dir[PATH_MAX];
+  if (len == 0)
+    strcpy(dir, ".");
+  else
+    snprintf(dir, PATH_MAX, "%.*s", (int)len, path);
+  int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd == -1)
+    return errno;
+  int ret = (fsync(fd) != 0 ? errno : 0);
+  close(fd);
+  return ret;
+}
+
+// Commit the streams of the group 'group': start the writeback of all
+// of them, then wait for their data, rename them, and sync once each
+// directory containing them
+static void PBErrSyncCommit(PBErrDurableOut* const group) {
+  for (PBErrDurableOut* s = group; s != NULL; s = s->_next)
+    sync_file_range(s->_fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+  for (PBErrDurableOut* s = group; s != NULL; s = s->_next) {
+    if (s->_errno == 0 && fdatasync(s->_fd) != 0)
+      s->_errno = errno;
+    if (close(s->_fd) != 0 && s->_errno == 0)
+      s->_errno = errno;
+    if (s->_errno == 0 && rename(s->_pathTmp, s->_path) != 0)
+      s->_errno = errno;
+    if (s->_errno != 0)
+      unlink(s->_pathTmp);
+  }
+  // The renames are durable once their directories are synced
+  PBErrSyncDir dirs[PBERR_SYNCNBDIR];
+  int nbDir = 0;
+  for (PBErrDurableOut* s = group; s != NULL; s = s->_next) {
+    if (s->_errno != 0)
+      continue;
+    const char* slash = strrchr(s->_path, '/');
+    size_t len = (slash == NULL ? 0 : 
+      (slash == s->_path ? 1 : (size_t)(slash - s->_path)));
+    int iDir = 0;
+    while (iDir < nbDir && (dirs[iDir]._len != len || 
+      strncmp(dirs[iDir]._path, s->_path, len) != 0))
+      ++iDir;
+    if (iDir < nbDir) {
+      s->_errno = dirs[iDir]._errno;
+    } else {
+      s->_errno = PBErrSyncDirectory(s->_path, len);
+      if (nbDir < PBERR_SYNCNBDIR) {
+        dirs[nbDir]._path = s->_path;
+        dirs[nbDir]._len = len;
+        dirs[nbDir]._errno = s->_errno;
+        ++nbDir;
+      }
+    }
+  }
+}
+
+// Main function of the syncer thread: commit at once all the streams
+// closed while the previous group was being committed
+static void* PBErrSyncMain(void* arg) {
+  (void)arg;
+  pthread_mutex_lock(&(PBErrSync._mutex));
+  while (true) {
+    while (PBErrSync._head == NULL)
+      pthread_cond_wait(&(PBErrSync._cond), &(PBErrSync._mutex));
+    PBErrDurableOut* group = PBErrSync._head;
+    PBErrSync._head = NULL;
+    PBErrSync._tail = &(PBErrSync._head);
+    pthread_mutex_unlock(&(PBErrSync._mutex));
+    PBErrSyncCommit(group);
+    pthread_mutex_lock(&(PBErrSync._mutex));
+    while (group != NULL) {
+      PBErrDurableOut* s = group;
+      group = group->_next;
+      if (s->_errno != 0) {
+        if (PBErrSync._nbFailed == 0) {
+          PBErrSync._failedErrno = s->_errno;
+          snprintf(PBErrSync._failedPath, PATH_MAX, "%s", s->_path);
+        }
+        ++(PBErrSync._nbFailed);
+      }
+      ++(PBErrSync._nbDone);
+      free(s);
+    }
+    pthread_cond_broadcast(&(PBErrSync._cond));
+  }
+  return NULL;
+}
+
+// Wait until the durable streams closed so far are committed
+static void PBErrSyncWait(void) {
+  pthread_mutex_lock(&(PBErrSync._mutex));
+  unsigned long nbQueued = PBErrSync._nbQueued;
+  while (PBErrSync._nbDone < nbQueued)
+    pthread_cond_wait(&(PBErrSync._cond), &(PBErrSync._mutex));
+  pthread_mutex_unlock(&(PBErrSync._mutex));
+}
+
+// Start the syncer thread, the streams closed but not yet committed
+// are committed before the process exits
+static void PBErrSyncStart(void) {
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, PBErrSyncMain, NULL) != 0)
+    return;
+  pthread_detach(thread);
+  PBErrSync._isRunning = true;
+  atexit(PBErrSyncWait);
+}
+
+// Write callback of a durable output stream
+// Fail if a previous write has failed
+static ssize_t PBErrDurableOutWrite(void* cookie, const char* data, 
+  size_t size) {
+  PBErrDurableOut* that = cookie;
+  size_t done = 0;
+  while (done < size && that->_errno == 0) {
+    ssize_t nb = write(that->_fd, data + done, size - done);
+    if (nb < 0 && errno != EINTR)
+      that->_errno = errno;
+    else if (nb > 0)
+      done += (size_t)nb;
+  }
+  if (that->_errno != 0) {
+    errno = that->_errno;
+    return -1;
+  }
+  return (ssize_t)size;
+}
+
+// Close callback of a durable output stream
+// Queue the stream for the syncer, or discard it if a write has 
+// failed
+static int PBErrDurableOutClose(void* cookie) {
+  PBErrDurableOut* that = cookie;
+  if (that->_errno != 0) {
+    close(that->_fd);
+    unlink(that->_pathTmp);
+    errno = that->_errno;
+    free(that);
+    return -1;
+  }
+  that->_next = NULL;
+  pthread_mutex_lock(&(PBErrSync._mutex));
+  *(PBErrSync._tail) = that;
+  PBErrSync._tail = &(that->_next);
+  ++(PBErrSync._nbQueued);
+  pthread_cond_broadcast(&(PBErrSync._cond));
+  pthread_mutex_unlock(&(PBErrSync._mutex));
+  return 0;
+}
+
+// Open a durable output stream: the data is written into a temporary
+// file next to 'path', renamed as 'path' once it's durable
+// PBErrCloseStream queues the stream for the syncer thread, which
+// commits as a group all the streams closed while it was committing
+// the previous group: their writeback is started at once, then their
+// data is synced and they are renamed, and each of their directories
+// is synced once. The failures are reported by PBErrDurableSync
+FILE* PBErrOpenStreamOutDurable(PBErr* const that, 
+  const char* const path) {
+#if BUILDMODE == 0
+  if (that == NULL) {
+    PBErrRaise(that, PBErrTypeNullPointer, true, "'that' is null");
+  }
+  if (path == NULL) {
+    PBErrRaise(that, PBErrTypeNullPointer, true, "'path' is null");
+  }
+#endif
+  pthread_once(&PBErrSyncOnce, PBErrSyncStart);
+  if (!PBErrSync._isRunning) {
+    PBErrRaise(that, PBErrTypeIOError, false,
+      "can't start the syncer for %s", path);
+    return NULL;
+  }
+  size_t len = strlen(path);
+  size_t lenTmp = len + 64;
+  // Not allocated with PBErrMalloc, it's freed by the syncer thread
+  // whose frees would stay in its own batch of the statistics
+  size_t size = sizeof(PBErrDurableOut) + len + 1 + lenTmp;
+  PBErrDurableOut* durable = malloc(size);
+  if (durable == NULL) {
+    PBErrRaise(that, PBErrTypeMallocFailed, true,
+      "malloc of %lu bytes failed for %s", (unsigned long)size, path);
+    return NULL;
+  }
+  durable->_path = (char*)(durable + 1);
+  durable->_pathTmp = durable->_path + len + 1;
+  memcpy(durable->_path, path, len + 1);
+  snprintf(durable->_pathTmp, lenTmp, "%s.%d.%lu.tmp", path, 
+    (int)getpid(), atomic_fetch_add(&(PBErrSync._nbTmp), 1));
+  durable->_errno = 0;
+  durable->_fd = open(durable->_pathTmp, 
+    O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+  if (durable->_fd == -1) {
+    free(durable);
+    PBErrRaise(that, PBErrTypeIOError, false,
+      "open failed for %s", path);
+    return NULL;
+  }
+  cookie_io_functions_t funs = {.read = NULL, 
+    .write = PBErrDurableOutWrite, .seek = NULL, 
+    .close = PBErrDurableOutClose};
+  FILE* stream = fopencookie(durable, "w", funs);
+  if (stream == NULL) {
+    close(durable->_fd);
+    unlink(durable->_pathTmp);
+    free(durable);
+    PBErrRaise(that, PBErrTypeIOError, false,
+      "can't create the stream for %s", path);
+  }
+  return stream;
+}
+
+// Wait until the durable streams closed so far are committed. The
+// failures since the previous call are raised as one non fatal 
+// IOError through 'that'
+// Return false if there were failures
+bool PBErrDurableSync(PBErr* const that) {
+#if BUILDMODE == 0
+  if (that == NULL) {
+    PBErrRaise(that, PBErrTypeNullPointer, true, "'that' is null");
+  }
+#endif
+  PBErrSyncWait();
+  pthread_mutex_lock(&(PBErrSync._mutex));
+  unsigned long nbFailed = PBErrSync._nbFailed;
+  int err = PBErrSync._failedErrno;
+  char path[PATH_MAX];
+  strcpy(path, PBErrSync._failedPath);
+  PBErrSync._nbFailed = 0;
+  pthread_mutex_unlock(&(PBErrSync._mutex));
+  if (nbFailed > 0) {
+    PBErrRaise(that, PBErrTypeIOError, false,
+      "durable write failed for %s (%s), %lu failure(s)", path, 
+      strerror(err), nbFailed);
+    return false;
+  }
+  return true;
+}
+
+
+
+// Fast parsers of whitespace separated values in memory
+
+// Return true if 'c' is a whitespace as for isspace in the C locale
+static inline bool PBErrIsSpace(const char c) {
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// Move the cursor 'cur' to the first non whitespace character before
+// 'end'
+static inline const char* PBErrSkipSpace(const char* cur, 
+  const char* const end) {
+  while (cur < end && PBErrIsSpace(*cur))
+    ++cur;
+  return cur;
+}
+
+// Parse a decimal integer at the cursor 'cur' before 'end'
+// On success, set 'val', move the cursor after the integer and 
+// return true. Return false if there is no integer at the cursor
+// or it overflows
+static bool PBErrParseLong(const char** const cur, 
+  const char* const end, long* const val) {
+  const char* ptr = *cur;
+  bool neg = false;
+  if (ptr < end && (*ptr == '-' || *ptr == '+')) {
+    neg = (*ptr == '-');
+    ++ptr;
+  }
+  const char* start = ptr;
+  unsigned long acc = 0;
+  while (ptr < end && *ptr >= '0' && *ptr <= '9') {
+    unsigned long digit = (unsigned long)(*ptr - '0');
+    if (acc > (ULONG_MAX - digit) / 10)
+      return false;
+    acc = acc * 10 + digit;
+    ++ptr;
+  }
+  if (ptr == start || acc > (unsigned long)LONG_MAX + (neg ? 1 : 0))
+    return false;
+  *val = (neg ? (long)(0UL - acc) : (long)acc);
+  *cur = ptr;
+  return true;
+}
+
+// Parse a float at the cursor 'cur' before 'end' with strtof
+// Used for the cases not handled by PBErrParseFloat
+static bool PBErrParseFloatSlow(const char** const cur, 
+  const char* const end, float* const val) {
+  char token[64];
+  size_t len = 0;
+  while (*cur + len < end && len < sizeof(token) - 1 && 
+    !PBErrIsSpace((*cur)[len])) {
+    token[len] = (*cur)[len];
+    ++len;
+  }
+  token[len] = '\0';
+  char* tokenEnd = NULL;
+  float v = strtof(token, &tokenEnd);
+  if (tokenEnd == token)
+    return false;
+  *val = v;
+  *cur += tokenEnd - token;
+  return true;
+}
+
+// Parse a float at the cursor 'cur' before 'end'
+// On success, set 'val', move the cursor after the float and 
+// return true. Return false if there is no float at the cursor
+// The mantissa is accumulated in an integer and scaled by an exact
+// power of 10, other cases (big exponents, inf, nan, hexadecimal)
+// fall back to strtof
+static bool PBErrParseFloat(const char** const cur, 
+  const char* const end, float* const val) {
+  static const double pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+  const char* ptr = *cur;
+  bool neg = false;
+  if (ptr < end && (*ptr == '-' || *ptr == '+')) {
+    neg = (*ptr == '-');
+    ++ptr;
+  }
+  unsigned long mant = 0;
+  int exp10 = 0;
+  bool isDigit = false;
+  while (ptr < end && *ptr >= '0' && *ptr <= '9') {
+    if (mant < 100000000000000000UL)
+      mant = mant * 10 + (unsigned long)(*ptr - '0');
+    else
+      ++exp10;
+    isDigit = true;
+    ++ptr;
+  }
+  if (ptr < end && *ptr == '.') {
+    ++ptr;
+    while (ptr < end && *ptr >= '0' && *ptr <= '9') {
+      if (mant < 100000000000000000UL) {
+        mant = mant * 10 + (unsigned long)(*ptr - '0');
+        --exp10;
+      }
+      isDigit = true;
+      ++ptr;
+    }
+  }
+  if (!isDigit || (ptr < end && (*ptr == 'x' || *ptr == 'X')))
+    return PBErrParseFloatSlow(cur, end, val);
+  if (ptr < end && (*ptr == 'e' || *ptr == 'E')) {
+    const char* ptrExp = ptr + 1;
+    long e = 0;
+    if (PBErrParseLong(&ptrExp, end, &e)) {
+      if (e > 1000 || e < -1000)
+        return PBErrParseFloatSlow(cur, end, val);
+      exp10 += (int)e;
+      ptr = ptrExp;
+    }
+  }
+  if (exp10 < -22 || exp10 > 22)
+    return PBErrParseFloatSlow(cur, end, val);
+  double v = (double)mant;
+  if (exp10 < 0)
+    v /= pow10[-exp10];
+  else
+    v *= pow10[exp10];
+  *val = (float)(neg ? -v : v);
+  *cur = ptr;
+  return true;
+}
+
+// Copy the token at the cursor 'cur' before 'end' into 'data' and
+// move the cursor after it
+static void PBErrParseStr(const char** const cur, 
+  const char* const end, char* const data) {
+  const char* ptr = *cur;
+  while (ptr < end && !PBErrIsSpace(*ptr))
+    ++ptr;
+  memcpy(data, *cur, (size_t)(ptr - *cur));
+  data[ptr - *cur] = '\0';
+  *cur = ptr;
+}
+
+PBErrMap* PBErrOpenMapIn(PBErr* const that, const char* const path) {
+#if BUILDMODE == 0
+  if (that == NULL) {
+    PBErrRaise(that, PBErrTypeNullPointer, true, "'that' is null");
+  }
+  if (path == NULL) {
+    PBErrRaise(that, PBErrTypeNullPointer, true, "'path' is null");
+  }
+#endif
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd == -1 || fstat(fd, &st) != 0) {
+    if (fd != -1)
+      close(fd);
+    PBErrRaise(that, PBErrTypeIOError, false,
+      "open failed for %s", path);
+    return NULL;
+  }
+  const char* data = NULL;
+  if (st.st_size > 0) {
+    data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, 
+      fd, 0);
+    if (data == MAP_FAILED) {
+      close(fd);
+      PBErrRaise(that, PBErrTypeIOError, false,
+        "mmap failed for %s", path);
+      return NULL;
+    }
+    madvise((void*)data, (size_t)st.st_size, MADV_SEQUENTIAL);
+  }
+  // The mapping stays valid after closing the file descriptor
+  close(fd);
+  PBErrMap* map = PBErrMalloc(that, sizeof(PBErrMap));
+  map->_data = data;
+  map->_size = (size_t)st.st_size;
+  map->_pos = 0;
+  return map;
+}
+
+void PBErrCloseMap(PBErr* const that, PBErrMap* const map) {
+#if BUILDMODE == 0
+  if (that == NULL) {
+    PBErrRaise(that, PBErrTypeNullPointer, true, "'that' is null");
+  }
+  if (map == NULL) {
+    PBErrRaise(that, PBErrTypeNullPointer, true, "'map' is null");
+  }
+#endif
+  if (map->_data != NULL)
+    munmap((void*)(map->_data), map->_size);
+  PBErrFree(that, map);
+}
+
+// Skip the whitespaces in the map 'map' and return the cursor on the
+// next value, or null if the end of the map is reached, in which case
+// the error is reported as fscanf returning EOF would be
+static const char* PBErrScanfMapNext(PBErr* const that, 
+  PBErrMap* const map, const void* const data) {
+#if BUILDMODE == 0
+  if (that == NULL) {
+    PBErrRaise(that, PBErrTypeNullPointer, true, "'that' is null\n");
+  }
+  if (map == NULL) {
+    PBErrRaise(that, PBErrTypeNullPointer, true, "'map' is null\n");
+  }
+  if (data == NULL) {
+    PBErrRaise(that, PBErrTypeNullPointer, true, "'data' is null\n");
+  }
+#else
+  (void)data;
+#endif
+  const char* end = map->_data + map->_size;
+  const char* cur = PBErrSkipSpace(map->_data + map->_pos, end);
+  map->_pos = (size_t)(cur - map->_data);
+  if (cur >= end) {
+    PBErrRaise(that, PBErrTypeIOError, false, "end of map reached\n");
+    return NULL;
+  }
+  return cur;
+}
+
+// Report the invalid value at the position 'pos' in a map
+static void PBErrScanfMapInvalid(PBErr* const that, const size_t pos) {
+  PBErrRaise(that, PBErrTypeInvalidData, false,
+    "invalid value at offset %lu\n", (unsigned long)pos);
+}
+
+bool _PBErrScanfMapShort(PBErr* const that, 
+  PBErrMap* const map, short* const data) {
+  const char* cur = PBErrScanfMapNext(that, map, data);
+  if (cur == NULL)
+    return false;
+  long v = 0;
+  if (!PBErrParseLong(&cur, map->_data + map->_size, &v) ||
+    v < SHRT_MIN || v > SHRT_MAX) {
+    PBErrScanfMapInvalid(that, map->_pos);
+    return false;
+  }
+  *data = (short)v;
+  map->_pos = (size_t)(cur - map->_data);
+  return true;
+}
+
+bool _PBErrScanfMapInt(PBErr* const that, 
+  PBErrMap* const map, int* const data) {
+  const char* cur = PBErrScanfMapNext(that, map, data);
+  if (cur == NULL)
+    return false;
+  long v = 0;
+  if (!PBErrParseLong(&cur, map->_data + map->_size, &v) ||
+    v < INT_MIN || v > INT_MAX) {
+    PBErrScanfMapInvalid(that, map->_pos);
+    return false;
+  }
+  *data = (int)v;
+  map->_pos = (size_t)(cur - map->_data);
+  return true;
+}
+
+bool _PBErrScanfMapFloat(PBErr* const that, 
+  PBErrMap* const map, float* const data) {
+  const char* cur = PBErrScanfMapNext(that, map, data);
+  if (cur == NULL)
+    return false;
+  if (!PBErrParseFloat(&cur, map->_data + map->_size, data)) {
+    PBErrScanfMapInvalid(that, map->_pos);
+    return false;
+  }
+  map->_pos = (size_t)(cur - map->_data);
+  return true;
+}
+
+bool _PBErrScanfMapStr(PBErr* const that, 
+  PBErrMap* const map, char* const data) {
+  const char* cur = PBErrScanfMapNext(that, map, data);
+  if (cur == NULL)
+    return false;
+  PBErrParseStr(&cur, map->_data + map->_size, data);
+  map->_pos = (size_t)(cur - map->_data);
+  return true;
+}
+
+// Bulk array I/O
+
+// Types of the arrays of the bulk I/O
+typedef enum PBErrArrayType {
+  PBErrArrayTypeShort,
+  PBErrArrayTypeInt,
+  PBErrArrayTypeLong,
+  PBErrArrayTypeFloat
+} PBErrArrayType;
+
+// Size in bytes of the chunks written at once by PBErrPrintfArray
+#define PBERR_ARRAYCHUNKSIZE 65536
+
+// Maximum length of a value read by PBErrScanfArray
+#define PBERR_ARRAYTOKENLENGTHMAX 64
+
+// Check the arguments of the bulk I/O, once per array
+static void PBErrArrayCheck(PBErr* const that, 
+  const FILE* const stream, const char* const format, 
+  const void* const data) {
 #if BUILDMODE == 0
   if (that == NULL) {
-    that->_type = PBErrTypeNullPointer;
-    sprintf(that->_msg, "'that' is null\n");
-    that->_fatal = true;
-    PBErrCatch(that);
+    PBErrRaise(that, PBErrTypeNullPointer, true, "'that' is null\n");
   }
   if (stream == NULL) {
-    that->_type = PBErrTypeNullPointer;
-    sprintf(that->_msg, "'stream' is null\n");
-    that->_fatal = true;
-    PBErrCatch(that);
+    PBErrRaise(that, PBErrTypeNullPointer, true, "'stream' is null\n");
   }
   if (format == NULL) {
-    that->_type = PBErrTypeNullPointer;
-    sprintf(that->_msg, "'format' is null\n");
-    that->_fatal = true;
-    PBErrCatch(that);
+    PBErrRaise(that, PBErrTypeNullPointer, true, "'format' is null\n");
+  }
+  if (data == NULL) {
+    PBErrRaise(that, PBErrTypeNullPointer, true, "'data' is null\n");
   }
+#else
+  (void)that;
+  (void)stream;
+  (void)format;
+  (void)data;
 #endif
-  // Print to the stream
-  if (fprintf(stream, format, data) < 0) {
-    that->_type = PBErrTypeIOError;
-    sprintf(that->_msg, "fprintf failed\n");
-    that->_fatal = false;
-    PBErrCatch(that);
+}
+
+// Split the format 'format' around its conversion, memorized in
+// 'conv' (without the '%'), and memorize the text before and after
+// in 'prefix' and 'suffix'
+// Return true if the format contains exactly one conversion and no
+// flag, width or precision
+static bool PBErrFormatSplit(const char* const format, 
+  const char** const prefix, size_t* const lenPrefix, 
+  char* const conv, const char** const suffix) {
+  const char* percent = strchr(format, '%');
+  if (percent == NULL)
+    return false;
+  const char* ptr = percent + 1;
+  size_t lenConv = 0;
+  while (*ptr == 'h' || *ptr == 'l')
+    conv[lenConv++] = *(ptr++);
+  if (lenConv > 1 || strchr("dief", *ptr) == NULL || *ptr == '\0')
+    return false;
+  conv[lenConv++] = *(ptr++);
+  conv[lenConv] = '\0';
+  if (strchr(ptr, '%') != NULL)
+    return false;
+  *prefix = format;
+  *lenPrefix = (size_t)(percent - format);
+  *suffix = ptr;
+  return true;
+}
+
+// Write the decimal representation of 'val' at 'buf' and return the
+// number of characters written (at most 20)
+// The digits are produced two at a time from a lookup table
+static size_t PBErrLongToStr(const long val, char* const buf) {
+  static const char digits[] =
+    "00010203040506070809101112131415161718192021222324252627282930"
+    "31323334353637383940414243444546474849505152535455565758596061"
+    "62636465666768697071727374757677787980818283848586878889909192"
+    "93949596979899";
+  char tmp[20];
+  char* ptr = tmp + sizeof(tmp);
+  unsigned long u = (val < 0 ? 0UL - (unsigned long)val : 
+    (unsigned long)val);
+  while (u >= 100) {
+    unsigned long i = (u % 100) * 2;
+    u /= 100;
+    *(--ptr) = digits[i + 1];
+    *(--ptr) = digits[i];
+  }
+  if (u >= 10) {
+    *(--ptr) = digits[u * 2 + 1];
+    *(--ptr) = digits[u * 2];
+  } else {
+    *(--ptr) = (char)('0' + u);
+  }
+  size_t len = 0;
+  if (val < 0)
+    buf[len++] = '-';
+  memcpy(buf + len, ptr, (size_t)(tmp + sizeof(tmp) - ptr));
+  return len + (size_t)(tmp + sizeof(tmp) - ptr);
+}
+
+// Return the 'iVal'-th value of the array 'data' of type 'type' as a
+// long
+static inline long PBErrArrayGetLong(const void* const data, 
+  const PBErrArrayType type, const size_t iVal) {
+  switch (type) {
+    case PBErrArrayTypeShort:
+      return ((const short*)data)[iVal];
+    case PBErrArrayTypeInt:
+      return ((const int*)data)[iVal];
+    default:
+      return ((const long*)data)[iVal];
+  }
+}
+
+// Print the 'nb' values of the array 'data' of type 'type' on
+// 'stream' with the format 'format'
+// The values are formatted into a chunk written at once. Integers
+// with a plain %d, %i (or their h and l variants) are converted
+// without printf
+static bool PBErrPrintfArrayAny(PBErr* const that, FILE* const stream, 
+  const char* const format, const void* const data, const size_t nb,
+  const PBErrArrayType type) {
+  PBErrArrayCheck(that, stream, format, data);
+  const char* prefix = NULL;
+  const char* suffix = NULL;
+  size_t lenPrefix = 0;
+  char conv[3];
+  bool isFast = type != PBErrArrayTypeFloat &&
+    PBErrFormatSplit(format, &prefix, &lenPrefix, conv, &suffix) &&
+    conv[strlen(conv) - 1] != 'f';
+  size_t lenSuffix = (isFast ? strlen(suffix) : 0);
+  char chunk[PBERR_ARRAYCHUNKSIZE];
+  size_t lenChunk = 0;
+  size_t iFirst = 0;
+  for (size_t iVal = 0; iVal < nb; ++iVal) {
+    size_t lenMax = PBERR_ARRAYCHUNKSIZE - lenChunk;
+    size_t len = 0;
+    if (isFast && lenPrefix + lenSuffix + 20 <= lenMax) {
+      memcpy(chunk + lenChunk, prefix, lenPrefix);
+      len = lenPrefix;
+      len += PBErrLongToStr(PBErrArrayGetLong(data, type, iVal), 
+        chunk + lenChunk + len);
+      memcpy(chunk + lenChunk + len, suffix, lenSuffix);
+      len += lenSuffix;
+    } else if (!isFast) {
+      int ret = 0;
+      if (type == PBErrArrayTypeFloat)
+        ret = snprintf(chunk + lenChunk, lenMax, format, 
+          ((const float*)data)[iVal]);
+      else if (type == PBErrArrayTypeLong)
+        ret = snprintf(chunk + lenChunk, lenMax, format, 
+          ((const long*)data)[iVal]);
+      else
+        ret = snprintf(chunk + lenChunk, lenMax, format, 
+          (int)PBErrArrayGetLong(data, type, iVal));
+      if (ret < 0) {
+        PBErrRaise(that, PBErrTypeInvalidArg, false,
+          "snprintf failed at index %lu\n", (unsigned long)iVal);
+        return false;
+      }
+      len = (size_t)ret;
+    } else {
+      // Force the flush of the chunk
+      len = lenMax;
+    }
+    // If the value didn't fit in the chunk, flush the chunk and 
+    // format the value again
+    if (len >= lenMax) {
+      if (lenChunk == 0) {
+        PBErrRaise(that, PBErrTypeInvalidArg, false,
+          "format too long at index %lu\n", (unsigned long)iVal);
+        return false;
+      }
+      if (fwrite(chunk, 1, lenChunk, stream) != lenChunk) {
+        PBErrRaise(that, PBErrTypeIOError, false,
+          "fwrite failed at index %lu\n", (unsigned long)iFirst);
+        return false;
+      }
+      lenChunk = 0;
+      iFirst = iVal;
+      --iVal;
+      continue;
+    }
+    lenChunk += len;
+  }
+  if (lenChunk > 0 && fwrite(chunk, 1, lenChunk, stream) != lenChunk) {
+    PBErrRaise(that, PBErrTypeIOError, false,
+      "fwrite failed at index %lu\n", (unsigned long)iFirst);
+    return false;
+  }
+  return true;
+}
+
+bool _PBErrPrintfArrayShort(PBErr* const that, FILE* const stream,
+  const char* const format, const short* const data, 
+  const size_t nb) {
+  return PBErrPrintfArrayAny(that, stream, format, data, nb, 
+    PBErrArrayTypeShort);
+}
+
+bool _PBErrPrintfArrayInt(PBErr* const that, FILE* const stream,
+  const char* const format, const int* const data, const size_t nb) {
+  return PBErrPrintfArrayAny(that, stream, format, data, nb, 
+    PBErrArrayTypeInt);
+}
+
+bool _PBErrPrintfArrayLong(PBErr* const that, FILE* const stream,
+  const char* const format, const long* const data, const size_t nb) {
+  return PBErrPrintfArrayAny(that, stream, format, data, nb, 
+    PBErrArrayTypeLong);
+}
+
+bool _PBErrPrintfArrayFloat(PBErr* const that, FILE* const stream,
+  const char* const format, const float* const data, 
+  const size_t nb) {
+  return PBErrPrintfArrayAny(that, stream, format, data, nb, 
+    PBErrArrayTypeFloat);
+}
+
+// Read the next whitespace separated token of 'stream' into 'token'
+// of size PBERR_ARRAYTOKENLENGTHMAX, or into an allocated buffer if
+// it's longer, and set its length in 'len' (0 if the end of the 
+// stream is reached). The token is null terminated
+// The stream must be locked by the caller
+// Return 'token', the allocated buffer which must be freed by the 
+// caller, or null if it couldn't be allocated
+static char* PBErrReadToken(FILE* const stream, char* const token,
+  size_t* const len) {
+  int c = getc_unlocked(stream);
+  while (c != EOF && PBErrIsSpace((char)c))
+    c = getc_unlocked(stream);
+  char* buf = token;
+  size_t size = PBERR_ARRAYTOKENLENGTHMAX;
+  *len = 0;
+  while (c != EOF && !PBErrIsSpace((char)c)) {
+    if (*len == size - 1) {
+      char* bufLong = malloc(size * 2);
+      if (bufLong == NULL) {
+        if (buf != token)
+          free(buf);
+        return NULL;
+      }
+      memcpy(bufLong, buf, *len);
+      if (buf != token)
+        free(buf);
+      buf = bufLong;
+      size *= 2;
+    }
+    buf[(*len)++] = (char)c;
+    c = getc_unlocked(stream);
+  }
+  // Give back the whitespace ending the token, as fscanf does
+  if (c != EOF)
+    ungetc(c, stream);
+  buf[*len] = '\0';
+  return buf;
+}
+
+// Store the value 'val' as the 'iVal'-th value of the array 'data' of
+// type 'type'
+// Return false if the value is out of the range of the type
+static inline bool PBErrArraySetLong(void* const data, 
+  const PBErrArrayType type, const size_t iVal, const long val) {
+  switch (type) {
+    case PBErrArrayTypeShort:
+      if (val < SHRT_MIN || val > SHRT_MAX)
+        return false;
+      ((short*)data)[iVal] = (short)val;
+      return true;
+    case PBErrArrayTypeInt:
+      if (val < INT_MIN || val > INT_MAX)
+        return false;
+      ((int*)data)[iVal] = (int)val;
+      return true;
+    default:
+      ((long*)data)[iVal] = val;
+      return true;
+  }
+}
+
+// Read 'nb' values of type 'type' into the array 'data' from 'stream' 
+// with the format 'format'
+// If the format is a single conversion surrounded by whitespaces, the
+// stream is locked once and the values are parsed without scanf, else
+// fscanf is used per value
+static bool PBErrScanfArrayAny(PBErr* const that, FILE* const stream, 
+  const char* const format, void* const data, const size_t nb,
+  const PBErrArrayType type) {
+  PBErrArrayCheck(that, stream, format, data);
+  const char* prefix = NULL;
+  const char* suffix = NULL;
+  size_t lenPrefix = 0;
+  char conv[3];
+  bool isFast = 
+    PBErrFormatSplit(format, &prefix, &lenPrefix, conv, &suffix);
+  for (size_t iChar = 0; isFast && iChar < lenPrefix; ++iChar)
+    isFast = PBErrIsSpace(prefix[iChar]);
+  for (size_t iChar = 0; isFast && suffix[iChar] != '\0'; ++iChar)
+    isFast = PBErrIsSpace(suffix[iChar]);
+  char spec = conv[strlen(conv) - 1];
+  if (isFast)
+    isFast = (type == PBErrArrayTypeFloat ? spec == 'f' : spec != 'f');
+  flockfile(stream);
+  PBErrType errType = PBErrTypeUnknown;
+  size_t iVal = 0;
+  for (; iVal < nb && errType == PBErrTypeUnknown; ++iVal) {
+    if (!isFast) {
+      void* ptr = (char*)data + iVal * (type == PBErrArrayTypeShort ?
+        sizeof(short) : type == PBErrArrayTypeInt ? sizeof(int) : 
+        type == PBErrArrayTypeLong ? sizeof(long) : sizeof(float));
+      if (fscanf(stream, format, ptr) == EOF)
+        errType = PBErrTypeIOError;
+      continue;
+    }
+    char tokenShort[PBERR_ARRAYTOKENLENGTHMAX];
+    size_t len = 0;
+    char* token = PBErrReadToken(stream, tokenShort, &len);
+    if (token == NULL) {
+      errType = PBErrTypeMallocFailed;
+      continue;
+    }
+    if (len == 0) {
+      errType = PBErrTypeIOError;
+      continue;
+    }
+    const char* cur = token;
+    bool ret = false;
+    if (type == PBErrArrayTypeFloat && token == tokenShort) {
+      ret = PBErrParseFloat(&cur, token + len, (float*)data + iVal);
+    } else if (type == PBErrArrayTypeFloat) {
+      // Long tokens (zero padding, many digits) are parsed like fscanf
+      // does
+      char* end = NULL;
+      ((float*)data)[iVal] = strtof(token, &end);
+      cur = end;
+      ret = (end != token);
+    } else if (spec == 'i' || token != tokenShort) {
+      // %i accepts the octal and hexadecimal notations
+      char* end = NULL;
+      errno = 0;
+      long val = strtol(token, &end, (spec == 'i' ? 0 : 10));
+      cur = end;
+      ret = (end != token && errno == 0 && 
+        PBErrArraySetLong(data, type, iVal, val));
+    } else {
+      long val = 0;
+      ret = PBErrParseLong(&cur, token + len, &val) &&
+        PBErrArraySetLong(data, type, iVal, val);
+    }
+    if (!ret || cur != token + len)
+      errType = PBErrTypeInvalidData;
+    if (token != tokenShort)
+      free(token);
+  }
+  funlockfile(stream);
+  if (errType != PBErrTypeUnknown) {
+    PBErrRaise(that, errType, false,
+      "%s at index %lu\n", 
+      (errType == PBErrTypeIOError ? "fscanf failed" : 
+      errType == PBErrTypeMallocFailed ? "malloc failed" : 
+      "invalid value"),
+      (unsigned long)(iVal - 1));
     return false;
   }
   return true;
 }
 
+bool _PBErrScanfArrayShort(PBErr* const that, FILE* const stream,
+  const char* const format, short* const data, const size_t nb) {
+  return PBErrScanfArrayAny(that, stream, format, data, nb, 
+    PBErrArrayTypeShort);
+}
+
+bool _PBErrScanfArrayInt(PBErr* const that, FILE* const stream,
+  const char* const format, int* const data, const size_t nb) {
+  return PBErrScanfArrayAny(that, stream, format, data, nb, 
+    PBErrArrayTypeInt);
+}
+
+bool _PBErrScanfArrayLong(PBErr* const that, FILE* const stream,
+  const char* const format, long* const data, const size_t nb) {
+  return PBErrScanfArrayAny(that, stream, format, data, nb, 
+    PBErrArrayTypeLong);
+}
+
+bool _PBErrScanfArrayFloat(PBErr* const that, FILE* const stream,
+  const char* const format, float* const data, const size_t nb) {
+  return PBErrScanfArrayAny(that, stream, format, data, nb, 
+    PBErrArrayTypeFloat);
+}
+
+// Binary serialization
+
+// Magic number at the head of binary files
+#define PBERR_BINMAGIC "PBEB"
+
+// Flags of the tag of a block
+#define PBERR_BINTAGARRAY 0x40
+#define PBERR_BINTAGCRC 0x80
+#define PBERR_BINTAGTYPE 0x0F
+
+// Types of the blocks
+typedef enum PBErrBinType {
+  PBErrBinTypeShort = 1,
+  PBErrBinTypeInt,
+  PBErrBinTypeLong,
+  PBErrBinTypeFloat,
+  PBErrBinTypeChar
+} PBErrBinType;
+
+// Size in bytes of one value of each type of block, in the file
+static const size_t PBErrBinTypeSize[] = {0, 2, 4, 8, 4, 1};
+
+// Table for the computation of CRC32 (IEEE 802.3)
+static uint32_t PBErrCRCTable[256];
+static pthread_once_t PBErrCRCTableOnce = PTHREAD_ONCE_INIT;
+
+// Initialise the table for the computation of CRC32
+static void PBErrCRCTableInit(void) {
+  for (uint32_t i = 0; i < 256; ++i) {
+    uint32_t crc = i;
+    for (int iBit = 0; iBit < 8; ++iBit)
+      crc = (crc >> 1) ^ (0xEDB88320U & (0U - (crc & 1U)));
+    PBErrCRCTable[i] = crc;
+  }
+}
+
+// Update the CRC32 'crc' with the 'nb' bytes 'data'
+static uint32_t PBErrCRC(uint32_t crc, const void* const data, 
+  const size_t nb) {
+  const unsigned char* bytes = data;
+  crc = ~crc;
+  for (size_t iByte = 0; iByte < nb; ++iByte)
+    crc = PBErrCRCTable[(crc ^ bytes[iByte]) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
+
+// Convert in place the 'nb' values of 'size' bytes in 'data' between 
+// the host order and little endian
+static inline void PBErrBinToLE(void* const data, const size_t size,
+  const size_t nb) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  unsigned char* bytes = data;
+  for (size_t iVal = 0; iVal < nb; ++iVal, bytes += size)
+    for (size_t iByte = 0; iByte < size / 2; ++iByte) {
+      unsigned char tmp = bytes[iByte];
+      bytes[iByte] = bytes[size - 1 - iByte];
+      bytes[size - 1 - iByte] = tmp;
+    }
+#else
+  (void)data;
+  (void)size;
+  (void)nb;
+#endif
+}
+
+// Report the I/O error 'msg'
+static bool PBErrBinIOError(PBErr* const that, const char* const msg) {
+  PBErrRaise(that, PBErrTypeIOError, false, "%s\n", msg);
+  return false;
+}
+
+// Report the invalid data 'msg'
+static bool PBErrBinInvalid(PBErr* const that, const char* const msg) {
+  PBErrRaise(that, PBErrTypeInvalidData, false, "%s\n", msg);
+  return false;
+}
+
+// Write the header of a binary file: magic number, version, 
+// endianness of the data and 4 reserved bytes
+bool PBErrBinWriteHeader(PBErr* const that, FILE* const stream) {
+  PBErrArrayCheck(that, stream, "", stream);
+  unsigned char header[12] = {0};
+  memcpy(header, PBERR_BINMAGIC, 4);
+  header[4] = PBERR_BINVERSION;
+  header[5] = 'L';
+  if (fwrite(header, 1, sizeof(header), stream) != sizeof(header))
+    return PBErrBinIOError(that, "fwrite failed for the header");
+  return true;
+}
+
+// Read and check the header of a binary file
+bool PBErrBinReadHeader(PBErr* const that, FILE* const stream) {
+  PBErrArrayCheck(that, stream, "", stream);
+  unsigned char header[12];
+  if (fread(header, 1, sizeof(header), stream) != sizeof(header))
+    return PBErrBinIOError(that, "fread failed for the header");
+  if (memcmp(header, PBERR_BINMAGIC, 4) != 0)
+    return PBErrBinInvalid(that, "invalid magic number");
+  if (header[4] == 0 || header[4] > PBERR_BINVERSION)
+    return PBErrBinInvalid(that, "unsupported version");
+  if (header[5] != 'L')
+    return PBErrBinInvalid(that, "unsupported endianness");
+  return true;
+}
+
+// Write a block of 'nb' values of type 'type' from 'data' (in the
+// file representation and host order), as an array if 'isArray', 
+// followed by its CRC if 'crc'
+static bool PBErrBinWriteBlock(PBErr* const that, FILE* const stream,
+  const PBErrBinType type, const bool isArray, const bool crc,
+  const void* const data, const size_t nb) {
+  PBErrArrayCheck(that, stream, "", data);
+  size_t size = PBErrBinTypeSize[type];
+  unsigned char head[9];
+  size_t lenHead = 1;
+  head[0] = (unsigned char)type | (isArray ? PBERR_BINTAGARRAY : 0) |
+    (crc ? PBERR_BINTAGCRC : 0);
+  if (isArray) {
+    uint64_t nbLE = nb;
+    PBErrBinToLE(&nbLE, sizeof(nbLE), 1);
+    memcpy(head + 1, &nbLE, sizeof(nbLE));
+    lenHead += sizeof(nbLE);
+  }
+  if (fwrite(head, 1, lenHead, stream) != lenHead)
+    return PBErrBinIOError(that, "fwrite failed for a block head");
+  uint32_t sum = 0;
+  if (crc) {
+    pthread_once(&PBErrCRCTableOnce, PBErrCRCTableInit);
+    sum = PBErrCRC(0, head, lenHead);
+  }
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  // Convert by chunks to little endian
+  unsigned char chunk[PBERR_ARRAYCHUNKSIZE];
+  size_t nbPerChunk = PBERR_ARRAYCHUNKSIZE / size;
+  for (size_t iVal = 0; iVal < nb; iVal += nbPerChunk) {
+    size_t nbVal = (nb - iVal < nbPerChunk ? nb - iVal : nbPerChunk);
+    memcpy(chunk, (const unsigned char*)data + iVal * size, 
+      nbVal * size);
+    PBErrBinToLE(chunk, size, nbVal);
+    if (crc)
+      sum = PBErrCRC(sum, chunk, nbVal * size);
+    if (fwrite(chunk, size, nbVal, stream) != nbVal)
+      return PBErrBinIOError(that, "fwrite failed for a block");
+  }
+#else
+  if (crc)
+    sum = PBErrCRC(sum, data, nb * size);
+  if (fwrite(data, size, nb, stream) != nb)
+    return PBErrBinIOError(that, "fwrite failed for a block");
 #endif
+  if (crc) {
+    PBErrBinToLE(&sum, sizeof(sum), 1);
+    if (fwrite(&sum, sizeof(sum), 1, stream) != 1)
+      return PBErrBinIOError(that, "fwrite failed for a CRC");
+  }
+  return true;
+}
+
+// Read a block of type 'type' into 'data', as an array if 'isArray'
+// If 'isStr' the block may contain up to 'nb' - 1 values and 'data' 
+// is null terminated, else it must contain exactly 'nb' values
+static bool PBErrBinReadBlock(PBErr* const that, FILE* const stream,
+  const PBErrBinType type, const bool isArray, const bool isStr,
+  void* const data, const size_t nb) {
+  PBErrArrayCheck(that, stream, "", data);
+  size_t size = PBErrBinTypeSize[type];
+  unsigned char head[9];
+  if (fread(head, 1, 1, stream) != 1)
+    return PBErrBinIOError(that, "fread failed for a block head");
+  if ((head[0] & PBERR_BINTAGTYPE) != type ||
+    ((head[0] & PBERR_BINTAGARRAY) != 0) != isArray)
+    return PBErrBinInvalid(that, "unexpected type of block");
+  bool crc = ((head[0] & PBERR_BINTAGCRC) != 0);
+  size_t lenHead = 1;
+  size_t nbVal = nb;
+  if (isArray) {
+    uint64_t nbLE = 0;
+    if (fread(head + 1, sizeof(nbLE), 1, stream) != 1)
+      return PBErrBinIOError(that, "fread failed for a block head");
+    memcpy(&nbLE, head + 1, sizeof(nbLE));
+    PBErrBinToLE(&nbLE, sizeof(nbLE), 1);
+    lenHead += sizeof(nbLE);
+    if ((isStr && nbLE >= nb) || (!isStr && nbLE != nb))
+      return PBErrBinInvalid(that, "unexpected size of block");
+    nbVal = (size_t)nbLE;
+  }
+  if (fread(data, size, nbVal, stream) != nbVal)
+    return PBErrBinIOError(that, "fread failed for a block");
+  if (crc) {
+    pthread_once(&PBErrCRCTableOnce, PBErrCRCTableInit);
+    uint32_t sum = PBErrCRC(PBErrCRC(0, head, lenHead), data, 
+      nbVal * size);
+    uint32_t sumFile = 0;
+    if (fread(&sumFile, sizeof(sumFile), 1, stream) != 1)
+      return PBErrBinIOError(that, "fread failed for a CRC");
+    PBErrBinToLE(&sumFile, sizeof(sumFile), 1);
+    if (sum != sumFile)
+      return PBErrBinInvalid(that, "CRC mismatch");
+  }
+  PBErrBinToLE(data, size, nbVal);
+  if (isStr)
+    ((char*)data)[nbVal] = '\0';
+  return true;
+}
+
+bool _PBErrBinWriteShort(PBErr* const that, FILE* const stream, 
+  const short data) {
+  int16_t val = data;
+  return PBErrBinWriteBlock(that, stream, PBErrBinTypeShort, false, 
+    false, &val, 1);
+}
+
+bool _PBErrBinWriteInt(PBErr* const that, FILE* const stream, 
+  const int data) {
+  int32_t val = data;
+  return PBErrBinWriteBlock(that, stream, PBErrBinTypeInt, false, 
+    false, &val, 1);
+}
+
+bool _PBErrBinWriteLong(PBErr* const that, FILE* const stream, 
+  const long data) {
+  int64_t val = data;
+  return PBErrBinWriteBlock(that, stream, PBErrBinTypeLong, false, 
+    false, &val, 1);
+}
+
+bool _PBErrBinWriteFloat(PBErr* const that, FILE* const stream, 
+  const float data) {
+  return PBErrBinWriteBlock(that, stream, PBErrBinTypeFloat, false, 
+    false, &data, 1);
+}
+
+bool _PBErrBinWriteStr(PBErr* const that, FILE* const stream, 
+  const char* const data) {
+  return PBErrBinWriteBlock(that, stream, PBErrBinTypeChar, true, 
+    false, data, (data != NULL ? strlen(data) : 0));
+}
+
+bool _PBErrBinReadShort(PBErr* const that, FILE* const stream, 
+  short* const data) {
+  int16_t val = 0;
+  if (!PBErrBinReadBlock(that, stream, PBErrBinTypeShort, false, 
+    false, &val, 1))
+    return false;
+  *data = val;
+  return true;
+}
 
+bool _PBErrBinReadInt(PBErr* const that, FILE* const stream, 
+  int* const data) {
+  int32_t val = 0;
+  if (!PBErrBinReadBlock(that, stream, PBErrBinTypeInt, false, 
+    false, &val, 1))
+    return false;
+  *data = val;
+  return true;
+}
+
+bool _PBErrBinReadLong(PBErr* const that, FILE* const stream, 
+  long* const data) {
+  int64_t val = 0;
+  if (!PBErrBinReadBlock(that, stream, PBErrBinTypeLong, false, 
+    false, &val, 1))
+    return false;
+  *data = (long)val;
+  return true;
+}
+
+bool _PBErrBinReadFloat(PBErr* const that, FILE* const stream, 
+  float* const data) {
+  return PBErrBinReadBlock(that, stream, PBErrBinTypeFloat, false, 
+    false, data, 1);
+}
+
+// The arrays are written directly from memory, which requires the
+// types to have the same size in memory and in the file
+_Static_assert(sizeof(short) == 2 && sizeof(int) == 4 && 
+  sizeof(float) == 4, "unsupported sizes of types");
+
+bool _PBErrBinWriteArrayShort(PBErr* const that, FILE* const stream,
+  const short* const data, const size_t nb, const bool crc) {
+  return PBErrBinWriteBlock(that, stream, PBErrBinTypeShort, true, 
+    crc, data, nb);
+}
+
+bool _PBErrBinWriteArrayInt(PBErr* const that, FILE* const stream,
+  const int* const data, const size_t nb, const bool crc) {
+  return PBErrBinWriteBlock(that, stream, PBErrBinTypeInt, true, 
+    crc, data, nb);
+}
+
+bool _PBErrBinWriteArrayLong(PBErr* const that, FILE* const stream,
+  const long* const data, const size_t nb, const bool crc) {
+  _Static_assert(sizeof(long) == 8, "unsupported size of long");
+  return PBErrBinWriteBlock(that, stream, PBErrBinTypeLong, true, 
+    crc, data, nb);
+}
+
+bool _PBErrBinWriteArrayFloat(PBErr* const that, FILE* const stream,
+  const float* const data, const size_t nb, const bool crc) {
+  return PBErrBinWriteBlock(that, stream, PBErrBinTypeFloat, true, 
+    crc, data, nb);
+}
+
+bool _PBErrBinWriteArrayChar(PBErr* const that, FILE* const stream,
+  const char* const data, const size_t nb, const bool crc) {
+  return PBErrBinWriteBlock(that, stream, PBErrBinTypeChar, true, 
+    crc, data, nb);
+}
+
+bool _PBErrBinReadArrayShort(PBErr* const that, FILE* const stream,
+  short* const data, const size_t nb) {
+  return PBErrBinReadBlock(that, stream, PBErrBinTypeShort, true, 
+    false, data, nb);
+}
+
+bool _PBErrBinReadArrayInt(PBErr* const that, FILE* const stream,
+  int* const data, const size_t nb) {
+  return PBErrBinReadBlock(that, stream, PBErrBinTypeInt, true, 
+    false, data, nb);
+}
+
+bool _PBErrBinReadArrayLong(PBErr* const that, FILE* const stream,
+  long* const data, const size_t nb) {
+  return PBErrBinReadBlock(that, stream, PBErrBinTypeLong, true, 
+    false, data, nb);
+}
+
+bool _PBErrBinReadArrayFloat(PBErr* const that, FILE* const stream,
+  float* const data, const size_t nb) {
+  return PBErrBinReadBlock(that, stream, PBErrBinTypeFloat, true, 
+    false, data, nb);
+}
+
+bool _PBErrBinReadArrayChar(PBErr* const that, FILE* const stream,
+  char* const data, const size_t nb) {
+  return PBErrBinReadBlock(that, stream, PBErrBinTypeChar, true, 
+    true, data, nb);
+}
+
+#endif
@@ -13,12 +13,44 @@
 #include <string.h>
 #include <setjmp.h>
 #include <signal.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
 
 
 // ================= Define ==================
 
-#define PBERR_MAXSTACKHEIGHT 10
+// Maximum height, and default height, of the stack captured in the 
+// reports (cf PBErrSetStackHeight)
+#define PBERR_MAXSTACKHEIGHT 64
+#define PBERR_STACKHEIGHTDEFAULT 10
 #define PBERR_MSGLENGTHMAX 256
+// Number of size classes in the allocation statistics
+#define PBERR_NBSIZECLASS 16
+// Maximum number of arguments of a lazily formatted message
+#define PBERR_NBMAXARG 6
+// Version of the binary serialization format
+#define PBERR_BINVERSION 1
+// Version of the binary format of the reports
+#define PBERR_RECVERSION 2
+// Number of events in the ring buffer of trace events of a thread
+#define PBERR_TRACENBEVENT 16384
+// Maximum number of reclaim callbacks
+#define PBERR_NBMAXRECLAIM 32
+// Maximum number of context frames memorized per thread
+#define PBERR_NBMAXCONTEXT 16
+// Maximum length of the formatted context of a report
+#define PBERR_CONTEXTLENGTHMAX 512
+
+// Branch prediction hints
+#define PBERR_LIKELY(Cond) __builtin_expect(!!(Cond), 1)
+#define PBERR_UNLIKELY(Cond) __builtin_expect(!!(Cond), 0)
+
+// Allocation statistics are maintained by the secured malloc except
+// in fast and furious mode
+#if (defined(PBERRALL) || defined(PBERRSAFEMALLOC)) && BUILDMODE != 2
+  #define PBERR_ALLOCSTAT
+#endif
 
 // ================= Data structure ===================
 
@@ -36,6 +68,119 @@ typedef enum PBErrType {
   PBErrTypeNb
 } PBErrType;
 
+// Domains, one per repository using PBErr
+typedef enum PBErrDomain {
+  PBErrDomainPBErr,
+  PBErrDomainPBMath,
+  PBErrDomainGSet,
+  PBErrDomainELORank,
+  PBErrDomainShapoid,
+  PBErrDomainBCurve,
+  PBErrDomainGenBrush,
+  PBErrDomainFracNoise,
+  PBErrDomainGenAlg,
+  PBErrDomainGrad,
+  PBErrDomainKnapSack,
+  PBErrDomainNeuraNet,
+  PBErrDomainPBPhys,
+  PBErrDomainGenTree,
+  PBErrDomainJSON,
+  PBErrDomainMiniFrame,
+  PBErrDomainPixelToPosEstimator,
+  PBErrDomainPBDataAnalysis,
+  PBErrDomainPBImgAnalysis,
+  PBErrDomainPBFileSys,
+  PBErrDomainSDSIA,
+  PBErrDomainGDataSet,
+  PBErrDomainResPublish,
+  PBErrDomainTheSquid,
+  PBErrDomainCBo,
+  PBErrDomainCryptic,
+  PBErrDomainGradAutomaton,
+  PBErrDomainSmally,
+  PBErrDomainBuzzy,
+  PBErrDomainNeuraMorph,
+  PBErrDomainNb
+} PBErrDomain;
+
+// Symbolization modes of the stack in the reports
+typedef enum PBErrSymbolMode {
+  // Symbolize with backtrace_symbols_fd at each report (default)
+  PBErrSymbolModeImmediate,
+  // Symbolize through a cache of symbols shared by all the reports
+  PBErrSymbolModeCached,
+  // Print only the raw addresses and their offset in their module
+  PBErrSymbolModeRaw,
+  PBErrSymbolModeNb
+} PBErrSymbolMode;
+
+// Backends capturing the stacks (cf PBErrUnwindInit)
+typedef enum PBErrUnwinder {
+  // glibc backtrace(), based on the unwind tables (default)
+  PBErrUnwinderBacktrace,
+  // Walk of the chain of frame pointers, only for code compiled with
+  // -fno-omit-frame-pointer, on x86_64 and aarch64
+  PBErrUnwinderFramePointer,
+  PBErrUnwinderNb
+} PBErrUnwinder;
+
+// Output formats of the reports of the catched errors
+typedef enum PBErrFormat {
+  // Human readable text (default)
+  PBErrFormatText,
+  // One JSON object per line
+  PBErrFormatJSON,
+  // Length prefixed binary record (cf PBErrCatch)
+  PBErrFormatBin,
+  PBErrFormatNb
+} PBErrFormat;
+
+// Failures of the secured functions reported by PBErrFailed
+typedef enum PBErrFail {
+  // Null argument
+  PBErrFailNull,
+  // fscanf failed
+  PBErrFailScanf,
+  // fprintf failed
+  PBErrFailPrintf,
+  // malloc failed
+  PBErrFailMalloc,
+  // Invalid alignment
+  PBErrFailAlignment,
+  // Aligned malloc failed
+  PBErrFailMallocAligned,
+  // calloc failed
+  PBErrFailCalloc,
+  // realloc failed
+  PBErrFailRealloc,
+  // mmap of a huge block failed
+  PBErrFailMallocHuge,
+  PBErrFailNb
+} PBErrFail;
+
+// Call site of an error raised with PBErrRaise, one static
+// descriptor per call site
+typedef struct PBErrSite {
+  // Source file
+  const char* _file;
+  // Line in the source file
+  int _line;
+  // Function
+  const char* _func;
+  // Format of the message
+  const char* _format;
+} PBErrSite;
+
+// Raw argument of a lazily formatted message
+typedef union PBErrArg {
+  long _i;
+  unsigned long _u;
+  double _f;
+  const void* _p;
+} PBErrArg;
+
+struct PBErrCollector;
+
 typedef struct PBErr {
   // Error message
   char _msg[PBERR_MSGLENGTHMAX];
@@ -45,40 +190,185 @@ typedef struct PBErr {
   FILE* _stream;
   // Fatal mode, if true exit when catch
   bool _fatal;
+  // Domain of the error
+  PBErrDomain _domain;
+  // Collector receiving a copy of the catched errors, may be null
+  struct PBErrCollector* _collector;
+  // Call site of the error if raised with PBErrRaise, else null
+  const PBErrSite* _site;
+  // Raw arguments of the message if raised with PBErrRaise, the
+  // message is formatted from them only when it's printed
+  PBErrArg _args[PBERR_NBMAXARG];
+  int _nbArg;
+  // Output format of the reports
+  PBErrFormat _format;
 } PBErr;
 
+// Slot of a PBErrCollector
+typedef struct PBErrCollectorSlot {
+  // Copy of the catched error
+  PBErr _err;
+  // Flag raised once _err is completely written
+  atomic_bool _ready;
+} PBErrCollectorSlot;
+
+// Lock-free collector of errors raised by several threads
+typedef struct PBErrCollector {
+  // Slots, in order of arrival of the errors
+  PBErrCollectorSlot* _slots;
+  // Number of slots
+  int _capacity;
+  // Number of slots reserved, never exceeds _capacity
+  atomic_int _nb;
+  // Number of errors dropped because the collector was full
+  atomic_ulong _nbDropped;
+} PBErrCollector;
+
+// Chunk of memory of a PBErrArena
+typedef struct PBErrArenaChunk {
+  // Next chunk
+  struct PBErrArenaChunk* _next;
+  // Size in bytes of the memory of the chunk
+  size_t _size;
+  // Number of bytes used in the memory of the chunk
+  size_t _used;
+  // Memory of the chunk
+  max_align_t _mem[];
+} PBErrArenaChunk;
+
+// Bump pointer allocator, the memory is released all at once
+typedef struct PBErrArena {
+  // PBErr used to report errors
+  PBErr* _err;
+  // First chunk
+  PBErrArenaChunk* _first;
+  // Chunk currently used for allocations
+  PBErrArenaChunk* _cur;
+  // Minimum size in bytes of the chunks
+  size_t _chunkSize;
+} PBErrArena;
+
+// Snapshot of the allocation statistics of a domain
+typedef struct PBErrAllocStat {
+  // Number of bytes currently allocated
+  unsigned long _live;
+  // Maximum of _live
+  unsigned long _peak;
+  // Number of allocations and frees
+  unsigned long _nbAlloc;
+  unsigned long _nbFree;
+  // Number of allocations per size class, the i-th class contains
+  // the sizes in [2^(i+3), 2^(i+4)[, the first one also contains the
+  // smaller sizes and the last one the bigger sizes
+  unsigned long _hist[PBERR_NBSIZECLASS];
+} PBErrAllocStat;
+
+// Reclaim callback: release memory, 'size' bytes if possible, and
+// return the number of bytes released. 'data' is the data given at
+// its registration
+typedef size_t (*PBErrReclaimFun)(const size_t size, void* const data);
+
+// Snapshot of the counters of catched errors
+typedef struct PBErrCountStat {
+  // Number of catched errors per domain and type
+  unsigned long _nb[PBErrDomainNb][PBErrTypeNb];
+  // Number of catched fatal errors per domain
+  unsigned long _nbFatal[PBErrDomainNb];
+} PBErrCountStat;
+
+// Memory mapped input stream
+typedef struct PBErrMap {
+  // Mapped content of the file, null if the file is empty
+  const char* _data;
+  // Size in bytes of the file
+  size_t _size;
+  // Position of the next read
+  size_t _pos;
+} PBErrMap;
+
+// Context frame pushed with PBErrContextPush
+typedef struct PBErrContext {
+  // Call site, whose format describes the context
+  const PBErrSite* _site;
+  // Raw arguments of the description
+  PBErrArg _args[PBERR_NBMAXARG];
+  int _nbArg;
+} PBErrContext;
+
+// Stack of the context frames of a thread
+typedef struct PBErrContextStack {
+  // Number of frames pushed, if it exceeds PBERR_NBMAXCONTEXT only 
+  // the outermost ones are memorized
+  int _nb;
+  // Frames, outermost first
+  PBErrContext _frames[PBERR_NBMAXCONTEXT];
+} PBErrContextStack;
+
+// Scope of a PBErrTry block
+typedef struct PBErrScope {
+  // Context of the PBErrTry
+  sigjmp_buf _env;
+  // Enclosing scope of the calling thread, may be null
+  struct PBErrScope* _prev;
+  // Height of the context stack of the calling thread when entering
+  // the scope
+  int _nbContext;
+  // Copy of the fatal error which unwound to this scope
+  PBErr _err;
+} PBErrScope;
+
 // ================= Global variable ==================
 
 extern PBErr thePBErr;
-extern PBErr* PBMathErr;
-extern PBErr* GSetErr;
-extern PBErr* ELORankErr;
-extern PBErr* ShapoidErr;
-extern PBErr* BCurveErr;
-extern PBErr* GenBrushErr;
-extern PBErr* FracNoiseErr;
-extern PBErr* GenAlgErr;
-extern PBErr* GradErr;
-extern PBErr* KnapSackErr;
-extern PBErr* NeuraNetErr;
-extern PBErr* PBPhysErr;
-extern PBErr* GenTreeErr;
-extern PBErr* JSONErr;
-extern PBErr* MiniFrameErr;
-extern PBErr* PixelToPosEstimatorErr;
-extern PBErr* PBDataAnalysisErr;
-extern PBErr* PBImgAnalysisErr;
-extern PBErr* PBFileSysErr;
-extern PBErr* SDSIAErr;
-extern PBErr* GDataSetErr;
-extern PBErr* ResPublishErr;
-extern PBErr* TheSquidErr;
-extern PBErr* CBoErr;
-extern PBErr* CrypticErr;
-extern PBErr* GradAutomatonErr;
-extern PBErr* SmallyErr;
-extern PBErr* BuzzyErr;
-extern PBErr* NeuraMorphErr;
+// The pointers per repository are thread local: they point toward a
+// default PBErr per repository, shared by all the threads and whose
+// _domain is the one of the repository, until the thread calls 
+// PBErrThreadInit() or the user reassigns them in that thread
+// Unless their own _stream is set, the default PBErr per repository
+// are printed on the _stream and in the _format of thePBErr
+// Changes from the versions where they all pointed toward thePBErr:
+// - reassigning a pointer (e.g. PBMathErr = &myErr) applies only to
+//   the calling thread, the other threads must reassign it too
+// - the errors of a repository are in its own PBErr: they must be
+//   read through its pointer, not through thePBErr, and the _fatal 
+//   flag of thePBErr doesn't apply to them
+extern _Thread_local PBErr* PBMathErr;
+extern _Thread_local PBErr* GSetErr;
+extern _Thread_local PBErr* ELORankErr;
+extern _Thread_local PBErr* ShapoidErr;
+extern _Thread_local PBErr* BCurveErr;
+extern _Thread_local PBErr* GenBrushErr;
+extern _Thread_local PBErr* FracNoiseErr;
+extern _Thread_local PBErr* GenAlgErr;
+extern _Thread_local PBErr* GradErr;
+extern _Thread_local PBErr* KnapSackErr;
+extern _Thread_local PBErr* NeuraNetErr;
+extern _Thread_local PBErr* PBPhysErr;
+extern _Thread_local PBErr* GenTreeErr;
+extern _Thread_local PBErr* JSONErr;
+extern _Thread_local PBErr* MiniFrameErr;
+extern _Thread_local PBErr* PixelToPosEstimatorErr;
+extern _Thread_local PBErr* PBDataAnalysisErr;
+extern _Thread_local PBErr* PBImgAnalysisErr;
+extern _Thread_local PBErr* PBFileSysErr;
+extern _Thread_local PBErr* SDSIAErr;
+extern _Thread_local PBErr* GDataSetErr;
+extern _Thread_local PBErr* ResPublishErr;
+extern _Thread_local PBErr* TheSquidErr;
+extern _Thread_local PBErr* CBoErr;
+extern _Thread_local PBErr* CrypticErr;
+extern _Thread_local PBErr* GradAutomatonErr;
+extern _Thread_local PBErr* SmallyErr;
+extern _Thread_local PBErr* BuzzyErr;
+extern _Thread_local PBErr* NeuraMorphErr;
+// Innermost PBErrTry scope of the calling thread, null if there is
+// none
+extern _Thread_local PBErrScope* PBErrScopeTop;
+// Last PBErrTry scope of the calling thread a fatal error has been
+// unwound to
+extern _Thread_local PBErrScope* PBErrScopeCaught;
+// Context stack of the calling thread
+extern _Thread_local PBErrContextStack PBErrContextCur;
 
 // ================ Functions declaration ====================
 
@@ -89,44 +379,828 @@ PBErr PBErrCreateStatic(void);
 void PBErrReset(PBErr* const that);
 
 // Hook for error handling
+// The report is written on the stream of 'that' in its format, with a
+// single write for the JSON and binary formats so that reports from
+// concurrent threads never interleave
+// JSON format: one object per line with the keys "time" (monotonic 
+// time in ns), "thread", "domain", "type", "msg", "fatal", "errno",
+// "repeat", "site" (if raised with PBErrRaise), "stack" (raw 
+// addresses) and "context" (if any, outermost frame first)
+// Binary format, all integers in little endian: u32 size of the
+// remaining of the record, u8 version (PBERR_RECVERSION), u8 fatal, 
+// u16 domain, u16 type, u16 nb of addresses in the stack, u32 thread,
+// u64 time, u64 repeat, i32 errno, u16 length of the message, the 
+// message (without '\0'), u64 addresses of the stack, u16 length of
+// the context, the context (one line per frame, outermost first)
 void PBErrCatch(PBErr* const that);
 
+// Report the failure 'fail' of a secured function through 'that' 
+// (thePBErr if null). 'name' is the name of the null argument for
+// PBErrFailNull, 'size' the requested size (or alignment for 
+// PBErrFailAlignment)
+// Shared out of line cold path of the inline secured functions
+void PBErrFailed(PBErr* const that, const PBErrFail fail,
+  const char* const name, const size_t size) 
+  __attribute__((cold, noinline));
+
+// Recoverable scope: a fatal error catched by the thread executing
+// the block of PBErrTry unwinds to the block of PBErrTryCatch instead
+// of exiting. Usage:
+//   PBErrTry {
+//     ... 
+//   } PBErrTryCatch(err) {
+//     ... 'err' is a const PBErr* on a copy of the fatal error
+//   } PBErrTryEnd;
+// The error is not printed, and the PBErr which raised it is reset
+// The scopes can be nested, a fatal error unwinds to the innermost
+// one. Catching again a fatal copy of 'err' in the block of 
+// PBErrTryCatch forwards it to the enclosing scope
+// The block of PBErrTry must not be left with return, break or goto,
+// the local variables modified in it and read in the block of 
+// PBErrTryCatch must be volatile, and the memory allocated in it
+// is not freed by the unwinding. Without error, the scope costs 
+// only a sigsetjmp without saving the signal mask
+// The scope is named after the line of PBErrTry, so nested scopes
+// don't shadow each other as long as they start on different lines
+#define PBErrTry \
+  do { \
+    PBErrScope PBERR_CAT(_pbErrScope, __LINE__); \
+    PBErrScopePush(&PBERR_CAT(_pbErrScope, __LINE__)); \
+    if (sigsetjmp(PBERR_CAT(_pbErrScope, __LINE__)._env, 0) == 0) {
+#define PBErrTryCatch(Err) \
+      PBErrScopePop(PBErrScopeTop); \
+    } else { \
+      const PBErr* const Err = &(PBErrScopeCaught->_err); \
+      (void)Err;
+#define PBErrTryEnd \
+    } \
+  } while (false)
+
+// Enter the scope 'scope' (cf PBErrTry)
+static inline void PBErrScopePush(PBErrScope* const scope) {
+  scope->_prev = PBErrScopeTop;
+  scope->_nbContext = PBErrContextCur._nb;
+  PBErrScopeTop = scope;
+}
+
+// Leave the scope 'scope' (cf PBErrTry)
+static inline void PBErrScopePop(PBErrScope* const scope) {
+  PBErrScopeTop = scope->_prev;
+}
+
 // Print the PBErr 'that' on 'stream'
 void PBErrPrintln(const PBErr* const that, FILE* const stream);
 
+// Format the message of the PBErr 'that' into 'buf' of size 'size'
+// and return 'buf'. The message is _msg if it's not empty, else it's
+// formatted from the format of the call site and the raw arguments
+const char* PBErrFormatMsg(const PBErr* const that, char* const buf,
+  const size_t size);
+
+// Raise an error of type 'Type' through the PBErr 'Err'. The
+// following arguments are the format of the message and up to
+// PBERR_NBMAXARG arguments. The arguments are only memorized, the
+// message is formatted when it's printed, so it costs nothing if the 
+// error is not printed. The call site is memorized in a static
+// descriptor
+// Pointers for %p must be cast to void*, and strings for %s must
+// stay valid until the error is printed
+#define PBErrRaise(Err, Type, Fatal, ...) \
+  do { \
+    static const PBErrSite _pbErrSite = {._file = __FILE__, \
+      ._line = __LINE__, ._func = __func__, \
+      ._format = PBERR_FIRSTARG(__VA_ARGS__, _)}; \
+    PBErr* const _pbErr = (Err); \
+    _pbErr->_type = (Type); \
+    _pbErr->_fatal = (Fatal); \
+    _pbErr->_msg[0] = '\0'; \
+    _pbErr->_site = &_pbErrSite; \
+    _pbErr->_nbArg = PBERR_NBARG(__VA_ARGS__) - 1; \
+    PBERR_CAT(PBERR_SETARG, PBERR_NBARG(__VA_ARGS__))( \
+      _pbErr->_args, __VA_ARGS__) \
+    PBErrCatch(_pbErr); \
+  } while (false)
+
+// Conversion of the arguments of PBErrRaise
+static inline PBErrArg PBErrArgInt(const long a) {
+  PBErrArg arg = {._i = a};
+  return arg;
+}
+static inline PBErrArg PBErrArgUInt(const unsigned long a) {
+  PBErrArg arg = {._u = a};
+  return arg;
+}
+static inline PBErrArg PBErrArgFloat(const double a) {
+  PBErrArg arg = {._f = a};
+  return arg;
+}
+static inline PBErrArg PBErrArgPtr(const void* const a) {
+  PBErrArg arg = {._p = a};
+  return arg;
+}
+#define PBErrArgOf(A) _Generic((A), \
+  float: PBErrArgFloat, \
+  double: PBErrArgFloat, \
+  unsigned int: PBErrArgUInt, \
+  unsigned long: PBErrArgUInt, \
+  char*: PBErrArgPtr, \
+  const char*: PBErrArgPtr, \
+  void*: PBErrArgPtr, \
+  const void*: PBErrArgPtr, \
+  default: PBErrArgInt)(A)
+
+// Macros used by PBErrRaise to count and memorize its arguments
+#define PBERR_CAT(A, B) PBERR_CAT_(A, B)
+#define PBERR_CAT_(A, B) A ## B
+#define PBERR_FIRSTARG(A, ...) A
+#define PBERR_NBARG(...) PBERR_NBARG_(__VA_ARGS__, 7, 6, 5, 4, 3, 2, 1, _)
+#define PBERR_NBARG_(A1, A2, A3, A4, A5, A6, A7, N, ...) N
+#define PBERR_SETARG1(Args, F)
+#define PBERR_SETARG2(Args, F, A1) \
+  (Args)[0] = PBErrArgOf(A1);
+#define PBERR_SETARG3(Args, F, A1, A2) \
+  PBERR_SETARG2(Args, F, A1) (Args)[1] = PBErrArgOf(A2);
+#define PBERR_SETARG4(Args, F, A1, A2, A3) \
+  PBERR_SETARG3(Args, F, A1, A2) (Args)[2] = PBErrArgOf(A3);
+#define PBERR_SETARG5(Args, F, A1, A2, A3, A4) \
+  PBERR_SETARG4(Args, F, A1, A2, A3) (Args)[3] = PBErrArgOf(A4);
+#define PBERR_SETARG6(Args, F, A1, A2, A3, A4, A5) \
+  PBERR_SETARG5(Args, F, A1, A2, A3, A4) (Args)[4] = PBErrArgOf(A5);
+#define PBERR_SETARG7(Args, F, A1, A2, A3, A4, A5, A6) \
+  PBERR_SETARG6(Args, F, A1, A2, A3, A4, A5) \
+  (Args)[5] = PBErrArgOf(A6);
+
+// Push on the context stack of the calling thread a frame described
+// by a format and arguments as for PBErrRaise, for example 
+// PBErrContextPush("parsing row %d", iRow). It never allocates memory
+// and the description is formatted only if an error is printed, so 
+// the strings for %s must stay valid until the frame is popped
+// PBErrCatch prints the context stack with the error, outermost frame
+// first. A fatal error unwinding to a PBErrTry scope pops the frames
+// pushed inside it
+#define PBErrContextPush(...) \
+  do { \
+    static const PBErrSite _pbErrSite = {._file = __FILE__, \
+      ._line = __LINE__, ._func = __func__, \
+      ._format = PBERR_FIRSTARG(__VA_ARGS__, _)}; \
+    PBErrContext* const _pbErrContext = PBErrContextPushSite( \
+      &_pbErrSite, PBERR_NBARG(__VA_ARGS__) - 1); \
+    if (_pbErrContext != NULL) { \
+      PBERR_CAT(PBERR_SETARG, PBERR_NBARG(__VA_ARGS__))( \
+        _pbErrContext->_args, __VA_ARGS__) \
+    } \
+  } while (false)
+
+// Push a context frame as PBErrContextPush, popped at the end of the
+// block
+#define PBErrContextScope(...) \
+  PBErrContextPush(__VA_ARGS__); \
+  __attribute__((cleanup(PBErrContextScopeEnd))) \
+    const int PBERR_CAT(_pbErrContextScope, __LINE__) = 0
+
+// Push the call site 'site' with 'nbArg' arguments on the context 
+// stack of the calling thread (cf PBErrContextPush)
+// Return the frame to receive the arguments, or null if the stack is
+// full
+static inline PBErrContext* PBErrContextPushSite(
+  const PBErrSite* const site, const int nbArg) {
+  PBErrContextStack* const stack = &PBErrContextCur;
+  PBErrContext* context = NULL;
+  if (PBERR_LIKELY(stack->_nb < PBERR_NBMAXCONTEXT)) {
+    context = stack->_frames + stack->_nb;
+    context->_site = site;
+    context->_nbArg = nbArg;
+  }
+  ++(stack->_nb);
+  return context;
+}
+
+// Pop the innermost frame of the context stack of the calling thread
+static inline void PBErrContextPop(void) {
+  if (PBERR_LIKELY(PBErrContextCur._nb > 0))
+    --(PBErrContextCur._nb);
+}
+
+// Cleanup function of PBErrContextScope
+static inline void PBErrContextScopeEnd(const int* const scope) {
+  (void)scope;
+  PBErrContextPop();
+}
+
+// Start the asynchronous sink with a ring buffer of at least
+// 'capacity' records. While it's active, PBErrCatch only records
+// non fatal errors, and a background thread prints them
+// The streams of the PBErr must stay open until the records are
+// flushed
+// The ring buffer is allocated at the first start and reused by the
+// following ones, which can't ask for a larger capacity
+// Return false if the sink couldn't be started
+bool PBErrSinkStart(const unsigned int capacity);
+
+// Stop the asynchronous sink after writing all the pending records
+// This is done automatically at exit and before handling a fatal
+// error
+void PBErrSinkStop(void);
+
+// Wait until all the records pushed into the sink so far have been
+// written
+void PBErrSinkFlush(void);
+
+// Return the number of records dropped by the sink because its ring
+// buffer was full
+unsigned long PBErrSinkGetNbDropped(void);
+
+// Deduplicate the non fatal errors: the first 'nbFull' occurences of
+// an error (same type and same stack) are printed in full, then only
+// one summary every 'period' occurences. Fatal errors are always
+// printed in full
+// If 'nbFull' is 0 the deduplication is disabled (default)
+void PBErrSetDedup(const unsigned long nbFull, 
+  const unsigned long period);
+
+// Forget the occurences counted by the deduplication
+// Must not be called while other threads may catch errors
+void PBErrDedupReset(void);
+
+// Return the number of occurences of errors neither printed nor 
+// summarized because of the deduplication
+unsigned long PBErrDedupGetNbSuppressed(void);
+
+// Set the symbolization mode of the stack in the reports
+void PBErrSetSymbolMode(const PBErrSymbolMode mode);
+
+// Symbolize the address 'addr' into 'buf' of size 'size', using the 
+// cache of symbols shared by all the reports
+// Return 'buf'
+const char* PBErrSymbolize(const void* const addr, char* const buf,
+  const size_t size);
+
+// Select the backend 'unwinder' capturing the stacks of the reports,
+// of the crash handler and of the profilers, and pre-warm it in the 
+// calling thread so the first capture doesn't stall: the first call
+// of backtrace() takes a lock and loads libgcc, the frame pointer 
+// walk needs the bounds of the stack of the thread
+// The frame pointer walk takes no lock and allocates nothing, it is
+// safe in signal handlers and after fork(). Each frame is checked 
+// against the bounds of the stack, so code without frame pointers
+// ends the walk early instead of crashing it. The bounds are looked
+// for by the first capture in a thread, by PBErrThreadInit and by
+// this function. Until then, the stack of the code interrupted by 
+// the profilers and the crash handler is reduced to the interrupted
+// instruction
+// Return false if the backend is not available on this architecture,
+// the current one is then unchanged
+bool PBErrUnwindInit(const PBErrUnwinder unwinder);
+
+// Return the current backend capturing the stacks
+PBErrUnwinder PBErrGetUnwinder(void);
+
+// Capture with the current backend at most 'height' return addresses
+// of the stack of the calling function into 'stack', innermost first
+// Return the number of captured addresses
+int PBErrStackCapture(void** const stack, const int height);
+
+// Set the height of the stack captured in the reports and by the 
+// crash handler, clipped to [0, PBERR_MAXSTACKHEIGHT] 
+// (PBERR_STACKHEIGHTDEFAULT by default). If 0 the stack is not 
+// captured
+void PBErrSetStackHeight(const int height);
+
+// Return the height of the stack captured in the reports
+int PBErrGetStackHeight(void);
+
+// Open the log of raw addresses at 'path'. The stack of each report
+// is appended to it as lines '<module path> <offset in module>',
+// and an empty line after each report, for offline symbolization
+// (cf pberrsym.sh)
+// Return false if the log couldn't be opened
+bool PBErrAddrLogOpen(const char* const path);
+
+// Close the log of raw addresses
+void PBErrAddrLogClose(void);
+
+// Install the crash handler: on SIGSEGV, SIGBUS, SIGFPE and SIGILL a
+// report (signal, faulting address, registers, raw stack and last
+// error catched per domain) is written on the file descriptor 'fd' 
+// (stderr if 'fd' is negative), then the signal is raised again with
+// its default action so the core is still dumped
+// The handler uses only async-signal-safe calls and preallocated 
+// memory. It runs on an alternate stack in the calling thread (to 
+// report stack overflows), and on their own stack in other threads
+// unless they call PBErrCrashHandlerThreadInit
+// Return false if the handler couldn't be installed
+bool PBErrCrashHandlerInstall(const int fd);
+
+// Uninstall the crash handler and restore the previous actions, and
+// the previous alternate stack if called from the installing thread
+void PBErrCrashHandlerUninstall(void);
+
+// Give the calling thread an alternate stack, freed when the thread
+// exits, so the crash handler can report its stack overflows. An 
+// alternate stack already set by the user is kept
+// Return false if the stack couldn't be allocated or set
+bool PBErrCrashHandlerThreadInit(void);
+
+// Start the sampling profiler at 'frequency' samples per second of
+// CPU time of the process (ITIMER_PROF). At each sample the stack of
+// the running thread is recorded with the current unwinder (cf 
+// PBErrUnwindInit) into a lock-free preallocated table
+// Return false if it couldn't be started
+bool PBErrProfStart(const unsigned int frequency);
+
+// Stop the sampling profiler and print the sampled stacks on 'stream'
+// (if not null) in the folded format (one line per stack, functions 
+// from the outermost to the innermost separated by ';', then the 
+// number of samples) as read by flame graph tools
+// Return false if the profiler wasn't started or the stacks couldn't
+// be printed
+bool PBErrProfStop(FILE* const stream);
+
+// Return the number of samples of the profiler since its last start
+unsigned long PBErrProfGetNbSample(void);
+
+// Return the number of samples dropped because the table of stacks
+// of the profiler was full
+unsigned long PBErrProfGetNbDropped(void);
+
+// Start the sampling heap profiler: about one allocation every 'rate'
+// bytes allocated with the PBErrMalloc functions is sampled (the 
+// sampled bytes follow a geometric distribution of mean 'rate'), and
+// its stack recorded into a preallocated table of live samples until
+// it's freed. Each thread notices the start after at most 64KB of 
+// allocations
+// Return false if it couldn't be started, or if the allocations are 
+// not accounted (cf PBERR_ALLOCSTAT)
+bool PBErrHeapProfStart(const size_t rate);
+
+// Stop the heap profiler and forget its live samples
+void PBErrHeapProfStop(void);
+
+// Print the heap profile on 'stream' in the folded format (one line 
+// per stack, functions from the outermost to the innermost separated
+// by ';', then the estimated number of live bytes allocated from this
+// stack)
+// Return false if the heap profiler isn't started
+bool PBErrHeapProfDump(FILE* const stream);
+
+// Request a dump of the heap profile into the file at 'path' when the
+// signal 'sig' is received. The signal handler only raises a flag, 
+// the dump is written by the next sample of the heap profiler or call
+// to PBErrHeapProfPoll()
+// Return false if the handler couldn't be installed
+bool PBErrHeapProfDumpOnSignal(const int sig, const char* const path);
+
+// Write the dump of the heap profile requested by signal, if any
+void PBErrHeapProfPoll(void);
+
+// Return the number of live samples of the heap profiler
+unsigned long PBErrHeapProfGetNbLive(void);
+
+// Enable or disable the recording of the trace events. Disabled by
+// default
+void PBErrTraceEnable(const bool enable);
+
+// Record a trace event of phase 'phase' ('B'egin, 'E'nd, 'C'ounter,
+// 'i'nstant) named 'name' in the domain 'domain' with the value 
+// 'value', timestamped with the monotonic time, into the ring buffer
+// of the calling thread. The ring buffer keeps the last 
+// PBERR_TRACENBEVENT events. 'name' must stay valid until the trace
+// is exported. The ring of an exited thread is kept for the export
+// until a new thread reuses it (cf PBErrTraceGetNbDropped)
+// Use the macros PBErrTraceBegin, PBErrTraceEnd, PBErrTraceScope and
+// PBErrTraceCounter instead, which are compiled out in fast and
+// furious mode
+void PBErrTraceRecord(const PBErrDomain domain, const char* const name,
+  const char phase, const long value);
+
+// Print the trace events recorded by all the threads on 'stream' in
+// the Chrome trace event JSON format. The threads are identified by
+// PBErrThreadId and the categories are the domains. The errors 
+// catched while the trace is enabled are instant events named after
+// their type. Must be called while no thread records events
+// Return false if the trace couldn't be printed
+bool PBErrTraceExport(FILE* const stream);
+
+// Forget the trace events recorded by all the threads
+// Must be called while no thread records events
+void PBErrTraceReset(void);
+
+// Return the number of events of exited threads discarded since the
+// last reset because a new thread reused their ring
+unsigned long PBErrTraceGetNbDropped(void);
+
+// Scope of PBErrTraceScope
+typedef struct PBErrTraceScopeData {
+  PBErrDomain _domain;
+  const char* _name;
+} PBErrTraceScopeData;
+
+// Begin the scope 'name' of the domain 'domain'
+static inline PBErrTraceScopeData PBErrTraceScopeBegin(
+  const PBErrDomain domain, const char* const name) {
+  PBErrTraceRecord(domain, name, 'B', 0);
+  PBErrTraceScopeData scope = {._domain = domain, ._name = name};
+  return scope;
+}
+
+// End the scope 'scope', called when the variable declared by
+// PBErrTraceScope goes out of scope
+static inline void PBErrTraceScopeEnd(
+  const PBErrTraceScopeData* const scope) {
+  PBErrTraceRecord(scope->_domain, scope->_name, 'E', 0);
+}
+
+// Trace macros, 'Name' must be a string literal
+#if BUILDMODE != 2
+  #define PBErrTraceBegin(Domain, Name) \
+    PBErrTraceRecord(Domain, Name, 'B', 0)
+  #define PBErrTraceEnd(Domain, Name) \
+    PBErrTraceRecord(Domain, Name, 'E', 0)
+  // Trace the block from this point to its end
+  #define PBErrTraceScope(Domain, Name) \
+    __attribute__((cleanup(PBErrTraceScopeEnd))) \
+    const PBErrTraceScopeData PBERR_CAT(_pbErrTraceScope, __LINE__) = \
+      PBErrTraceScopeBegin(Domain, Name)
+  #define PBErrTraceCounter(Domain, Name, Value) \
+    PBErrTraceRecord(Domain, Name, 'C', (long)(Value))
+#else
+  #define PBErrTraceBegin(Domain, Name) do {} while (false)
+  #define PBErrTraceEnd(Domain, Name) do {} while (false)
+  #define PBErrTraceScope(Domain, Name) do {} while (false)
+  #define PBErrTraceCounter(Domain, Name, Value) do {} while (false)
+#endif
+
+// Give the calling thread its own PBErr per domain and make the
+// pointers per repository point toward them. The errors catched
+// through these PBErr are copied into 'collector' if it's not null
+// They are allocated at the first call and freed when the thread 
+// exits. The bounds of the stack of the thread are also looked for,
+// for the frame pointer walk (cf PBErrUnwindInit)
+// Return false if they couldn't be allocated
+bool PBErrThreadInit(PBErrCollector* const collector);
+
+// Return the identifier of the calling thread, numbered from 1 in
+// the order of the first call per thread
+unsigned int PBErrThreadId(void);
+
+// Return the PBErr of the calling thread for the domain 'domain', or
+// the default one of the domain if PBErrThreadInit() hasn't been 
+// called by this thread
+PBErr* PBErrThread(const PBErrDomain domain);
+
+// Create a collector able to memorize up to 'capacity' errors
+PBErrCollector* PBErrCollectorCreate(const int capacity);
+
+// Free the memory used by the collector 'that'
+void PBErrCollectorFree(PBErrCollector** that);
+
+// Empty the collector 'that'
+// Must not be called while other threads may push into it
+void PBErrCollectorReset(PBErrCollector* const that);
+
+// Push a copy of the PBErr 'err' into the collector 'that'
+// Return false if the collector is full
+bool PBErrCollectorPush(PBErrCollector* const that,
+  const PBErr* const err);
+
+// Return the number of errors pushed into the collector 'that',
+// including the ones dropped because it was full
+unsigned long PBErrCollectorGetNbPushed(
+  const PBErrCollector* const that);
+
+// Return the 'iErr'-th error memorized by the collector 'that', or
+// null if there is no such error or it's not yet completely written
+const PBErr* PBErrCollectorGet(const PBErrCollector* const that,
+  const int iErr);
+
+// Return the first error pushed into the collector 'that', or null
+// if there is none yet
+const PBErr* PBErrCollectorFirst(const PBErrCollector* const that);
+
 // Secured malloc
 #if defined(PBERRALL) || defined(PBERRSAFEMALLOC)
+#if BUILDMODE != 0
+  static inline
+#endif
   void* PBErrMalloc(PBErr* const that, const size_t size);
+  // Aligned malloc, 'alignment' must be a power of 2 multiple of 
+  // sizeof(void*)
+#if BUILDMODE != 0
+  static inline
+#endif
+  void* PBErrMallocAligned(PBErr* const that, const size_t alignment,
+    const size_t size);
+#if BUILDMODE != 0
+  static inline
+#endif
+  void* PBErrCalloc(PBErr* const that, const size_t nb, 
+    const size_t size);
+  // Realloc of memory allocated with the PBErrMalloc functions. If it
+  // fails, 'ptr' is still valid. If 'size' is 0, 'ptr' is freed and
+  // null is returned
+#if BUILDMODE != 0
+  static inline
+#endif
+  void* PBErrRealloc(PBErr* const that, void* const ptr, 
+    const size_t size);
+  // Free the memory allocated with PBErrMalloc, PBErrMallocAligned,
+  // PBErrCalloc and PBErrRealloc
+#if BUILDMODE != 0
+  static inline
+#endif
+  void PBErrFree(PBErr* const that, void* const ptr);
+  // Allocate 'size' bytes with mmap, aligned on a huge page and 
+  // advised to use transparent huge pages (normal pages are used if
+  // they are unavailable). For large buffers, freed with 
+  // PBErrFreeHuge
+  void* PBErrMallocHuge(PBErr* const that, const size_t size);
+  // Free the memory 'ptr' of 'size' bytes allocated with 
+  // PBErrMallocHuge
+  void PBErrFreeHuge(PBErr* const that, void* const ptr, 
+    const size_t size);
+#if defined(PBERR_ALLOCSTAT)
+  // Account the allocation, free, and realloc of 'ptr' in the 
+  // statistics of the domain of 'that', used by the PBErrMalloc 
+  // functions
+  void _PBErrAllocStatAdd(const PBErr* const that, 
+    void* const ptr);
+  void _PBErrAllocStatSub(const PBErr* const that, 
+    void* const ptr);
+  void _PBErrAllocStatResize(const PBErr* const that, 
+    const long iSample, const uintptr_t sample, const size_t sizeOld, 
+    void* const ptr);
+  // Return the usable size of the memory 'ptr' and look up its sample
+  // in the heap profiler, without modifying it, before it's 
+  // reallocated
+  size_t _PBErrAllocStatPeek(void* const ptr, long* const iSample, 
+    uintptr_t* const sample);
+#endif
+  // Call the reclaim callbacks and retry the allocation which failed
+  // with 'fail' after each callback releasing memory. 'ptr' is the 
+  // memory to realloc, 'arg' the alignment or number of elements
+  // Return the allocated memory, or null if it still fails
+  void* _PBErrReclaimRetry(PBErr* const that, const PBErrFail fail,
+    void* const ptr, const size_t arg, const size_t size) 
+    __attribute__((cold, noinline));
 #else
-  #define PBErrMalloc(That, Size) malloc(Size)
+  #define PBErrMalloc(That, Size) ((void)(That), malloc(Size))
+  #define PBErrMallocAligned(That, Alignment, Size) \
+    ((void)(That), aligned_alloc(Alignment, \
+    ((Size) + (Alignment) - 1) / (Alignment) * (Alignment)))
+  #define PBErrCalloc(That, Nb, Size) ((void)(That), calloc(Nb, Size))
+  #define PBErrRealloc(That, Ptr, Size) \
+    ((void)(That), realloc(Ptr, Size))
+  #define PBErrFree(That, Ptr) ((void)(That), free(Ptr))
+  #define PBErrMallocHuge(That, Size) ((void)(That), malloc(Size))
+  #define PBErrFreeHuge(That, Ptr, Size) \
+    ((void)(That), (void)(Size), free(Ptr))
 #endif
 
+// Register the reclaim callback 'fun' with 'data' for the domain
+// 'domain'. When an allocation of the PBErrMalloc functions fails, 
+// the callbacks are called (the ones of the domain of the PBErr first,
+// then the other ones, each in decreasing order of 'priority') and 
+// the allocation is retried after each callback releasing memory, 
+// until it succeeds. The error is raised only if it still fails after
+// all the callbacks
+// The callbacks may allocate and free memory, but their allocations 
+// don't call the callbacks again
+// Return false if there are already PBERR_NBMAXRECLAIM callbacks
+bool PBErrReclaimAdd(const PBErrDomain domain, const int priority,
+  const PBErrReclaimFun fun, void* const data);
+
+// Unregister the reclaim callback 'fun' with 'data'
+// Return false if it wasn't registered
+bool PBErrReclaimRemove(const PBErrReclaimFun fun, void* const data);
+
+// Call the reclaim callbacks, the ones of 'domain' first, until 'size'
+// bytes are released
+// Return the number of bytes released
+size_t PBErrReclaim(const PBErrDomain domain, const size_t size);
+
+// Set the soft budget of live bytes allocated with the PBErrMalloc
+// functions to 'budget' (0 to disable it, default). When the live 
+// bytes of all the domains exceed the budget, the reclaim callbacks
+// are called to release the excess. The live bytes are checked by 
+// each thread every 64KB it allocates or frees, and by one thread at
+// a time, so the budget may be exceeded by as much before the 
+// callbacks are called. It should be set below the memory actually 
+// available
+// Return false if the allocations are not accounted 
+// (cf PBERR_ALLOCSTAT)
+bool PBErrReclaimSetBudget(const size_t budget);
+
+// Get a snapshot of the allocation statistics of the domain 'domain'
+// into 'stat'. The memory allocated with PBErrMalloc is accounted in
+// the domain of the PBErr given to PBErrMalloc, and must be freed
+// with PBErrFree to be accounted as freed
+// Each thread accounts its allocations locally and folds them into 
+// the statistics of the domains every 64KB it allocates or frees, and
+// at its exit. The snapshot includes all the allocations of the 
+// calling thread, but may miss the last ones of the other threads.
+// The peak is the one observed at the folds
+// The statistics are all null if PBERR_ALLOCSTAT is not defined
+void PBErrAllocStatGet(const PBErrDomain domain, 
+  PBErrAllocStat* const stat);
+
+// Print the allocation statistics of the domains having allocated
+// memory on the stream 'stream'
+void PBErrAllocStatPrint(FILE* const stream);
+
+// Get a snapshot of the counters of catched errors into 'stat'
+// Every error given to PBErrCatch is counted in the domain and type
+// of its PBErr, including the ones raised by the secured malloc and
+// I/O, and whether or not it's printed (deduplication, sink)
+void PBErrCountGet(PBErrCountStat* const stat);
+
+// Reset the counters of catched errors
+void PBErrCountReset(void);
+
+// Print the counters of catched errors, the statistics of the 
+// deduplication, sink and allocations on 'stream' in the text format
+// of Prometheus. Only the non null counters are printed
+void PBErrCountPrint(FILE* const stream);
+
+// Print the metrics as PBErrCountPrint into the file at 'path'. The
+// file is written aside and renamed so that readers never see it 
+// partially written
+// Return false if the file couldn't be written
+bool PBErrCountExport(const char* const path);
+
+// Static constructor for an arena allocating chunks of at least
+// 'chunkSize' bytes, and reporting errors through 'err'
+PBErrArena PBErrArenaCreateStatic(PBErr* const err, 
+  const size_t chunkSize);
+
+// Allocate 'size' bytes in the arena 'that'
+// The memory is aligned as for malloc
+void* PBErrArenaAlloc(PBErrArena* const that, const size_t size);
+
+// Release at once all the allocations in the arena 'that', its 
+// chunks are kept for the following allocations
+void PBErrArenaReset(PBErrArena* const that);
+
+// Free the chunks of the arena 'that'
+void PBErrArenaRelease(PBErrArena* const that);
+
+// Return the arena of the calling thread, released when the thread
+// exits
+PBErrArena* PBErrArenaThread(void);
+
 // Secured I/O
 #if defined(PBERRALL) || defined(PBERRSAFEIO)
   FILE* PBErrOpenStreamIn(PBErr* const that, const char* const path);
   FILE* PBErrOpenStreamOut(PBErr* const that, const char* const path);
   void PBErrCloseStream(PBErr* const that, FILE* const fd);
 
+  // Open an output stream whose writes are buffered in memory and
+  // written to the file by a background thread, closed with
+  // PBErrCloseStream
+  FILE* PBErrOpenStreamOutAsync(PBErr* const that, 
+    const char* const path);
+
+  // Open an output stream writing into a temporary file next to 
+  // 'path', renamed as 'path' once its content is durable. The 
+  // streams closed with PBErrCloseStream are committed in groups by a
+  // syncer thread, which syncs their data and their directories once
+  // per group, and renames them. The streams closed but not yet 
+  // committed are committed before the process exits
+  FILE* PBErrOpenStreamOutDurable(PBErr* const that, 
+    const char* const path);
+
+  // Wait until the durable streams closed so far are committed. The
+  // failures since the previous call are raised as one non fatal 
+  // IOError through 'that'
+  // Return false if there were failures
+  bool PBErrDurableSync(PBErr* const that);
+
+#if BUILDMODE != 0
+  static inline
+#endif
   bool _PBErrScanfShort(PBErr* const that, 
     FILE* const stream, const char* const format, short* const data);
+#if BUILDMODE != 0
+  static inline
+#endif
   bool _PBErrScanfInt(PBErr* const that, 
     FILE* const stream, const char* const format, int* const data);
+#if BUILDMODE != 0
+  static inline
+#endif
   bool _PBErrScanfFloat(PBErr* const that, 
     FILE* const stream, const char* const format, float* const data);
+#if BUILDMODE != 0
+  static inline
+#endif
   bool _PBErrScanfStr(PBErr* const that, 
     FILE* const stream, const char* const format, char* const data);
     
+#if BUILDMODE != 0
+  static inline
+#endif
   bool _PBErrPrintfShort(PBErr* const that, 
     FILE* const stream, const char* const format, const short data);
+#if BUILDMODE != 0
+  static inline
+#endif
   bool _PBErrPrintfInt(PBErr* const that, 
     FILE* const stream, const char* const format, const int data);
+#if BUILDMODE != 0
+  static inline
+#endif
   bool _PBErrPrintfLong(PBErr* const that, 
     FILE* const stream, const char* const format, const long data);
+#if BUILDMODE != 0
+  static inline
+#endif
   bool _PBErrPrintfFloat(PBErr* const that, 
     FILE* const stream, const char* const format, const float data);
+#if BUILDMODE != 0
+  static inline
+#endif
   bool _PBErrPrintfStr(PBErr* const that, 
     FILE* const stream, const char* const format, 
     const char* const data);
+
+  // Memory mapped input stream, read with PBErrScanfMap
+  PBErrMap* PBErrOpenMapIn(PBErr* const that, const char* const path);
+  void PBErrCloseMap(PBErr* const that, PBErrMap* const map);
+
+  bool _PBErrScanfMapShort(PBErr* const that, 
+    PBErrMap* const map, short* const data);
+  bool _PBErrScanfMapInt(PBErr* const that, 
+    PBErrMap* const map, int* const data);
+  bool _PBErrScanfMapFloat(PBErr* const that, 
+    PBErrMap* const map, float* const data);
+  bool _PBErrScanfMapStr(PBErr* const that, 
+    PBErrMap* const map, char* const data);
+
+  // Binary serialization, the data are stored in little endian and
+  // each value or array is preceded by its type
+  bool PBErrBinWriteHeader(PBErr* const that, FILE* const stream);
+  bool PBErrBinReadHeader(PBErr* const that, FILE* const stream);
+
+  bool _PBErrBinWriteShort(PBErr* const that, FILE* const stream, 
+    const short data);
+  bool _PBErrBinWriteInt(PBErr* const that, FILE* const stream, 
+    const int data);
+  bool _PBErrBinWriteLong(PBErr* const that, FILE* const stream, 
+    const long data);
+  bool _PBErrBinWriteFloat(PBErr* const that, FILE* const stream, 
+    const float data);
+  bool _PBErrBinWriteStr(PBErr* const that, FILE* const stream, 
+    const char* const data);
+
+  bool _PBErrBinReadShort(PBErr* const that, FILE* const stream, 
+    short* const data);
+  bool _PBErrBinReadInt(PBErr* const that, FILE* const stream, 
+    int* const data);
+  bool _PBErrBinReadLong(PBErr* const that, FILE* const stream, 
+    long* const data);
+  bool _PBErrBinReadFloat(PBErr* const that, FILE* const stream, 
+    float* const data);
+
+  bool _PBErrBinWriteArrayShort(PBErr* const that, FILE* const stream,
+    const short* const data, const size_t nb, const bool crc);
+  bool _PBErrBinWriteArrayInt(PBErr* const that, FILE* const stream,
+    const int* const data, const size_t nb, const bool crc);
+  bool _PBErrBinWriteArrayLong(PBErr* const that, FILE* const stream,
+    const long* const data, const size_t nb, const bool crc);
+  bool _PBErrBinWriteArrayFloat(PBErr* const that, FILE* const stream,
+    const float* const data, const size_t nb, const bool crc);
+  bool _PBErrBinWriteArrayChar(PBErr* const that, FILE* const stream,
+    const char* const data, const size_t nb, const bool crc);
+
+  bool _PBErrBinReadArrayShort(PBErr* const that, FILE* const stream,
+    short* const data, const size_t nb);
+  bool _PBErrBinReadArrayInt(PBErr* const that, FILE* const stream,
+    int* const data, const size_t nb);
+  bool _PBErrBinReadArrayLong(PBErr* const that, FILE* const stream,
+    long* const data, const size_t nb);
+  bool _PBErrBinReadArrayFloat(PBErr* const that, FILE* const stream,
+    float* const data, const size_t nb);
+  bool _PBErrBinReadArrayChar(PBErr* const that, FILE* const stream,
+    char* const data, const size_t nb);
+
+  bool _PBErrPrintfArrayShort(PBErr* const that, FILE* const stream,
+    const char* const format, const short* const data, 
+    const size_t nb);
+  bool _PBErrPrintfArrayInt(PBErr* const that, FILE* const stream,
+    const char* const format, const int* const data, const size_t nb);
+  bool _PBErrPrintfArrayLong(PBErr* const that, FILE* const stream,
+    const char* const format, const long* const data, const size_t nb);
+  bool _PBErrPrintfArrayFloat(PBErr* const that, FILE* const stream,
+    const char* const format, const float* const data, 
+    const size_t nb);
+
+  bool _PBErrScanfArrayShort(PBErr* const that, FILE* const stream,
+    const char* const format, short* const data, const size_t nb);
+  bool _PBErrScanfArrayInt(PBErr* const that, FILE* const stream,
+    const char* const format, int* const data, const size_t nb);
+  bool _PBErrScanfArrayLong(PBErr* const that, FILE* const stream,
+    const char* const format, long* const data, const size_t nb);
+  bool _PBErrScanfArrayFloat(PBErr* const that, FILE* const stream,
+    const char* const format, float* const data, const size_t nb);
 #else
   #define PBErrOpenStreamIn(Err, Path) \
     fopen(Path, "r")
@@ -134,6 +1208,12 @@ void PBErrPrintln(const PBErr* const that, FILE* const stream);
     fopen(Path, "w")
   #define PBErrCloseStream(Err, Stream) \
     fclose(Stream)
+  #define PBErrOpenStreamOutAsync(Err, Path) \
+    fopen(Path, "w")
+  #define PBErrOpenStreamOutDurable(Err, Path) \
+    fopen(Path, "w")
+  #define PBErrDurableSync(Err) \
+    ((void)(Err), true)
 
   #define PBErrScanf(Err, Stream, Format, Data) \
     (fscanf(Stream, Format, Data) == EOF)
@@ -161,6 +1241,98 @@ void PBErrInvalidPolymorphism(void*t, ...);
     float: _PBErrPrintfFloat, \
     char*: _PBErrPrintfStr, \
     default: PBErrInvalidPolymorphism) (Err, Stream, Format, Data)
+
+  // Read the next whitespace separated value from a PBErrMap, as
+  // fscanf with the formats %hd, %d, %f and %s would do
+  #define PBErrScanfMap(Err, Map, Data) _Generic(Data, \
+    short*: _PBErrScanfMapShort, \
+    int*: _PBErrScanfMapInt, \
+    float*: _PBErrScanfMapFloat, \
+    char*: _PBErrScanfMapStr, \
+    default: PBErrInvalidPolymorphism) (Err, Map, Data)
+
+  // Print the 'Nb' values of the array 'Data', each one with the 
+  // format 'Format' which must contain one conversion only
+  #define PBErrPrintfArray(Err, Stream, Format, Data, Nb) \
+    _Generic(Data, \
+    short*: _PBErrPrintfArrayShort, \
+    const short*: _PBErrPrintfArrayShort, \
+    int*: _PBErrPrintfArrayInt, \
+    const int*: _PBErrPrintfArrayInt, \
+    long*: _PBErrPrintfArrayLong, \
+    const long*: _PBErrPrintfArrayLong, \
+    float*: _PBErrPrintfArrayFloat, \
+    const float*: _PBErrPrintfArrayFloat, \
+    default: PBErrInvalidPolymorphism) (Err, Stream, Format, Data, Nb)
+
+  // Read 'Nb' values into the array 'Data', each one with the 
+  // format 'Format' which must contain one conversion only
+  #define PBErrScanfArray(Err, Stream, Format, Data, Nb) \
+    _Generic(Data, \
+    short*: _PBErrScanfArrayShort, \
+    int*: _PBErrScanfArrayInt, \
+    long*: _PBErrScanfArrayLong, \
+    float*: _PBErrScanfArrayFloat, \
+    default: PBErrInvalidPolymorphism) (Err, Stream, Format, Data, Nb)
+
+  // Write the value 'Data' in binary, strings are written as arrays
+  // of char
+  #define PBErrBinWrite(Err, Stream, Data) _Generic(Data, \
+    short: _PBErrBinWriteShort, \
+    int: _PBErrBinWriteInt, \
+    long: _PBErrBinWriteLong, \
+    float: _PBErrBinWriteFloat, \
+    char*: _PBErrBinWriteStr, \
+    const char*: _PBErrBinWriteStr, \
+    default: PBErrInvalidPolymorphism) (Err, Stream, Data)
+
+  // Read a value written with PBErrBinWrite, strings must be read
+  // with PBErrBinReadArray
+  #define PBErrBinRead(Err, Stream, Data) _Generic(Data, \
+    short*: _PBErrBinReadShort, \
+    int*: _PBErrBinReadInt, \
+    long*: _PBErrBinReadLong, \
+    float*: _PBErrBinReadFloat, \
+    default: PBErrInvalidPolymorphism) (Err, Stream, Data)
+
+  // Write the 'Nb' values of the array 'Data' in binary, in one block
+  // The CRC variant appends the CRC32 of the block, checked when 
+  // reading it
+  #define PBErrBinWriteArrayAny(Err, Stream, Data, Nb, Crc) \
+    _Generic(Data, \
+    short*: _PBErrBinWriteArrayShort, \
+    const short*: _PBErrBinWriteArrayShort, \
+    int*: _PBErrBinWriteArrayInt, \
+    const int*: _PBErrBinWriteArrayInt, \
+    long*: _PBErrBinWriteArrayLong, \
+    const long*: _PBErrBinWriteArrayLong, \
+    float*: _PBErrBinWriteArrayFloat, \
+    const float*: _PBErrBinWriteArrayFloat, \
+    char*: _PBErrBinWriteArrayChar, \
+    const char*: _PBErrBinWriteArrayChar, \
+    default: PBErrInvalidPolymorphism) (Err, Stream, Data, Nb, Crc)
+  #define PBErrBinWriteArray(Err, Stream, Data, Nb) \
+    PBErrBinWriteArrayAny(Err, Stream, Data, Nb, false)
+  #define PBErrBinWriteArrayCRC(Err, Stream, Data, Nb) \
+    PBErrBinWriteArrayAny(Err, Stream, Data, Nb, true)
+
+  // Read an array written with PBErrBinWriteArray(CRC) into 'Data'
+  // The number of values must be 'Nb', except for arrays of char which
+  // are read as a null terminated string of at most 'Nb' char
+  // including the null character
+  #define PBErrBinReadArray(Err, Stream, Data, Nb) _Generic(Data, \
+    short*: _PBErrBinReadArrayShort, \
+    int*: _PBErrBinReadArrayInt, \
+    long*: _PBErrBinReadArrayLong, \
+    float*: _PBErrBinReadArrayFloat, \
+    char*: _PBErrBinReadArrayChar, \
+    default: PBErrInvalidPolymorphism) (Err, Stream, Data, Nb)
+#endif
+
+// ================ Inliner ====================
+
+#if BUILDMODE != 0
+#include "pberr-inline.c"
 #endif
 
 #endif
@@ -0,0 +1,22 @@
+#!/bin/sh
+# Offline symbolization of the log of raw addresses produced by
+# PBErrAddrLogOpen()
+# Usage: pberrsym.sh <address log>
+# Each line '<module path> <offset>' is converted to
+# '<function> at <file>:<line>' with addr2line, empty lines separate
+# the reports
+
+if [ $# -ne 1 ]; then
+  echo "Usage: $0 <address log>" >&2
+  exit 1
+fi
+
+while read -r module offset; do
+  if [ -z "$module" ]; then
+    echo "--------------------"
+  elif [ "$module" = "??" ]; then
+    echo "?? ($offset)"
+  else
+    addr2line -f -p -C -e "$module" "$offset"
+  fi
+done < "$1"